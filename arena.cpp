@@ -0,0 +1,122 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file arena.cpp
+ * The memory arena component takes blocks of ARENA_BLOCK bytes from the
+ * heap and hands out aligned pieces of them. Larger requests get a block
+ * of their own.
+ * @par More info:
+ * - http://en.wikipedia.org/wiki/Region-based_memory_management
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The memory arena component implementation.
+ */
+
+// C++ Standard Library headers
+#include <algorithm>
+
+// C++ (C Standard Library) headers
+#include <cassert>
+#include <cstdlib>
+
+// Local C++ headers
+#include "arena.hpp"
+
+/**
+ * @brief Round up to a multiple of the alignment.
+ * @param [in] value The value.
+ * @param [in] alignment The alignment, a power of two.
+ * @return The rounded value.
+ */
+static size_t
+align(size_t value, size_t alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+Arena::Arena(void) : used(0), capacity(0), total(0)
+{
+}
+
+Arena::~Arena(void)
+{
+	clear();
+}
+
+void
+Arena::clear(void)
+{
+	for (size_t i = 0; i < blocks.size(); ++i)
+	{
+		free(blocks[i]);
+	}
+	blocks.clear();
+	used = 0;
+	capacity = 0;
+	total = 0;
+}
+
+void *
+Arena::allocate(size_t bytes)
+{
+	bytes = align(std::max<size_t>(bytes, 1), ARENA_ALIGN);
+	total += bytes;
+
+	// A large request gets a block of its own, the current block is kept for the small ones
+	if (bytes > ARENA_BLOCK / 4)
+	{
+		void *memory = NULL;
+		int res = posix_memalign(&memory, ARENA_ALIGN, bytes);
+		assert(res == 0);
+		blocks.insert(blocks.begin(), static_cast<char *>(memory));
+		return memory;
+	}
+
+	if (blocks.empty() || used + bytes > capacity)
+	{
+		void *memory = NULL;
+		int res = posix_memalign(&memory, ARENA_ALIGN, ARENA_BLOCK);
+		assert(res == 0);
+		blocks.push_back(static_cast<char *>(memory));
+		used = 0;
+		capacity = ARENA_BLOCK;
+	}
+
+	void *memory = blocks.back() + used;
+	used += bytes;
+	return memory;
+}
+
+cv::Mat
+Arena::mat(int rows, int cols, int type)
+{
+	assert(rows > 0 && cols > 0);
+
+	const size_t step = align(cols * CV_ELEM_SIZE(type), ARENA_ALIGN);
+	return cv::Mat(rows, cols, type, allocate(rows * step), step);
+}
+
+size_t
+Arena::size(void) const
+{
+	return total;
+}
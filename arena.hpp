@@ -0,0 +1,118 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file arena.hpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The memory arena component API.
+ */
+
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+// C++ Standard Library headers
+#include <vector>
+
+// C++ (C Standard Library) headers
+#include <cstddef>
+
+// OpenCV headers
+#include <opencv/cv.h>
+
+/**
+ * @def ARENA_ALIGN
+ * @brief The alignment (in bytes) of every allocation, and of every image row.
+ */
+#define ARENA_ALIGN 64
+
+/**
+ * @def ARENA_BLOCK
+ * @brief The size (in bytes) of the blocks that the arena hands out memory from.
+ */
+#define ARENA_BLOCK (1 << 20)
+
+/**
+ * @class Arena
+ * @brief A memory arena.
+ *
+ * Hands out memory from large blocks, the memory is only given back when
+ * the arena is destroyed. Buffers that live as long as their owner are
+ * taken from an arena up front, so the owner doesn't need the heap later.
+ * @par More info here:
+ * - http://en.wikipedia.org/wiki/Region-based_memory_management
+ */
+class Arena
+{
+public:
+	Arena(void);
+	~Arena(void);
+
+	/**
+	 * @brief Take memory from the arena.
+	 * @param [in] bytes The size of the memory.
+	 * @return The memory, aligned to ARENA_ALIGN.
+	 */
+	void *
+	allocate(size_t bytes);
+
+	/**
+	 * @brief Take an image from the arena.
+	 *
+	 * The image doesn't own its memory. OpenCV functions writing to it
+	 * keep using the memory, as long as the size and type are the same.
+	 *
+	 * @param [in] rows The number of rows.
+	 * @param [in] cols The number of columns.
+	 * @param [in] type The OpenCV type, like CV_32F.
+	 * @return The image, with every row aligned to ARENA_ALIGN.
+	 */
+	cv::Mat
+	mat(int rows, int cols, int type);
+
+	/**
+	 * @brief Give all memory back to the heap.
+	 *
+	 * Everything taken from the arena earlier must not be used anymore.
+	 */
+	void
+	clear(void);
+
+	/**
+	 * @brief The memory taken from the arena.
+	 * @return The number of bytes handed out.
+	 */
+	size_t
+	size(void) const;
+
+private:
+	Arena(const Arena &);
+
+	Arena &
+	operator=(const Arena &);
+
+	std::vector<char *> blocks;
+	size_t used;
+	size_t capacity;
+	size_t total;
+};
+
+#endif
@@ -0,0 +1,157 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file audit.c
+ * The allocation audit component replaces the allocation functions of the
+ * C library with ones that count the calls and forward them to the glibc
+ * implementation. It's a debug aid, only ALLOC_AUDIT builds have it.
+ * @par More info:
+ * - http://www.gnu.org/software/libc/manual/html_node/Replacing-malloc.html
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The allocation audit component implementation.
+ */
+
+// C Standard Library headers
+#include <errno.h>
+#include <stddef.h>
+
+// Local C headers
+#include "audit.h"
+
+#ifdef ALLOC_AUDIT
+
+static unsigned long allocations = 0;
+
+// Suspended calls of the current thread, in static TLS so reading it never allocates
+static __thread int suspended = 0;
+
+// The glibc implementation, under its internal names
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *memory, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+/**
+ * @brief Count one allocation, from any thread.
+ */
+static void
+Audit_Count(void)
+{
+	if (suspended == 0)
+	{
+		__sync_fetch_and_add(&allocations, 1);
+	}
+}
+
+void *
+malloc(size_t size)
+{
+	Audit_Count();
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t count, size_t size)
+{
+	Audit_Count();
+	return __libc_calloc(count, size);
+}
+
+void *
+realloc(void *memory, size_t size)
+{
+	Audit_Count();
+	return __libc_realloc(memory, size);
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+	Audit_Count();
+	return __libc_memalign(alignment, size);
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+	Audit_Count();
+	return __libc_memalign(alignment, size);
+}
+
+int
+posix_memalign(void **memory, size_t alignment, size_t size)
+{
+	Audit_Count();
+	*memory = __libc_memalign(alignment, size);
+	return *memory ? 0 : ENOMEM;
+}
+
+unsigned long
+Audit_Allocations(void)
+{
+	return __sync_fetch_and_add(&allocations, 0);
+}
+
+void
+Audit_Suspend(void)
+{
+	++suspended;
+}
+
+void
+Audit_Resume(void)
+{
+	--suspended;
+}
+
+int
+Audit_Enabled(void)
+{
+	return 1;
+}
+
+#else
+
+unsigned long
+Audit_Allocations(void)
+{
+	return 0;
+}
+
+void
+Audit_Suspend(void)
+{
+}
+
+void
+Audit_Resume(void)
+{
+}
+
+int
+Audit_Enabled(void)
+{
+	return 0;
+}
+
+#endif
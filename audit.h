@@ -0,0 +1,75 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file audit.h
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The allocation audit component API.
+ */
+
+#ifndef __AUDIT_H__
+#define __AUDIT_H__
+
+/**
+ * @def AUDIT_WARMUP
+ * @brief The number of frames it takes to make every buffer.
+ *
+ * The frames after these are the steady state, they shouldn't allocate.
+ */
+#define AUDIT_WARMUP 3
+
+/**
+ * @brief Count the heap allocations so far.
+ *
+ * Only builds with ALLOC_AUDIT defined count the allocations, every call
+ * to malloc(), calloc(), realloc() and their aligned siblings of every
+ * thread. The C++ operator new ends up in malloc() as well.
+ *
+ * @return The number of allocations since the start, always 0 without ALLOC_AUDIT.
+ */
+unsigned long
+Audit_Allocations(void);
+
+/**
+ * @brief Stop counting the allocations of the calling thread.
+ *
+ * For library calls that make temporaries of their own, like
+ * cv::matchTemplate(). The calls nest, every one needs an Audit_Resume().
+ */
+void
+Audit_Suspend(void);
+
+/**
+ * @brief Count the allocations of the calling thread again.
+ * @see Audit_Suspend()
+ */
+void
+Audit_Resume(void);
+
+/**
+ * @brief Check if the allocations are counted.
+ * @return 1 if this is an ALLOC_AUDIT build, 0 otherwise.
+ */
+int
+Audit_Enabled(void);
+
+#endif
@@ -0,0 +1,1394 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file bench.cpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief Grorld benchmark application
+ *
+ * Measures the matching component on synthetic frames, no X server is
+ * needed. The templates are planted at known positions, scales and noise
+ * levels, hence the accuracy at MATCHING_THRESHOLD is measured as well.
+ *
+ * @par Usage:
+ * - Use the command "./grorld_bench" from the source directory (the
+ * templates are loaded from assets/).
+ * - The tracking run shows the miss rate and the cost per frame of
+ * searching around the recent hits first (grorld -t) on a sequence of
+ * frames, prepared from their damage like a window's.
+ * - The colour key run does the same for searching only where the colours
+ * of the template are (grorld -k).
+ * - The peaks run plants several bonus templates per frame and counts how
+ * many of them Match::matchPeaks() finds.
+ * - The zoom run plants the bonus template zoomed, and compares searching
+ * the template alone with searching its bank of zoom levels.
+ * - The mouse run times the moves and clicks of every mouse backend
+ * (grorld -i) inside a window of its own, it's skipped without an X
+ * server.
+ * - Build with "cmake -DALLOC_AUDIT=ON" to count the heap allocations of
+ * every mode, with damage, tracking, a colour key, peaks and a zoom bank.
+ * The run fails if any frame allocates after the warm up.
+ * - Use "./grorld_bench -m pyramid", "-m fft", "-m ssd" or "-m ssda" to measure another
+ * matching mode, "-j N" to match with N threads.
+ */
+
+// C++ Standard Library headers
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// C++ (C Standard Library) headers
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+// POSIX headers
+#include <unistd.h>
+
+// Xlib headers
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+// OpenCV headers
+#include <opencv/highgui.h>
+
+// Local C headers
+extern "C"
+{
+#include "audit.h"
+#include "mouse.h"
+#include "timer.h"
+}
+
+// Local C++ headers
+#include "match.hpp"
+#include "pack.hpp"
+
+/**
+ * @def BENCH_TILE
+ * @brief The size of the flat coloured tiles of the synthetic backgrounds.
+ */
+#define BENCH_TILE 32
+
+/**
+ * @def BENCH_GRAIN
+ * @brief The amount of pixel noise on the synthetic backgrounds.
+ */
+#define BENCH_GRAIN 12
+
+/**
+ * @def BENCH_CELL
+ * @brief The size of the cells two frames are compared in, for the damage between them.
+ */
+#define BENCH_CELL 32
+
+/**
+ * @def BENCH_AUDIT_WARMUP
+ * @brief The frames of the allocation audit that aren't counted.
+ *
+ * Longer than every refresh period of the tracked, keyed and zoomed
+ * searches, every path has been taken before the counted frames.
+ */
+#define BENCH_AUDIT_WARMUP 160
+
+/**
+ * @def BENCH_AUDIT_FULL
+ * @brief Every this many frames of the allocation audit are prepared in full, the others from their damage.
+ */
+#define BENCH_AUDIT_FULL 8
+
+/**
+ * @brief A template planted on a synthetic frame.
+ */
+struct Planted
+{
+	Planted(void) : present(false), scale(1), noise(0) {}
+
+	bool present; ///< If the template is on the frame at all
+	cv::Point position; ///< Top left corner of the planted template
+	cv::Size size; ///< Size of the planted (scaled) template
+	double scale; ///< The scale the template was planted at
+	int noise; ///< Standard deviation of the noise added to the template
+};
+
+/**
+ * @brief The outcome of searching one frame for one template.
+ */
+struct Tally
+{
+	Tally(void) : hits(0), misses(0), misplaced(0), rejections(0), false_alarms(0) {}
+
+	int hits; ///< Planted and found at the right place
+	int misses; ///< Planted but scored below the threshold
+	int misplaced; ///< Planted, but found somewhere else
+	int rejections; ///< Not planted and scored below the threshold
+	int false_alarms; ///< Not planted, but scored above the threshold
+};
+
+/**
+ * @brief Milliseconds between two points in time.
+ * @param [in] start The first time.
+ * @param [in] stop The second time.
+ * @return The elapsed time in milliseconds.
+ */
+static double
+elapsed(const struct timespec &start, const struct timespec &stop)
+{
+	struct timespec ts = timespec_sub(stop, start);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/**
+ * @brief The nearest-rank percentile of some samples.
+ * @param [in] samples The samples, sorted in place.
+ * @param [in] percent The percentile.
+ * @return The percentile, 0 without samples.
+ */
+static double
+percentile(std::vector<double> &samples, double percent)
+{
+	if (samples.empty())
+	{
+		return 0;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	size_t rank = static_cast<size_t>(percent / 100.0 * samples.size() + 0.999999);
+	return samples[std::min(std::max<size_t>(rank, 1), samples.size()) - 1];
+}
+
+/**
+ * @brief Create an in-memory frame, laid out like an XShm grab.
+ *
+ * The frame is 32 bits per pixel BGRX. It's filled with flat coloured
+ * tiles with some grain on top, which is a lot more like a game map than
+ * plain noise.
+ *
+ * @param [in] width The frame width.
+ * @param [in] height The frame height.
+ * @param [in] engine The random number generator.
+ * @return The frame, free it with XDestroyImage().
+ */
+static XImage *
+createFrame(int width, int height, std::mt19937 &engine)
+{
+	XImage *img = static_cast<XImage *>(calloc(1, sizeof (XImage)));
+	assert(img);
+
+	img->width = width;
+	img->height = height;
+	img->format = ZPixmap;
+	img->byte_order = LSBFirst;
+	img->bitmap_unit = 32;
+	img->bitmap_bit_order = LSBFirst;
+	img->bitmap_pad = 32;
+	img->depth = 24;
+	img->bits_per_pixel = 32;
+	img->bytes_per_line = width * 4;
+	img->red_mask = 0xff0000;
+	img->green_mask = 0x00ff00;
+	img->blue_mask = 0x0000ff;
+	img->data = static_cast<char *>(malloc(img->bytes_per_line * height));
+	assert(img->data);
+
+	Status res = XInitImage(img);
+	assert(res != 0);
+
+	std::uniform_int_distribution<int> base(BENCH_GRAIN, 255 - BENCH_GRAIN);
+	std::uniform_int_distribution<int> grain(-BENCH_GRAIN, BENCH_GRAIN);
+	const int columns = (width + BENCH_TILE - 1) / BENCH_TILE;
+	std::vector<int> tiles(columns * 3);
+	for (int y = 0; y < height; ++y)
+	{
+		if (y % BENCH_TILE == 0)
+		{
+			std::generate(tiles.begin(), tiles.end(), [&]() { return base(engine); });
+		}
+
+		unsigned char *row = reinterpret_cast<unsigned char *>(img->data) + y * img->bytes_per_line;
+		for (int x = 0; x < width; ++x)
+		{
+			const int *tile = &tiles[(x / BENCH_TILE) * 3];
+			row[x * 4 + 0] = tile[0] + grain(engine);
+			row[x * 4 + 1] = tile[1] + grain(engine);
+			row[x * 4 + 2] = tile[2] + grain(engine);
+			row[x * 4 + 3] = 0;
+		}
+	}
+
+	return img;
+}
+
+/**
+ * @brief Draw a template into a frame.
+ * @param [in,out] img The frame.
+ * @param [in] templ The template, grey or BGR.
+ * @param [in] at The top left corner.
+ * @param [in] noise Standard deviation of the noise added to every pixel.
+ * @param [in,out] engine The random number generator.
+ */
+static void
+plant(XImage *img, const cv::Mat &templ, const cv::Point &at, int noise, std::mt19937 &engine)
+{
+	std::normal_distribution<double> distortion(0, std::max(noise, 1));
+	for (int y = 0; y < templ.rows; ++y)
+	{
+		for (int x = 0; x < templ.cols; ++x)
+		{
+			int bgr[3];
+			if (templ.channels() == 1)
+			{
+				bgr[0] = bgr[1] = bgr[2] = templ.at<unsigned char>(y, x);
+			}
+			else
+			{
+				const cv::Vec3b &pixel = templ.at<cv::Vec3b>(y, x);
+				bgr[0] = pixel[0];
+				bgr[1] = pixel[1];
+				bgr[2] = pixel[2];
+			}
+
+			unsigned long value = 0;
+			for (int c = 0; c < 3; ++c)
+			{
+				int v = bgr[c] + (noise > 0 ? static_cast<int>(distortion(engine)) : 0);
+				value |= static_cast<unsigned long>(std::min(std::max(v, 0), 255)) << (c * 8);
+			}
+
+			XPutPixel(img, at.x + x, at.y + y, value);
+		}
+	}
+}
+
+/**
+ * @brief Plant a template somewhere in a part of a frame.
+ *
+ * The template is left out every fourth time, to measure the false alarms.
+ *
+ * @param [in,out] img The frame.
+ * @param [in] templ The template.
+ * @param [in] area The part of the frame to plant the template in.
+ * @param [in] scale The scale to plant the template at.
+ * @param [in] noise The noise added to the template.
+ * @param [in,out] engine The random number generator.
+ * @return What was planted.
+ */
+static Planted
+scatter(XImage *img, const cv::Mat &templ, const cv::Rect &area, double scale, int noise, std::mt19937 &engine)
+{
+	Planted planted;
+	planted.scale = scale;
+	planted.noise = noise;
+	if (std::uniform_int_distribution<int>(0, 3)(engine) == 0)
+	{
+		return planted;
+	}
+
+	cv::Mat scaled = templ;
+	if (scale != 1)
+	{
+		cv::resize(templ, scaled, cv::Size(), scale, scale, cv::INTER_LINEAR);
+	}
+
+	planted.present = true;
+	planted.size = scaled.size();
+	planted.position.x = std::uniform_int_distribution<int>(area.x, area.x + area.width - scaled.cols)(engine);
+	planted.position.y = std::uniform_int_distribution<int>(area.y, area.y + area.height - scaled.rows)(engine);
+	plant(img, scaled, planted.position, noise, engine);
+
+	return planted;
+}
+
+/**
+ * @brief Tell if a search found a planted template.
+ *
+ * A hit has to be within a quarter of the template size from the planted
+ * template, measured between the centers since the scale may differ.
+ *
+ * @param [in] planted What was planted.
+ * @param [in] extent The size of the template searched for.
+ * @param [in] at The top left corner found.
+ * @return True if close enough.
+ */
+static bool
+near(const Planted &planted, const cv::Size &extent, const cv::Point &at)
+{
+	const int dx = (at.x * 2 + extent.width) - (planted.position.x * 2 + planted.size.width);
+	const int dy = (at.y * 2 + extent.height) - (planted.position.y * 2 + planted.size.height);
+	return std::abs(dx) <= extent.width / 2 + 2 && std::abs(dy) <= extent.height / 2 + 2;
+}
+
+/**
+ * @brief Count the outcome of a search.
+ * @param [in,out] tally The outcomes so far.
+ * @param [in] planted What was planted.
+ * @param [in] templ The template searched for.
+ * @param [in] mr The result of the search.
+ */
+static void
+judge(Tally &tally, const Planted &planted, const cv::Mat &templ, const std::tuple<cv::Point, double> &mr)
+{
+	const bool found = std::get<1>(mr) > MATCHING_THRESHOLD;
+	if (!planted.present)
+	{
+		++(found ? tally.false_alarms : tally.rejections);
+		return;
+	}
+
+	if (!found)
+	{
+		++tally.misses;
+		return;
+	}
+
+	++(near(planted, templ.size(), std::get<0>(mr)) ? tally.hits : tally.misplaced);
+}
+
+/**
+ * @brief Print the accuracy of some searches.
+ * @param [in] tally The outcomes.
+ */
+static void
+report(const Tally &tally)
+{
+	const int planted = tally.hits + tally.misses + tally.misplaced;
+	const int empty = tally.rejections + tally.false_alarms;
+	std::cout << tally.hits << "/" << planted;
+	if (tally.misplaced)
+	{
+		std::cout << " (" << tally.misplaced << " misplaced)";
+	}
+	std::cout << ", " << tally.false_alarms << "/" << empty << " false";
+}
+
+/**
+ * @brief Measure the template loading.
+ *
+ * Decoding the images is compared with mapping the template pack, if
+ * grorld_pack has written one.
+ *
+ * @param [in] frames The number of loads per template.
+ */
+static void
+loading(int frames)
+{
+	const char *files[] = {"assets/bonus.png", "assets/city.png"};
+
+	std::cout << "Match::loadTemplate" << std::endl;
+	std::cout << "template\t\tp50 ms\tp99 ms" << std::endl;
+	for (size_t i = 0; i < sizeof (files) / sizeof (files[0]); ++i)
+	{
+		std::vector<double> samples;
+		for (int j = 0; j < frames; ++j)
+		{
+			struct timespec start, stop;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			cv::Mat templ = Match::loadTemplate(files[i]);
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			assert(!templ.empty());
+
+			samples.push_back(elapsed(start, stop));
+		}
+
+		std::cout << files[i] << "\t" << std::fixed << std::setprecision(3) << percentile(samples, 50) << "\t" << percentile(samples, 99) << std::endl;
+	}
+
+	// Open the pack and look up every template (and its pyramid), like the startup does
+	const char *names[] = {"bonus", "city"};
+	std::vector<double> samples;
+	for (int j = 0; j < frames; ++j)
+	{
+		struct timespec start, stop;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		Pack pack;
+		bool res = pack.open("assets/grorld.pack");
+		for (size_t i = 0; res && i < sizeof (names) / sizeof (names[0]); ++i)
+		{
+			std::vector<cv::Mat> pyramid;
+			res = !pack.templ(names[i], &pyramid).empty();
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+		if (!res)
+		{
+			break;
+		}
+
+		samples.push_back(elapsed(start, stop));
+	}
+
+	if (!samples.empty())
+	{
+		std::cout << "assets/grorld.pack\t" << std::fixed << std::setprecision(3) << percentile(samples, 50) << "\t" << percentile(samples, 99) << std::endl;
+	}
+	std::cout << std::endl;
+}
+
+/**
+ * @brief Measure the stages of the matching at the common window sizes.
+ *
+ * Every frame gets the bonus template planted on its left half and the
+ * city template on its right half, at scale 1 and without noise. The
+ * frame rate includes preparing the frame and searching for both
+ * templates, like the main loop does when nothing is found. In SSDA mode
+ * every hit is also checked against a full SSD search, and the share of
+ * positions rejected early is shown.
+ *
+ * @param [in] mode The matching mode.
+ * @param [in] threads The number of matching threads, negative for none.
+ * @param [in] frames The number of frames per window size.
+ * @param [in] engine The random number generator.
+ */
+static void
+stages(Match::Mode mode, int threads, int frames, std::mt19937 &engine)
+{
+	const cv::Mat bonus = Match::loadTemplate("assets/bonus.png");
+	const cv::Mat city = Match::loadTemplate("assets/city.png");
+	assert(!bonus.empty() && !city.empty());
+
+	const cv::Size sizes[] = {cv::Size(1280, 720), cv::Size(1920, 1080), cv::Size(2560, 1440), cv::Size(3840, 2160)};
+
+	std::cout << "Match::prepare and Match::match, " << frames << " frames per size" << std::endl;
+	std::cout << "size\t\tfps\tprepare p50/p99\tbonus p50/p99\tcity p50/p99\tbonus found\t\tcity found" << std::endl;
+	for (size_t i = 0; i < sizeof (sizes) / sizeof (sizes[0]); ++i)
+	{
+		XImage *background = createFrame(sizes[i].width, sizes[i].height, engine);
+		XImage *img = createFrame(sizes[i].width, sizes[i].height, engine);
+		const size_t bytes = img->bytes_per_line * img->height;
+		const cv::Rect left(0, 0, img->width / 2, img->height);
+		const cv::Rect right(img->width / 2, 0, img->width - img->width / 2, img->height);
+
+		Match m(img);
+		m.setMode(mode);
+		if (threads >= 0)
+		{
+			m.setThreads(threads);
+		}
+		m.registerTemplate(bonus);
+		m.registerTemplate(city);
+
+		// The full search that the early rejecting and the coarse to fine ones have to agree with
+		const bool checked = mode == Match::SSDA || mode == Match::PYRAMID;
+		Match reference(img);
+		reference.setMode(mode == Match::SSDA ? Match::SSD : Match::EXHAUSTIVE);
+
+		// One frame to warm up the caches and allocate the buffers
+		m.prepare();
+		m.match(bonus);
+		m.match(city);
+
+		std::vector<double> prepare, bonuses, cities;
+		Tally bonus_tally, city_tally;
+		int inexact = 0, disagreeing = 0;
+		double total = 0;
+		for (int j = 0; j < frames; ++j)
+		{
+			memcpy(img->data, background->data, bytes);
+			Planted pb = scatter(img, bonus, left, 1, 0, engine);
+			Planted pc = scatter(img, city, right, 1, 0, engine);
+
+			struct timespec t0, t1, t2, t3;
+			clock_gettime(CLOCK_MONOTONIC, &t0);
+			m.prepare();
+			clock_gettime(CLOCK_MONOTONIC, &t1);
+			std::tuple<cv::Point, double> mb = m.match(bonus);
+			clock_gettime(CLOCK_MONOTONIC, &t2);
+			std::tuple<cv::Point, double> mc = m.match(city);
+			clock_gettime(CLOCK_MONOTONIC, &t3);
+
+			prepare.push_back(elapsed(t0, t1));
+			bonuses.push_back(elapsed(t1, t2));
+			cities.push_back(elapsed(t2, t3));
+			total += elapsed(t0, t3);
+
+			judge(bonus_tally, pb, bonus, mb);
+			judge(city_tally, pc, city, mc);
+
+			if (checked)
+			{
+				reference.prepare();
+				const std::tuple<cv::Point, double> found[] = {mb, mc};
+				const std::tuple<cv::Point, double> full[] = {reference.match(bonus), reference.match(city)};
+				for (int k = 0; k < 2; ++k)
+				{
+					// The same threshold has to decide the same way, hit or miss
+					const bool hit = std::get<1>(found[k]) > MATCHING_THRESHOLD;
+					if (hit != (std::get<1>(full[k]) > MATCHING_THRESHOLD))
+					{
+						++disagreeing;
+					}
+					if (hit && std::get<0>(found[k]) != std::get<0>(full[k]))
+					{
+						++inexact;
+					}
+				}
+			}
+		}
+
+		std::cout << img->width << "x" << img->height << "\t" << std::fixed << std::setprecision(1) << frames * 1000.0 / total << "\t"
+				  << std::setprecision(2) << percentile(prepare, 50) << "/" << percentile(prepare, 99) << "\t"
+				  << percentile(bonuses, 50) << "/" << percentile(bonuses, 99) << "\t"
+				  << percentile(cities, 50) << "/" << percentile(cities, 99) << "\t";
+		report(bonus_tally);
+		std::cout << "\t";
+		report(city_tally);
+		if (mode == Match::SSDA)
+		{
+			long long positions;
+			const long long rejected = m.rejected(&positions);
+			std::cout << "\t" << std::setprecision(1) << 100.0 * rejected / positions << "% rejected early";
+		}
+		if (checked)
+		{
+			std::cout << "\t" << inexact << " inexact hit(s), " << disagreeing << " decision(s) unlike " << (mode == Match::SSDA ? "ssd" : "exhaustive");
+		}
+		std::cout << std::endl;
+
+		XDestroyImage(img);
+		XDestroyImage(background);
+	}
+	std::cout << std::endl;
+}
+
+/**
+ * @brief Measure the detection accuracy at different scales and noise levels.
+ *
+ * @param [in] mode The matching mode.
+ * @param [in] threads The number of matching threads, negative for none.
+ * @param [in] frames The number of frames per scale and noise level.
+ * @param [in] engine The random number generator.
+ */
+static void
+accuracy(Match::Mode mode, int threads, int frames, std::mt19937 &engine)
+{
+	const cv::Mat bonus = Match::loadTemplate("assets/bonus.png");
+	const cv::Mat city = Match::loadTemplate("assets/city.png");
+	assert(!bonus.empty() && !city.empty());
+
+	const double scales[] = {0.9, 1.0, 1.1, 1.25};
+	const int noises[] = {0, 8, 16, 32};
+
+	XImage *background = createFrame(1280, 720, engine);
+	XImage *img = createFrame(1280, 720, engine);
+	const size_t bytes = img->bytes_per_line * img->height;
+	const cv::Rect left(0, 0, img->width / 2, img->height);
+	const cv::Rect right(img->width / 2, 0, img->width - img->width / 2, img->height);
+
+	Match m(img);
+	m.setMode(mode);
+	if (threads >= 0)
+	{
+		m.setThreads(threads);
+	}
+	m.registerTemplate(bonus);
+	m.registerTemplate(city);
+
+	std::cout << "Accuracy at threshold " << MATCHING_THRESHOLD << ", 1280x720, " << frames << " frames each" << std::endl;
+	std::cout << "scale\tnoise\tbonus found\t\tcity found" << std::endl;
+	for (size_t i = 0; i < sizeof (scales) / sizeof (scales[0]); ++i)
+	{
+		for (size_t j = 0; j < sizeof (noises) / sizeof (noises[0]); ++j)
+		{
+			Tally bonus_tally, city_tally;
+			for (int k = 0; k < frames; ++k)
+			{
+				memcpy(img->data, background->data, bytes);
+				Planted pb = scatter(img, bonus, left, scales[i], noises[j], engine);
+				Planted pc = scatter(img, city, right, scales[i], noises[j], engine);
+
+				m.prepare();
+				judge(bonus_tally, pb, bonus, m.match(bonus));
+				judge(city_tally, pc, city, m.match(city));
+			}
+
+			std::cout << std::fixed << std::setprecision(2) << scales[i] << "\t" << noises[j] << "\t";
+			report(bonus_tally);
+			std::cout << "\t";
+			report(city_tally);
+			std::cout << std::endl;
+		}
+	}
+	std::cout << std::endl;
+
+	XDestroyImage(img);
+	XDestroyImage(background);
+}
+
+/**
+ * @brief Set up the matching algorithm of one run of an A/B comparison.
+ * @param [in,out] m The matching algorithm, the mode is already set.
+ * @param [in] run The run.
+ * @return True to search with Match::matchPeaks(), false with Match::match().
+ */
+typedef std::function<bool (Match &m, int run)> Setup;
+
+/**
+ * @brief Find where a frame differs from the one before it.
+ *
+ * The frames are compared cell by cell, the changed cells of a row of
+ * cells are joined into one rectangle, just like the damage of a window.
+ *
+ * @param [in] before The previous frame.
+ * @param [in] after The frame, of the same size.
+ * @param [out] rects The damaged rectangles.
+ */
+static void
+damage(const XImage *before, const XImage *after, std::vector<XRectangle> &rects)
+{
+	const int bytes = after->bits_per_pixel / 8;
+	rects.clear();
+	for (int y = 0; y < after->height; y += BENCH_CELL)
+	{
+		const int height = std::min(BENCH_CELL, after->height - y);
+		int start = -1;
+		for (int x = 0; x < after->width; x += BENCH_CELL)
+		{
+			const int width = std::min(BENCH_CELL, after->width - x);
+			bool changed = false;
+			for (int row = y; row < y + height && !changed; ++row)
+			{
+				const size_t offset = row * after->bytes_per_line + x * bytes;
+				changed = memcmp(before->data + offset, after->data + offset, width * bytes) != 0;
+			}
+
+			if (changed && start < 0)
+			{
+				start = x;
+			}
+			if (start >= 0 && (!changed || x + width == after->width))
+			{
+				XRectangle r;
+				r.x = start;
+				r.y = y;
+				r.width = (changed ? x + width : x) - start;
+				r.height = height;
+				rects.push_back(r);
+				start = -1;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Plant the templates of one frame of an A/B comparison.
+ * @param [in,out] img The frame, the background is already drawn.
+ * @param [in] run The run.
+ * @param [in] frame The frame number.
+ * @param [in,out] sequence The random number generator of the sequence.
+ * @param [out] planted Every template planted, empty if none.
+ */
+typedef std::function<void (XImage *img, int run, int frame, std::mt19937 &sequence, std::vector<Planted> &planted)> Scene;
+
+/**
+ * @brief Count the outcome of searching a frame for several templates.
+ *
+ * A peak counts once, for the first planted template it's close to. The
+ * planted templates left over are misplaced as long as there are peaks
+ * left over too, the other peaks are false alarms.
+ *
+ * @param [in,out] tally The outcomes so far.
+ * @param [in] planted What was planted.
+ * @param [in] extent The size of the template searched for.
+ * @param [in] peaks The results of the search, above the threshold.
+ */
+static void
+judge(Tally &tally, const std::vector<Planted> &planted, const cv::Size &extent, const std::vector<std::tuple<cv::Point, double> > &peaks)
+{
+	std::vector<bool> taken(peaks.size(), false);
+	int missed = 0;
+	for (size_t i = 0; i < planted.size(); ++i)
+	{
+		size_t j = 0;
+		while (j < peaks.size() && (taken[j] || !near(planted[i], extent, std::get<0>(peaks[j]))))
+		{
+			++j;
+		}
+
+		if (j < peaks.size())
+		{
+			taken[j] = true;
+			++tally.hits;
+		}
+		else
+		{
+			++missed;
+		}
+	}
+
+	const int left = std::count(taken.begin(), taken.end(), false);
+	if (planted.empty() && left == 0)
+	{
+		++tally.rejections;
+		return;
+	}
+
+	const int misplaced = std::min(missed, left);
+	tally.misplaced += misplaced;
+	tally.misses += missed - misplaced;
+	tally.false_alarms += left - misplaced;
+}
+
+/**
+ * @brief Search the very same sequence of frames in a few different ways.
+ *
+ * Every run gets a matching algorithm of its own and the same frames, the
+ * time includes preparing the frames. The first frame is prepared in
+ * full, the others from where they differ from the frame before.
+ *
+ * @param [in] column The heading of the first column.
+ * @param [in] names The name of every run.
+ * @param [in] templ The template searched for.
+ * @param [in] mode The matching mode.
+ * @param [in] frames The length of the sequence.
+ * @param [in] engine The random number generator.
+ * @param [in] setup Sets up the matching algorithm of a run.
+ * @param [in] scene Plants the templates of a frame.
+ */
+static void
+compare(const char *column, const std::vector<std::string> &names, const cv::Mat &templ, Match::Mode mode, int frames, std::mt19937 &engine, const Setup &setup, const Scene &scene)
+{
+	XImage *background = createFrame(1920, 1080, engine);
+	XImage *img = createFrame(1920, 1080, engine);
+	XImage *last = createFrame(1920, 1080, engine);
+	const size_t bytes = img->bytes_per_line * img->height;
+	const unsigned int seed = engine();
+
+	std::cout << std::left << std::setw(16) << column << "found			miss rate	ms/frame	prepare p50" << std::endl;
+	for (size_t run = 0; run < names.size(); ++run)
+	{
+		Match m(img);
+		m.setMode(mode);
+		const bool all = setup(m, run);
+		const cv::Size extent = m.extent(templ);
+
+		// Every run gets the same frames
+		std::mt19937 sequence(seed);
+		std::vector<Planted> planted;
+		std::vector<std::tuple<cv::Point, double> > peaks;
+		std::vector<double> prepare;
+		std::vector<XRectangle> rects;
+		Tally tally;
+		double total = 0;
+		for (int i = 0; i < frames; ++i)
+		{
+			memcpy(img->data, background->data, bytes);
+			planted.clear();
+			scene(img, run, i, sequence, planted);
+			damage(last, img, rects);
+
+			struct timespec start, prepared, stop;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			if (i == 0)
+			{
+				m.prepare();
+			}
+			else
+			{
+				m.prepare(rects.data(), static_cast<int>(rects.size()));
+			}
+			clock_gettime(CLOCK_MONOTONIC, &prepared);
+			if (all)
+			{
+				m.matchPeaks(templ, peaks);
+			}
+			else
+			{
+				peaks.assign(1, m.match(templ));
+				if (std::get<1>(peaks[0]) <= MATCHING_THRESHOLD)
+				{
+					peaks.clear();
+				}
+			}
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+
+			prepare.push_back(elapsed(start, prepared));
+			total += elapsed(start, stop);
+			judge(tally, planted, extent, peaks);
+			memcpy(last->data, img->data, bytes);
+		}
+
+		// The cost of a frame next to what it bought
+		const int found = tally.hits + tally.misses + tally.misplaced;
+		std::cout << std::setw(16) << names[run];
+		report(tally);
+		std::cout << "\t" << std::fixed << std::setprecision(2) << (found ? 100.0 * (tally.misses + tally.misplaced) / found : 0) << "%\t\t" << total / frames << "\t\t" << percentile(prepare, 50) << std::endl;
+	}
+	std::cout << std::endl;
+
+	XDestroyImage(last);
+	XDestroyImage(img);
+	XDestroyImage(background);
+}
+
+/**
+ * @brief Measure searching around the recent hits first.
+ *
+ * The bonus template shows up at one of three places most of the time,
+ * somewhere else now and then, and sometimes not at all. The very same
+ * sequence of frames is searched with and without tracking.
+ *
+ * @param [in] mode The matching mode.
+ * @param [in] frames The length of the sequence.
+ * @param [in] engine The random number generator.
+ */
+static void
+tracking(Match::Mode mode, int frames, std::mt19937 &engine)
+{
+	const cv::Mat bonus = Match::loadTemplate("assets/bonus.png");
+	assert(!bonus.empty());
+
+	const cv::Point places[] = {cv::Point(300, 200), cv::Point(1200, 640), cv::Point(1600, 150)};
+
+	std::cout << "Tracking, 1920x1080, assets/bonus.png mostly at 3 places, " << frames << " frames" << std::endl;
+	compare("tracking", {"off", "on"}, bonus, mode, frames, engine,
+		[&](Match &m, int run)
+		{
+			m.setTracking(run);
+			m.registerTemplate(bonus);
+			return false;
+		},
+		[&](XImage *img, int, int, std::mt19937 &sequence, std::vector<Planted> &planted)
+		{
+			const int k = std::uniform_int_distribution<int>(0, 9)(sequence);
+			if (k < 7)
+			{
+				std::uniform_int_distribution<int> place(0, sizeof (places) / sizeof (places[0]) - 1);
+				std::uniform_int_distribution<int> wobble(-3, 3);
+				Planted p;
+				p.present = true;
+				p.size = bonus.size();
+				p.position = places[place(sequence)] + cv::Point(wobble(sequence), wobble(sequence));
+				plant(img, bonus, p.position, 4, sequence);
+				planted.push_back(p);
+			}
+			else if (k < 9)
+			{
+				Planted p = scatter(img, bonus, cv::Rect(0, 0, img->width, img->height), 1, 4, sequence);
+				if (p.present)
+				{
+					planted.push_back(p);
+				}
+			}
+		});
+}
+
+/**
+ * @brief Measure searching only where the colours of a template are.
+ *
+ * The bonus template shows up in one frame out of ten, somewhere. The
+ * very same sequence of frames is searched with and without the colour
+ * key.
+ *
+ * @param [in] mode The matching mode.
+ * @param [in] frames The length of the sequence.
+ * @param [in] engine The random number generator.
+ */
+static void
+keying(Match::Mode mode, int frames, std::mt19937 &engine)
+{
+	const cv::Mat bonus = Match::loadTemplate("assets/bonus.png");
+	const cv::Mat colour = cv::imread("assets/bonus.png");
+	assert(!bonus.empty() && !colour.empty());
+
+	std::cout << "Colour key, 1920x1080, assets/bonus.png in 1 frame out of 10, " << frames << " frames" << std::endl;
+	compare("key", {"off", "on"}, bonus, mode, frames, engine,
+		[&](Match &m, int run)
+		{
+			m.registerTemplate(bonus);
+			if (run)
+			{
+				m.setKey(bonus, colour);
+			}
+			return false;
+		},
+		[&](XImage *img, int, int, std::mt19937 &sequence, std::vector<Planted> &planted)
+		{
+			if (std::uniform_int_distribution<int>(0, 9)(sequence) == 0)
+			{
+				Planted p;
+				p.present = true;
+				p.size = bonus.size();
+				p.position.x = std::uniform_int_distribution<int>(0, img->width - bonus.cols)(sequence);
+				p.position.y = std::uniform_int_distribution<int>(0, img->height - bonus.rows)(sequence);
+				plant(img, colour, p.position, 4, sequence);
+				planted.push_back(p);
+			}
+		});
+}
+
+/**
+ * @brief Measure finding every bonus bubble of a frame at once.
+ *
+ * One to four bonus templates are planted on every frame, each in a cell
+ * of its own. match() can only find one of them per frame, matchPeaks()
+ * should find all of them and nothing else.
+ *
+ * @param [in] mode The matching mode.
+ * @param [in] frames The number of frames.
+ * @param [in] engine The random number generator.
+ */
+static void
+peaking(Match::Mode mode, int frames, std::mt19937 &engine)
+{
+	const cv::Mat bonus = Match::loadTemplate("assets/bonus.png");
+	assert(!bonus.empty());
+
+	std::cout << "Peaks, 1920x1080, 1 to 4 of assets/bonus.png per frame, " << frames << " frames" << std::endl;
+	compare("search", {"match", "matchPeaks"}, bonus, mode, frames, engine,
+		[&](Match &m, int run)
+		{
+			m.registerTemplate(bonus);
+			return run == 1;
+		},
+		[&](XImage *img, int, int frame, std::mt19937 &sequence, std::vector<Planted> &planted)
+		{
+			const cv::Size cell(img->width / 4, img->height / 2);
+			int cells[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+			std::shuffle(cells, cells + 8, sequence);
+			for (int j = 0; j <= frame % 4; ++j)
+			{
+				const cv::Point corner((cells[j] % 4) * cell.width, (cells[j] / 4) * cell.height);
+				Planted p;
+				p.present = true;
+				p.size = bonus.size();
+				p.position = corner + cv::Point(std::uniform_int_distribution<int>(0, cell.width - bonus.cols)(sequence), std::uniform_int_distribution<int>(0, cell.height - bonus.rows)(sequence));
+				plant(img, bonus, p.position, 4, sequence);
+				planted.push_back(p);
+			}
+		});
+}
+
+/**
+ * @brief Measure searching a template bank when the browser is zoomed.
+ *
+ * The bonus template is planted at one zoom level for a whole sequence of
+ * frames, like a zoomed browser draws it. Every zoom level is searched
+ * with the template alone and with its bank.
+ *
+ * @param [in] mode The matching mode.
+ * @param [in] frames The length of each sequence.
+ * @param [in] engine The random number generator.
+ */
+static void
+zooming(Match::Mode mode, int frames, std::mt19937 &engine)
+{
+	std::vector<cv::Mat> bank;
+	const cv::Mat bonus = Match::loadTemplate("assets/bonus.png", &bank);
+	assert(!bonus.empty());
+
+	const double zooms[] = {0.75, 1.0, 1.25, 1.5};
+	std::vector<std::string> names;
+	for (size_t i = 0; i < sizeof (zooms) / sizeof (zooms[0]); ++i)
+	{
+		std::ostringstream name;
+		name << std::fixed << std::setprecision(2) << zooms[i];
+		names.push_back(name.str() + " off");
+		names.push_back(name.str() + " on");
+	}
+
+	// Run 2i searches zooms[i] with the template alone, run 2i+1 with the bank
+	std::cout << "Zoom, 1920x1080, assets/bonus.png and " << bank.size() << " zoom levels, " << frames << " frames each" << std::endl;
+	compare("zoom bank", names, bonus, mode, frames, engine,
+		[&](Match &m, int run)
+		{
+			if (run % 2)
+			{
+				m.registerBank(bonus, bank);
+			}
+			else
+			{
+				m.registerTemplate(bonus);
+			}
+			return false;
+		},
+		[&](XImage *img, int run, int, std::mt19937 &sequence, std::vector<Planted> &planted)
+		{
+			Planted p = scatter(img, bonus, cv::Rect(0, 0, img->width, img->height), zooms[run / 2], 4, sequence);
+			if (p.present)
+			{
+				planted.push_back(p);
+			}
+		});
+}
+
+/**
+ * @brief Measure how the tiled matching scales with the number of threads.
+ *
+ * Prepares and matches the same 1080p frame without threads, then with 1
+ * up to max threads, and verifies that every thread count gives exactly
+ * the same result as the search without threads.
+ *
+ * @param [in] max The highest thread count.
+ * @param [in] frames The number of frames per thread count.
+ * @param [in] engine The random number generator.
+ */
+static void
+scaling(int max, int frames, std::mt19937 &engine)
+{
+	const cv::Mat bonus = Match::loadTemplate("assets/bonus.png");
+	assert(!bonus.empty());
+
+	XImage *img = createFrame(1920, 1080, engine);
+	const cv::Point truth(1000, 500);
+	plant(img, bonus, truth, 0, engine);
+
+	std::cout << "Thread scaling, 1920x1080, assets/bonus.png at " << truth.x << "x" << truth.y << std::endl;
+	std::cout << "threads\tms/frame\tspeedup\tresult" << std::endl;
+
+	double serial = 0;
+	std::tuple<cv::Point, double> reference;
+	for (int threads = 0; threads <= max; ++threads)
+	{
+		// No pool at all first, that's the reference
+		Match m(img);
+		if (threads > 0)
+		{
+			m.setThreads(threads);
+		}
+		m.registerTemplate(bonus);
+
+		std::tuple<cv::Point, double> mr;
+		struct timespec start, stop;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (int i = 0; i < frames; ++i)
+		{
+			m.prepare();
+			mr = m.match(bonus);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &stop);
+
+		double ms = elapsed(start, stop) / frames;
+		if (threads == 0)
+		{
+			serial = ms;
+			reference = mr;
+		}
+
+		const bool same = std::get<0>(mr).x == std::get<0>(reference).x && std::get<0>(mr).y == std::get<0>(reference).y && std::get<1>(mr) == std::get<1>(reference);
+		if (threads > 0)
+		{
+			std::cout << threads;
+		}
+		else
+		{
+			std::cout << "none";
+		}
+		std::cout << "\t" << std::fixed << std::setprecision(2) << ms << "\t\t" << serial / ms << "\t"
+				  << std::get<0>(mr).x << "x" << std::get<0>(mr).y << " (sigma: " << std::get<1>(mr) << ")"
+				  << (same ? "" : " MISMATCH") << std::endl;
+	}
+	std::cout << std::endl;
+
+	XDestroyImage(img);
+}
+
+/**
+ * @brief Count the heap allocations of steady state frames.
+ *
+ * Only ALLOC_AUDIT builds count the allocations, the temporaries inside
+ * cv::matchTemplate(), cv::dft() and cv::pyrDown() aren't counted. Every
+ * mode searches the same sequence of 1080p frames the way grorld does:
+ * the bonus template moves between two places and is searched with its
+ * zoom bank and tracking, the city template is keyed on its colours and
+ * searched with matchPeaks(). Most frames are prepared from their damage
+ * only. The first BENCH_AUDIT_WARMUP frames take every path once, a single
+ * allocation in any frame after them fails the run.
+ *
+ * @param [in] threads The number of matching threads, negative for none.
+ * @param [in] frames The number of counted frames per mode.
+ * @param [in] engine The random number generator.
+ * @return If no counted frame allocated.
+ */
+static bool
+audit(int threads, int frames, std::mt19937 &engine)
+{
+	if (!Audit_Enabled())
+	{
+		return true;
+	}
+
+	std::vector<cv::Mat> bank;
+	const cv::Mat bonus = Match::loadTemplate("assets/bonus.png", &bank);
+	const cv::Mat city = Match::loadTemplate("assets/city.png");
+	const cv::Mat colour = cv::imread("assets/city.png");
+	assert(!bonus.empty() && !city.empty() && !colour.empty());
+
+	XImage *background = createFrame(1920, 1080, engine);
+	XImage *img = createFrame(1920, 1080, engine);
+	const size_t bytes = img->bytes_per_line * img->height;
+	plant(background, city, cv::Point(200, 700), 0, engine);
+
+	// The bonus template moves back and forth, both of its places are damaged every frame
+	const cv::Point places[] = {cv::Point(1000, 500), cv::Point(1012, 494)};
+	XRectangle rects[2];
+	for (int k = 0; k < 2; ++k)
+	{
+		rects[k].x = places[k].x;
+		rects[k].y = places[k].y;
+		rects[k].width = bonus.cols;
+		rects[k].height = bonus.rows;
+	}
+
+	const Match::Mode modes[] = {Match::EXHAUSTIVE, Match::PYRAMID, Match::FFT, Match::SSD, Match::SSDA};
+	const char *names[] = {"exhaustive", "pyramid", "fft", "ssd", "ssda"};
+
+	std::cout << "Allocation audit, 1920x1080, " << frames << " frames after " << BENCH_AUDIT_WARMUP << " to warm up" << std::endl;
+	std::cout << "mode		per frame	worst frame" << std::endl;
+	bool clean = true;
+	for (size_t i = 0; i < sizeof (modes) / sizeof (modes[0]); ++i)
+	{
+		Match m(img);
+		m.setMode(modes[i]);
+		if (threads >= 0)
+		{
+			m.setThreads(threads);
+		}
+		m.setTracking(true);
+		m.registerBank(bonus, bank);
+		m.registerTemplate(city);
+		m.setKey(city, colour);
+
+		std::vector<std::tuple<cv::Point, double> > peaks;
+		unsigned long total = 0, worst = 0;
+		for (int j = 0; j < BENCH_AUDIT_WARMUP + frames; ++j)
+		{
+			memcpy(img->data, background->data, bytes);
+			plant(img, bonus, places[j % 2], 0, engine);
+
+			const unsigned long before = Audit_Allocations();
+			if (j % BENCH_AUDIT_FULL == 0)
+			{
+				m.prepare();
+			}
+			else
+			{
+				m.prepare(rects, 2);
+			}
+			m.match(bonus);
+			m.matchPeaks(city, peaks);
+			const unsigned long allocations = Audit_Allocations() - before;
+
+			if (j >= BENCH_AUDIT_WARMUP)
+			{
+				total += allocations;
+				worst = std::max(worst, allocations);
+			}
+		}
+
+		if (worst > 0)
+		{
+			clean = false;
+		}
+
+		std::cout << names[i] << "\t\t" << std::fixed << std::setprecision(1) << static_cast<double>(total) / frames << "\t\t" << worst << (worst > 0 ? "\tFAIL" : "") << std::endl;
+	}
+	std::cout << std::endl;
+
+	XDestroyImage(img);
+	XDestroyImage(background);
+	return clean;
+}
+
+/**
+ * @brief Measure the actions of every mouse backend.
+ *
+ * A window of our own is put on top, every move and click lands in it.
+ * The call is the time the caller is held up, the settled time lasts
+ * until the X server reports the pointer at the new place.
+ *
+ * @param [in] frames The number of actions per backend.
+ * @param [in] engine The random number generator.
+ */
+static void
+pointing(int frames, std::mt19937 &engine)
+{
+	Display *display = XOpenDisplay(NULL);
+	if (!display)
+	{
+		std::cout << "Mouse: No X server, skipped" << std::endl << std::endl;
+		return;
+	}
+
+	// Keep the window manager out of it, the window is at a known place
+	XSetWindowAttributes attr;
+	attr.override_redirect = True;
+	const int size = 200;
+	Window window = XCreateWindow(display, DefaultRootWindow(display), 0, 0, size, size, 0, CopyFromParent, InputOutput, CopyFromParent, CWOverrideRedirect, &attr);
+	XSelectInput(display, window, ButtonPressMask | ButtonReleaseMask);
+	XMapRaised(display, window);
+	XSync(display, False);
+
+	const int backends[] = {MOUSE_EVENTS, MOUSE_XTEST};
+	const char *names[] = {"events", "xtest"};
+
+	std::cout << "Mouse, " << frames << " actions in a " << size << "x" << size << " window" << std::endl;
+	std::cout << "backend		move p50 ms	p99 ms	click p50 ms	p99 ms	settled p50 ms	p99 ms" << std::endl;
+	for (size_t i = 0; i < sizeof (backends) / sizeof (backends[0]); ++i)
+	{
+		Pointer *pointer = Mouse_Initialize(window);
+		if (Mouse_SetBackend(backends[i]) != backends[i])
+		{
+			Mouse_Deinitialize(pointer);
+			continue;
+		}
+
+		std::vector<double> moves, clicks, settled;
+		for (int j = 0; j < frames; ++j)
+		{
+			const int x = std::uniform_int_distribution<int>(0, size - 1)(engine);
+			const int y = std::uniform_int_distribution<int>(0, size - 1)(engine);
+
+			struct timespec start, moved, clicked, stop;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			Mouse_SetCoords(pointer, x, y);
+			clock_gettime(CLOCK_MONOTONIC, &moved);
+
+			// The click is somewhere else, the settled time covers its move too
+			Mouse_ClickAt(pointer, y, x, Button1);
+			clock_gettime(CLOCK_MONOTONIC, &clicked);
+
+			int px, py;
+			Mouse_GetCoords(pointer, &px, &py);
+			clock_gettime(CLOCK_MONOTONIC, &stop);
+			assert(px == y && py == x);
+
+			moves.push_back(elapsed(start, moved));
+			clicks.push_back(elapsed(moved, clicked));
+			settled.push_back(elapsed(moved, stop));
+		}
+		Mouse_Deinitialize(pointer);
+
+		std::cout << names[i] << "		" << std::fixed << std::setprecision(3) << percentile(moves, 50) << "		" << percentile(moves, 99)
+			<< "	" << percentile(clicks, 50) << "		" << percentile(clicks, 99)
+			<< "	" << percentile(settled, 50) << "		" << percentile(settled, 99) << std::endl;
+	}
+	std::cout << std::endl;
+
+	XDestroyWindow(display, window);
+	XCloseDisplay(display);
+}
+
+/**
+ * @brief Print the command line options.
+ * @param [in] name The name of the executable.
+ */
+static void
+usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " [-j threads] [-m exhaustive|pyramid|fft|ssd|ssda] [-n frames] [-t threads]" << std::endl;
+	std::cerr << "  -j  matching threads for the stage and accuracy runs, 0 for one per core (default: no threads)" << std::endl;
+	std::cerr << "  -m  template matching mode for the stage and accuracy runs (default: exhaustive)" << std::endl;
+	std::cerr << "  -n  frames per measurement (default: 20)" << std::endl;
+	std::cerr << "  -t  highest thread count of the scaling run (default: one per core)" << std::endl;
+}
+
+/**
+ * @brief Grorld benchmark entry point
+ */
+int main(int argc, char **argv)
+{
+	std::cout << "Grorld benchmark, version 1" << std::endl;
+
+	Match::Mode mode = Match::EXHAUSTIVE;
+	int threads = -1;
+	int frames = 20;
+	int max = std::max(1u, std::thread::hardware_concurrency());
+	int option;
+	while ((option = getopt(argc, argv, "j:m:n:t:")) != -1)
+	{
+		switch (option)
+		{
+		case 'j':
+			threads = atoi(optarg);
+			break;
+
+		case 'm':
+			if (strcmp(optarg, "exhaustive") == 0)
+			{
+				mode = Match::EXHAUSTIVE;
+			}
+			else if (strcmp(optarg, "pyramid") == 0)
+			{
+				mode = Match::PYRAMID;
+			}
+			else if (strcmp(optarg, "fft") == 0)
+			{
+				mode = Match::FFT;
+			}
+			else if (strcmp(optarg, "ssd") == 0)
+			{
+				mode = Match::SSD;
+			}
+			else if (strcmp(optarg, "ssda") == 0)
+			{
+				mode = Match::SSDA;
+			}
+			else
+			{
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'n':
+			frames = atoi(optarg);
+			break;
+
+		case 't':
+			max = atoi(optarg);
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (frames < 1 || max < 1)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 engine(42);
+	loading(frames);
+	stages(mode, threads, frames, engine);
+	accuracy(mode, threads, frames, engine);
+	tracking(mode, frames * 5, engine);
+	keying(mode, frames * 5, engine);
+	peaking(mode, frames * 4, engine);
+	zooming(mode, frames * 5, engine);
+	scaling(max, frames, engine);
+	pointing(frames * 5, engine);
+
+	if (!audit(threads, frames, engine))
+	{
+		std::cerr << "Audit: Steady state frames allocate" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,506 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file convert.c
+ * The pixel conversion component reads the XShm frame buffer row by row
+ * (using bytes_per_line) instead of asking XGetPixel() for every single
+ * pixel. The common 24/32 bits per pixel layouts have dedicated kernels,
+ * the 32 bits per pixel ones are vectorized with SSE2/SSSE3 or AVX2
+ * depending on what the CPU supports. The keyed conversions also look up
+ * every pixel in a colour key table while its row is in the cache, and
+ * mark the cells of the frame that have any of the keyed colours.
+ * @par More info:
+ * - http://en.wikipedia.org/wiki/SSE2
+ * - http://en.wikipedia.org/wiki/Advanced_Vector_Extensions
+ *
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The pixel conversion component implementation.
+ */
+
+// C Standard Library headers
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+// Xlib headers
+#include <X11/Xutil.h>
+
+// Local C headers
+#include "convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief A row kernel, converts n pixels from src into dst.
+ */
+typedef void (*Convert_Row)(const unsigned char *src, unsigned char *dst, int n);
+
+static Convert_Row grey32 = NULL;
+static Convert_Row bgr32 = NULL;
+static char kernel[32] = "scalar";
+
+static void
+Grey32_Scalar(const unsigned char *src, unsigned char *dst, int n)
+{
+	int i;
+	for (i = 0; i < n; ++i, src += 4)
+	{
+		dst[i] = (src[0] + src[1] + src[2]) / 3;
+	}
+}
+
+static void
+BGR32_Scalar(const unsigned char *src, unsigned char *dst, int n)
+{
+	int i;
+	for (i = 0; i < n; ++i, src += 4, dst += 3)
+	{
+		dst[0] = src[0];
+		dst[1] = src[1];
+		dst[2] = src[2];
+	}
+}
+
+static void
+Grey24_Scalar(const unsigned char *src, unsigned char *dst, int n)
+{
+	int i;
+	for (i = 0; i < n; ++i, src += 3)
+	{
+		dst[i] = (src[0] + src[1] + src[2]) / 3;
+	}
+}
+
+static void
+BGR24_Scalar(const unsigned char *src, unsigned char *dst, int n)
+{
+	int i;
+	for (i = 0; i < n * 3; ++i)
+	{
+		dst[i] = src[i];
+	}
+}
+
+#ifdef CONVERT_X86
+
+/*
+ * The grey kernels sum the three channels in 32 bit lanes, pack the sums
+ * (at most 765) into 16 bit lanes and divide by three with a multiply:
+ * (x * 0xaaab) >> 17 equals x / 3 for every x below 2^17, hence the
+ * result is bit identical to the scalar division.
+ */
+
+__attribute__((target("sse2")))
+static inline __m128i
+Sum32_SSE2(const unsigned char *src)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i p = _mm_loadu_si128((const __m128i *)src);
+
+	return _mm_add_epi32(_mm_add_epi32(	_mm_and_si128(p, mask),
+										_mm_and_si128(_mm_srli_epi32(p, 8), mask)),
+										_mm_and_si128(_mm_srli_epi32(p, 16), mask));
+}
+
+__attribute__((target("sse2")))
+static void
+Grey32_SSE2(const unsigned char *src, unsigned char *dst, int n)
+{
+	const __m128i third = _mm_set1_epi16((short)0xaaab);
+
+	int i;
+	for (i = 0; i + 16 <= n; i += 16, src += 64)
+	{
+		__m128i lo = _mm_packs_epi32(Sum32_SSE2(src), Sum32_SSE2(src + 16));
+		__m128i hi = _mm_packs_epi32(Sum32_SSE2(src + 32), Sum32_SSE2(src + 48));
+
+		lo = _mm_srli_epi16(_mm_mulhi_epu16(lo, third), 1);
+		hi = _mm_srli_epi16(_mm_mulhi_epu16(hi, third), 1);
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+
+	Grey32_Scalar(src, dst + i, n - i);
+}
+
+__attribute__((target("ssse3")))
+static void
+BGR32_SSSE3(const unsigned char *src, unsigned char *dst, int n)
+{
+	const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+	// Every store writes 16 bytes of which 12 are valid, the garbage is
+	// overwritten by the next store, so keep one block in reserve
+	int i;
+	for (i = 0; i + 8 <= n; i += 4, src += 16, dst += 12)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)src);
+		_mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(p, shuffle));
+	}
+
+	BGR32_Scalar(src, dst, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+Sum32_AVX2(const unsigned char *src)
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	__m256i p = _mm256_loadu_si256((const __m256i *)src);
+
+	return _mm256_add_epi32(_mm256_add_epi32(	_mm256_and_si256(p, mask),
+												_mm256_and_si256(_mm256_srli_epi32(p, 8), mask)),
+												_mm256_and_si256(_mm256_srli_epi32(p, 16), mask));
+}
+
+__attribute__((target("avx2")))
+static void
+Grey32_AVX2(const unsigned char *src, unsigned char *dst, int n)
+{
+	const __m256i third = _mm256_set1_epi16((short)0xaaab);
+	// The packs work within 128 bit lanes, this puts the pixels back in order
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	int i;
+	for (i = 0; i + 32 <= n; i += 32, src += 128)
+	{
+		__m256i lo = _mm256_packs_epi32(Sum32_AVX2(src), Sum32_AVX2(src + 32));
+		__m256i hi = _mm256_packs_epi32(Sum32_AVX2(src + 64), Sum32_AVX2(src + 96));
+
+		lo = _mm256_srli_epi16(_mm256_mulhi_epu16(lo, third), 1);
+		hi = _mm256_srli_epi16(_mm256_mulhi_epu16(hi, third), 1);
+
+		__m256i grey = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), order);
+		_mm256_storeu_si256((__m256i *)(dst + i), grey);
+	}
+
+	Grey32_SSE2(src, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void
+BGR32_AVX2(const unsigned char *src, unsigned char *dst, int n)
+{
+	const __m256i shuffle = _mm256_setr_epi8(	0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+												0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+	// Same trick as the SSSE3 kernel, 24 valid bytes out of 8 pixels
+	int i;
+	for (i = 0; i + 16 <= n; i += 8, src += 32, dst += 24)
+	{
+		__m256i p = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)src), shuffle);
+		_mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(p));
+		_mm_storeu_si128((__m128i *)(dst + 12), _mm256_extracti128_si256(p, 1));
+	}
+
+	BGR32_SSSE3(src, dst, n - i);
+}
+
+#endif
+
+void
+Convert_Initialize(void)
+{
+	if (grey32)
+	{
+		return;
+	}
+
+	if (!Convert_Select("avx2") && !Convert_Select("ssse3") && !Convert_Select("sse2"))
+	{
+		Convert_Select("scalar");
+	}
+}
+
+int
+Convert_Select(const char *set)
+{
+	assert(set);
+
+	Convert_Row grey = Grey32_Scalar;
+	Convert_Row bgr = BGR32_Scalar;
+	const char *grey_name = "scalar";
+	const char *bgr_name = "scalar";
+
+#ifdef CONVERT_X86
+	__builtin_cpu_init();
+#endif
+
+	if (strcmp(set, "scalar") == 0)
+	{
+		// The plain C kernels above
+	}
+#ifdef CONVERT_X86
+	else if (strcmp(set, "avx2") == 0 && __builtin_cpu_supports("avx2"))
+	{
+		grey = Grey32_AVX2;
+		bgr = BGR32_AVX2;
+		grey_name = bgr_name = "avx2";
+	}
+	else if (strcmp(set, "ssse3") == 0 && __builtin_cpu_supports("ssse3"))
+	{
+		grey = Grey32_SSE2;
+		bgr = BGR32_SSSE3;
+		grey_name = "sse2";
+		bgr_name = "ssse3";
+	}
+	else if (strcmp(set, "sse2") == 0 && __builtin_cpu_supports("sse2"))
+	{
+		grey = Grey32_SSE2;
+		grey_name = "sse2";
+	}
+#endif
+	else
+	{
+		return 0;
+	}
+
+	snprintf(kernel, sizeof (kernel), "grey %s, bgr %s", grey_name, bgr_name);
+
+	bgr32 = bgr;
+	grey32 = grey;
+	return 1;
+}
+
+const char *
+Convert_Kernel(void)
+{
+	return kernel;
+}
+
+/**
+ * @brief Check if the image layout can be read directly from the buffer.
+ * @param [in] img The source image.
+ * @return The number of bytes per pixel.
+ * @retval 0 Unknown layout, use XGetPixel().
+ */
+static int
+Convert_Direct(const XImage *img)
+{
+	if (img->format != ZPixmap || img->byte_order != LSBFirst)
+	{
+		return 0;
+	}
+
+	if (img->bits_per_pixel == 32 || img->bits_per_pixel == 24)
+	{
+		return img->bits_per_pixel / 8;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Or the colour key bits of a row of pixels into a row of cells.
+ *
+ * The bits of a whole cell are collected first and stored once.
+ *
+ * @param [in] src The first pixel.
+ * @param [in] bpp The number of bytes per pixel.
+ * @param [in] x The column of the first pixel.
+ * @param [in] n The number of pixels.
+ * @param [in] key The colour key table.
+ * @param [in,out] cells The row of cells.
+ */
+static void
+Convert_KeyRow(const unsigned char *src, int bpp, int x, int n, const unsigned char *key, unsigned char *cells)
+{
+	int i = 0;
+	while (i < n)
+	{
+		const int cell = (x + i) >> CONVERT_CELL_SHIFT;
+		const int end = ((cell + 1) << CONVERT_CELL_SHIFT) - x < n ? ((cell + 1) << CONVERT_CELL_SHIFT) - x : n;
+
+		unsigned char bits = 0;
+		for (; i < end; ++i, src += bpp)
+		{
+			bits |= key[CONVERT_KEY(src[0], src[1], src[2])];
+		}
+		cells[cell] |= bits;
+	}
+}
+
+/**
+ * @brief Reference (XGetPixel based) colour keying.
+ * @see Convert_GreyKeyed()
+ */
+static void
+Convert_KeyReference(const XImage *img, int x, int y, int width, int height, const unsigned char *key, unsigned char *cells, size_t cells_step)
+{
+	int i, j;
+	for (j = y; j < y + height; ++j)
+	{
+		for (i = x; i < x + width; ++i)
+		{
+			unsigned long pixel = XGetPixel((XImage *)img, i, j);
+			cells[(j >> CONVERT_CELL_SHIFT) * cells_step + (i >> CONVERT_CELL_SHIFT)] |= key[CONVERT_KEY(pixel & 0xff, (pixel >> 8) & 0xff, (pixel >> 16) & 0xff)];
+		}
+	}
+}
+
+void
+Convert_Grey(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step)
+{
+	Convert_GreyKeyed(img, x, y, width, height, dst, step, NULL, NULL, 0);
+}
+
+void
+Convert_BGR(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step)
+{
+	Convert_BGRKeyed(img, x, y, width, height, dst, step, NULL, NULL, 0);
+}
+
+void
+Convert_GreyKeyed(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step, const unsigned char *key, unsigned char *cells, size_t cells_step)
+{
+	assert(img);
+	assert(dst);
+	assert(!key || cells);
+	assert(x >= 0 && y >= 0 && x + width <= img->width && y + height <= img->height);
+
+	const int bpp = Convert_Direct(img);
+	if (bpp == 0)
+	{
+		Convert_GreyReference(img, x, y, width, height, dst, step);
+		if (key)
+		{
+			Convert_KeyReference(img, x, y, width, height, key, cells, cells_step);
+		}
+		return;
+	}
+
+	Convert_Initialize();
+	Convert_Row row = (bpp == 4) ? grey32 : Grey24_Scalar;
+
+	int j;
+	for (j = y; j < y + height; ++j)
+	{
+		const unsigned char *src = (const unsigned char *)img->data + (size_t)j * img->bytes_per_line + (size_t)x * bpp;
+		row(src, dst + j * step + x, width);
+
+		// The row is still in the cache
+		if (key)
+		{
+			Convert_KeyRow(src, bpp, x, width, key, cells + (j >> CONVERT_CELL_SHIFT) * cells_step);
+		}
+	}
+}
+
+void
+Convert_BGRKeyed(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step, const unsigned char *key, unsigned char *cells, size_t cells_step)
+{
+	assert(img);
+	assert(dst);
+	assert(!key || cells);
+	assert(x >= 0 && y >= 0 && x + width <= img->width && y + height <= img->height);
+
+	const int bpp = Convert_Direct(img);
+	if (bpp == 0)
+	{
+		Convert_BGRReference(img, x, y, width, height, dst, step);
+		if (key)
+		{
+			Convert_KeyReference(img, x, y, width, height, key, cells, cells_step);
+		}
+		return;
+	}
+
+	Convert_Initialize();
+	Convert_Row row = (bpp == 4) ? bgr32 : BGR24_Scalar;
+
+	int j;
+	for (j = y; j < y + height; ++j)
+	{
+		const unsigned char *src = (const unsigned char *)img->data + (size_t)j * img->bytes_per_line + (size_t)x * bpp;
+		row(src, dst + j * step + x * 3, width);
+
+		if (key)
+		{
+			Convert_KeyRow(src, bpp, x, width, key, cells + (j >> CONVERT_CELL_SHIFT) * cells_step);
+		}
+	}
+}
+
+void
+Convert_Histogram(const XImage *img, unsigned int *histogram)
+{
+	assert(img);
+	assert(histogram);
+
+	const int bpp = Convert_Direct(img);
+	int i, j;
+	for (j = 0; j < img->height; ++j)
+	{
+		const unsigned char *src = (const unsigned char *)img->data + (size_t)j * img->bytes_per_line;
+		for (i = 0; i < img->width; ++i, src += bpp)
+		{
+			if (bpp == 0)
+			{
+				unsigned long pixel = XGetPixel((XImage *)img, i, j);
+				++histogram[CONVERT_KEY(pixel & 0xff, (pixel >> 8) & 0xff, (pixel >> 16) & 0xff)];
+			}
+			else
+			{
+				++histogram[CONVERT_KEY(src[0], src[1], src[2])];
+			}
+		}
+	}
+}
+
+void
+Convert_GreyReference(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step)
+{
+	assert(img);
+	assert(dst);
+
+	int i, j;
+	for (j = y; j < y + height; ++j)
+	{
+		for (i = x; i < x + width; ++i)
+		{
+			unsigned long pixel = XGetPixel((XImage *)img, i, j);
+			dst[j * step + i] = ((pixel & 0xff) + ((pixel >> 8) & 0xff) + ((pixel >> 16) & 0xff)) / 3;
+		}
+	}
+}
+
+void
+Convert_BGRReference(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step)
+{
+	assert(img);
+	assert(dst);
+
+	int i, j;
+	for (j = y; j < y + height; ++j)
+	{
+		for (i = x; i < x + width; ++i)
+		{
+			unsigned long pixel = XGetPixel((XImage *)img, i, j);
+			dst[j * step + i * 3] = pixel & 0xff;
+			dst[j * step + i * 3 + 1] = (pixel >> 8) & 0xff;
+			dst[j * step + i * 3 + 2] = (pixel >> 16) & 0xff;
+		}
+	}
+}
@@ -0,0 +1,187 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file convert.h
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The pixel conversion component API.
+ */
+
+#ifndef __CONVERT_H__
+#define __CONVERT_H__
+
+// C Standard Library headers
+#include <stddef.h>
+
+// Xlib headers
+#include <X11/Xlib.h>
+
+/**
+ * @def CONVERT_KEY_BITS
+ * @brief The number of bits per channel that a colour key looks at.
+ */
+#define CONVERT_KEY_BITS 4
+
+/**
+ * @def CONVERT_KEY_SIZE
+ * @brief The number of entries in a colour key table.
+ */
+#define CONVERT_KEY_SIZE (1 << (3 * CONVERT_KEY_BITS))
+
+/**
+ * @def CONVERT_KEY
+ * @brief The colour key table entry of a pixel.
+ */
+#define CONVERT_KEY(b, g, r) ((((b) >> (8 - CONVERT_KEY_BITS)) << (2 * CONVERT_KEY_BITS)) | (((g) >> (8 - CONVERT_KEY_BITS)) << CONVERT_KEY_BITS) | ((r) >> (8 - CONVERT_KEY_BITS)))
+
+/**
+ * @def CONVERT_CELL_SHIFT
+ * @brief The colour key cells are 1 << CONVERT_CELL_SHIFT pixels wide and high.
+ */
+#define CONVERT_CELL_SHIFT 3
+
+/**
+ * @brief Initialize the pixel conversion component.
+ *
+ * Probes the CPU for supported instruction sets and selects the fastest
+ * conversion kernels (AVX2, SSE2 or plain C). Calling it more than once
+ * is harmless.
+ */
+void
+Convert_Initialize(void);
+
+/**
+ * @brief Select the conversion kernels of an instruction set.
+ *
+ * Convert_Initialize() selects the fastest kernels, this is for testing
+ * the others. "sse2" selects the SSE2 grey kernel and the plain C BGR
+ * kernel, "ssse3" the SSE2 grey kernel and the SSSE3 BGR kernel.
+ *
+ * @param [in] set "scalar", "sse2", "ssse3" or "avx2".
+ * @return Non-zero if selected, 0 if the CPU (or the build) doesn't support the set.
+ */
+int
+Convert_Select(const char *set);
+
+/**
+ * @brief Name of the selected conversion kernels.
+ * @return A description like "grey avx2, bgr avx2".
+ */
+const char *
+Convert_Kernel(void);
+
+/**
+ * @brief Convert a region of a captured frame into grey scale.
+ *
+ * Each destination pixel is the integer average of the three lowest
+ * bytes of the source pixel, exactly as (b + g + r) / 3. Frames with
+ * 24 or 32 bits per pixel in LSBFirst byte order are read directly from
+ * the image buffer, any other visual falls back on XGetPixel().
+ *
+ * @param [in] img The source image.
+ * @param [in] x The left edge of the region.
+ * @param [in] y The top edge of the region.
+ * @param [in] width The width of the region.
+ * @param [in] height The height of the region.
+ * @param [out] dst The destination image, pixel (0, 0), one byte per pixel.
+ * @param [in] step The number of bytes per row in the destination image.
+ */
+void
+Convert_Grey(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step);
+
+/**
+ * @brief Convert a region of a captured frame into packed BGR.
+ *
+ * Same as Convert_Grey() but keeps the three lowest bytes of each pixel
+ * as three separate channels.
+ *
+ * @param [in] img The source image.
+ * @param [in] x The left edge of the region.
+ * @param [in] y The top edge of the region.
+ * @param [in] width The width of the region.
+ * @param [in] height The height of the region.
+ * @param [out] dst The destination image, pixel (0, 0), three bytes per pixel.
+ * @param [in] step The number of bytes per row in the destination image.
+ */
+void
+Convert_BGR(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step);
+
+/**
+ * @brief Convert a region of a captured frame into grey scale and key it.
+ *
+ * Same as Convert_Grey(), but every source row is also looked up in a
+ * colour key table while it's still in the cache. The table holds one
+ * bit per keyed template for every colour, the bits of all pixels in a
+ * cell are or:ed into that cell. The cells of the region have to be
+ * cleared by the caller.
+ *
+ * @param [in] img The source image.
+ * @param [in] x The left edge of the region.
+ * @param [in] y The top edge of the region.
+ * @param [in] width The width of the region.
+ * @param [in] height The height of the region.
+ * @param [out] dst The destination image, pixel (0, 0), one byte per pixel.
+ * @param [in] step The number of bytes per row in the destination image.
+ * @param [in] key The colour key table, CONVERT_KEY_SIZE entries indexed by CONVERT_KEY().
+ * @param [in,out] cells The key bits, cell (0, 0), one byte per cell.
+ * @param [in] cells_step The number of bytes per row of cells.
+ * @see CONVERT_CELL_SHIFT
+ */
+void
+Convert_GreyKeyed(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step, const unsigned char *key, unsigned char *cells, size_t cells_step);
+
+/**
+ * @brief Convert a region of a captured frame into packed BGR and key it.
+ * @see Convert_BGR()
+ * @see Convert_GreyKeyed()
+ */
+void
+Convert_BGRKeyed(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step, const unsigned char *key, unsigned char *cells, size_t cells_step);
+
+/**
+ * @brief Count the colours of a captured frame.
+ *
+ * @param [in] img The source image.
+ * @param [in,out] histogram The number of pixels per colour key table entry,
+ * CONVERT_KEY_SIZE entries which are added to.
+ */
+void
+Convert_Histogram(const XImage *img, unsigned int *histogram);
+
+/**
+ * @brief Reference (XGetPixel based) grey scale conversion.
+ *
+ * The slow per pixel conversion, used for visuals without a fast path
+ * and to verify the output of the fast kernels.
+ *
+ * @see Convert_Grey()
+ */
+void
+Convert_GreyReference(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step);
+
+/**
+ * @brief Reference (XGetPixel based) BGR conversion.
+ * @see Convert_BGR()
+ */
+void
+Convert_BGRReference(const XImage *img, int x, int y, int width, int height, unsigned char *dst, size_t step);
+
+#endif
@@ -0,0 +1,273 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file convert_test.c
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief Grorld pixel conversion test
+ *
+ * Converts synthetic frames with every conversion kernel the CPU supports
+ * and compares the result byte for byte with the XGetPixel() based
+ * reference. The frames are 24 and 32 bits per pixel, have odd widths and
+ * padded rows, and are converted at odd offsets, so the vectorized loops
+ * and their scalar tails are both covered. No X server is needed.
+ *
+ * @par Usage:
+ * - Use the command "ctest" or "./grorld_convert_test" in the build
+ * directory, it exits with a failure status if any kernel mismatches.
+ */
+
+// C Standard Library headers
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Xlib headers
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+// Local C headers
+#include "convert.h"
+
+/**
+ * @def TEST_SENTINEL
+ * @brief The value of the destination bytes that no conversion should touch.
+ */
+#define TEST_SENTINEL 0xa5
+
+/**
+ * @brief A tiny linear congruential generator, the same bytes on every run.
+ * @param [in,out] state The generator state.
+ * @return The next pseudo random byte.
+ */
+static unsigned char
+Test_Random(unsigned int *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0xff;
+}
+
+/**
+ * @brief Create an in-memory frame with random pixels.
+ * @param [in] width The frame width.
+ * @param [in] height The frame height.
+ * @param [in] bpp The number of bits per pixel, 24 or 32.
+ * @param [in] pad The number of bytes of padding after every row.
+ * @param [in,out] state The random generator state.
+ * @return The frame, free it with XDestroyImage().
+ */
+static XImage *
+Test_CreateFrame(int width, int height, int bpp, int pad, unsigned int *state)
+{
+	XImage *img = calloc(1, sizeof (XImage));
+	assert(img);
+
+	img->width = width;
+	img->height = height;
+	img->format = ZPixmap;
+	img->byte_order = LSBFirst;
+	img->bitmap_unit = 32;
+	img->bitmap_bit_order = LSBFirst;
+	img->bitmap_pad = 32;
+	img->depth = 24;
+	img->bits_per_pixel = bpp;
+	img->bytes_per_line = (width * bpp / 8 + 3) / 4 * 4 + pad;
+	img->red_mask = 0xff0000;
+	img->green_mask = 0x00ff00;
+	img->blue_mask = 0x0000ff;
+	img->data = malloc((size_t)img->bytes_per_line * height);
+	assert(img->data);
+
+	Status res = XInitImage(img);
+	assert(res != 0);
+	(void)res;
+
+	size_t i;
+	for (i = 0; i < (size_t)img->bytes_per_line * height; ++i)
+	{
+		img->data[i] = Test_Random(state);
+	}
+
+	return img;
+}
+
+/**
+ * @brief Compare a kernel's output with the reference output.
+ * @param [in] what The conversion, for the failure message.
+ * @param [in] img The frame.
+ * @param [in] x The left edge of the region.
+ * @param [in] y The top edge of the region.
+ * @param [in] width The width of the region.
+ * @param [in] height The height of the region.
+ * @param [in] expected The reference output.
+ * @param [in] actual The kernel's output.
+ * @param [in] size The size of both outputs.
+ * @return 1 on a mismatch, 0 otherwise.
+ */
+static int
+Test_Compare(const char *what, const XImage *img, int x, int y, int width, int height, const unsigned char *expected, const unsigned char *actual, size_t size)
+{
+	if (memcmp(expected, actual, size) == 0)
+	{
+		return 0;
+	}
+
+	size_t i = 0;
+	while (expected[i] == actual[i])
+	{
+		++i;
+	}
+
+	fprintf(stderr, "Convert: %s (%s) mismatch on a %dx%d, %d bpp, %d bytes per line frame at %d,%d %dx%d, byte %zu is %d, not %d\n",
+		what, Convert_Kernel(), img->width, img->height, img->bits_per_pixel, img->bytes_per_line, x, y, width, height, i, actual[i], expected[i]);
+	return 1;
+}
+
+/**
+ * @brief Convert a region of a frame every way and compare with the reference.
+ * @param [in] img The frame.
+ * @param [in] x The left edge of the region.
+ * @param [in] y The top edge of the region.
+ * @param [in] width The width of the region.
+ * @param [in] height The height of the region.
+ * @param [in] key A colour key table.
+ * @return The number of mismatches.
+ */
+static int
+Test_Region(const XImage *img, int x, int y, int width, int height, const unsigned char *key)
+{
+	// Padded destination rows, the bytes outside the region must stay untouched
+	const size_t step = img->width * 3 + 5;
+	const size_t size = step * img->height;
+	const size_t cells_step = (img->width >> CONVERT_CELL_SHIFT) + 1;
+	const size_t cells_size = cells_step * ((img->height >> CONVERT_CELL_SHIFT) + 1);
+
+	unsigned char *expected = malloc(size);
+	unsigned char *actual = malloc(size);
+	unsigned char *expected_cells = calloc(cells_size, 1);
+	unsigned char *actual_cells = calloc(cells_size, 1);
+	assert(expected && actual && expected_cells && actual_cells);
+
+	int i, j;
+	for (j = y; j < y + height; ++j)
+	{
+		for (i = x; i < x + width; ++i)
+		{
+			unsigned long pixel = XGetPixel((XImage *)img, i, j);
+			expected_cells[(j >> CONVERT_CELL_SHIFT) * cells_step + (i >> CONVERT_CELL_SHIFT)] |= key[CONVERT_KEY(pixel & 0xff, (pixel >> 8) & 0xff, (pixel >> 16) & 0xff)];
+		}
+	}
+
+	int failures = 0;
+
+	memset(expected, TEST_SENTINEL, size);
+	memset(actual, TEST_SENTINEL, size);
+	Convert_GreyReference(img, x, y, width, height, expected, step);
+	Convert_Grey(img, x, y, width, height, actual, step);
+	failures += Test_Compare("grey", img, x, y, width, height, expected, actual, size);
+
+	memset(actual, TEST_SENTINEL, size);
+	Convert_GreyKeyed(img, x, y, width, height, actual, step, key, actual_cells, cells_step);
+	failures += Test_Compare("keyed grey", img, x, y, width, height, expected, actual, size);
+	failures += Test_Compare("grey key cells", img, x, y, width, height, expected_cells, actual_cells, cells_size);
+
+	memset(expected, TEST_SENTINEL, size);
+	memset(actual, TEST_SENTINEL, size);
+	Convert_BGRReference(img, x, y, width, height, expected, step);
+	Convert_BGR(img, x, y, width, height, actual, step);
+	failures += Test_Compare("bgr", img, x, y, width, height, expected, actual, size);
+
+	memset(actual, TEST_SENTINEL, size);
+	memset(actual_cells, 0, cells_size);
+	Convert_BGRKeyed(img, x, y, width, height, actual, step, key, actual_cells, cells_step);
+	failures += Test_Compare("keyed bgr", img, x, y, width, height, expected, actual, size);
+	failures += Test_Compare("bgr key cells", img, x, y, width, height, expected_cells, actual_cells, cells_size);
+
+	free(actual_cells);
+	free(expected_cells);
+	free(actual);
+	free(expected);
+
+	return failures;
+}
+
+/**
+ * @brief Grorld pixel conversion test entry point
+ */
+int main(void)
+{
+	const char *sets[] = {"scalar", "sse2", "ssse3", "avx2"};
+	const int bpps[] = {32, 24};
+	// Shorter and longer than every vector loop, and not a multiple of any
+	const int widths[] = {1, 3, 15, 17, 33, 67, 131};
+	const int pads[] = {0, 4, 12};
+	const int offsets[] = {0, 1, 5};
+
+	unsigned int state = 2011;
+	unsigned char key[CONVERT_KEY_SIZE];
+	size_t k;
+	for (k = 0; k < sizeof (key); ++k)
+	{
+		key[k] = Test_Random(&state) & Test_Random(&state);
+	}
+
+	int failures = 0;
+	size_t s, b, w, p, o;
+	for (s = 0; s < sizeof (sets) / sizeof (sets[0]); ++s)
+	{
+		if (!Convert_Select(sets[s]))
+		{
+			printf("%s\tnot supported, skipped\n", sets[s]);
+			continue;
+		}
+
+		int regions = 0;
+		for (b = 0; b < sizeof (bpps) / sizeof (bpps[0]); ++b)
+		{
+			for (w = 0; w < sizeof (widths) / sizeof (widths[0]); ++w)
+			{
+				for (p = 0; p < sizeof (pads) / sizeof (pads[0]); ++p)
+				{
+					const int height = 11;
+					XImage *img = Test_CreateFrame(widths[w] + offsets[2] + 2, height + offsets[2], bpps[b], pads[p], &state);
+					for (o = 0; o < sizeof (offsets) / sizeof (offsets[0]); ++o)
+					{
+						failures += Test_Region(img, offsets[o], offsets[o], widths[w], height, key);
+						++regions;
+					}
+					XDestroyImage(img);
+				}
+			}
+		}
+
+		printf("%s\t%s, %d regions\n", sets[s], Convert_Kernel(), regions);
+	}
+
+	if (failures)
+	{
+		fprintf(stderr, "Convert: %d mismatch(es)\n", failures);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,529 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file latency.cpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief Grorld end-to-end latency application
+ *
+ * Measures the time from a bonus bubble appearing on the screen to the
+ * mouse pointer landing on it, through the whole of grorld: the grab,
+ * the matching, the scheduling and the mouse. A private Xvfb server is
+ * started with MIT-SHM, a fake game window titled "CivWorld on Facebook"
+ * is opened on it and grorld is started against it. The bonus template
+ * is drawn at random places, one at a time, and the pointer is sampled
+ * every millisecond until it's on the bubble.
+ *
+ * @par Usage:
+ * - Use the command "./grorld_latency" from the source directory (the
+ * templates are loaded from assets/), Xvfb has to be installed.
+ * - Use "-n N" to draw N bubbles, "-t MS" to give up on a bubble after
+ * MS milliseconds.
+ * - Use "-e PATH" to run another grorld executable, the options after
+ * "--" are passed on to it, like "./grorld_latency -- -g xcb -m ssd".
+ * - The latency percentiles are followed by the statistics of grorld,
+ * the latency of every stage tells which one a regression is in.
+ */
+
+// C++ Standard Library headers
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// C++ (C Standard Library) headers
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// POSIX headers
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Xlib headers
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+
+// OpenCV headers
+#include <opencv/highgui.h>
+
+// Local C headers
+extern "C"
+{
+#include "mouse.h"
+#include "timer.h"
+}
+
+/**
+ * @def LATENCY_WIDTH
+ * @brief The width of the fake game window.
+ */
+#define LATENCY_WIDTH 1024
+
+/**
+ * @def LATENCY_HEIGHT
+ * @brief The height of the fake game window.
+ */
+#define LATENCY_HEIGHT 768
+
+/**
+ * @def LATENCY_ORIGIN
+ * @brief Where the fake game window is on the screen, in both directions.
+ *
+ * The pointer is parked in the corner of the screen between the bubbles,
+ * outside the window.
+ */
+#define LATENCY_ORIGIN 64
+
+/**
+ * @def LATENCY_TILE
+ * @brief The size of the flat coloured tiles of the fake game map.
+ */
+#define LATENCY_TILE 32
+
+/**
+ * @def LATENCY_STARTUP
+ * @brief The time (in milliseconds) Xvfb and grorld get to start.
+ */
+#define LATENCY_STARTUP 10000
+
+/**
+ * @def LATENCY_GAP_MIN
+ * @brief The shortest time (in milliseconds) without a bubble.
+ */
+#define LATENCY_GAP_MIN 300
+
+/**
+ * @def LATENCY_GAP_MAX
+ * @brief The longest time (in milliseconds) without a bubble.
+ */
+#define LATENCY_GAP_MAX 1500
+
+/**
+ * @brief The nearest-rank percentile of some samples.
+ * @param [in] samples The samples, sorted in place.
+ * @param [in] percent The percentile.
+ * @return The percentile, 0 without samples.
+ */
+static double
+percentile(std::vector<double> &samples, double percent)
+{
+	if (samples.empty())
+	{
+		return 0;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	size_t rank = static_cast<size_t>(percent / 100.0 * samples.size() + 0.999999);
+	return samples[std::min(std::max<size_t>(rank, 1), samples.size()) - 1];
+}
+
+/**
+ * @brief Sleep for a while.
+ * @param [in] ms The time in milliseconds.
+ */
+static void
+rest(long ms)
+{
+	struct timespec ts = millis_to_timespec(ms);
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, NULL);
+}
+
+/**
+ * @brief Start a program.
+ * @param [in] argv The program and its arguments, NULL terminated.
+ * @param [in] quiet Send its standard output to /dev/null.
+ * @return The process id, -1 if it couldn't be started.
+ */
+static pid_t
+spawn(char *const argv[], bool quiet)
+{
+	pid_t pid = fork();
+	if (pid != 0)
+	{
+		return pid;
+	}
+
+	if (quiet)
+	{
+		int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		close(null);
+	}
+	execvp(argv[0], argv);
+	fprintf(stderr, "Latency: Unable to run %s\n", argv[0]);
+	_exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Stop a program started by spawn().
+ * @param [in] pid The process id.
+ */
+static void
+reap(pid_t pid)
+{
+	if (pid > 0)
+	{
+		kill(pid, SIGTERM);
+		waitpid(pid, NULL, 0);
+	}
+}
+
+/**
+ * @brief If a program started by spawn() is still running.
+ * @param [in] pid The process id.
+ * @return True while it runs.
+ */
+static bool
+running(pid_t pid)
+{
+	return waitpid(pid, NULL, WNOHANG) == 0;
+}
+
+/**
+ * @brief Start a private Xvfb server on the first free display.
+ * @param [out] display The connection to it.
+ * @return The process id of the server, -1 if it didn't start.
+ */
+static pid_t
+startServer(Display **display)
+{
+	// A display is taken if its lock file exists
+	int number = 99;
+	char lock[64];
+	do
+	{
+		snprintf(lock, sizeof (lock), "/tmp/.X%d-lock", ++number);
+	}
+	while (access(lock, F_OK) == 0);
+
+	char name[16];
+	snprintf(name, sizeof (name), ":%d", number);
+	char geometry[32];
+	snprintf(geometry, sizeof (geometry), "%dx%dx24", LATENCY_WIDTH + 2 * LATENCY_ORIGIN, LATENCY_HEIGHT + 2 * LATENCY_ORIGIN);
+
+	const char *argv[] = {"Xvfb", name, "-screen", "0", geometry, "-nolisten", "tcp", "+extension", "MIT-SHM", NULL};
+	pid_t pid = spawn(const_cast<char *const *>(argv), true);
+	if (pid < 0)
+	{
+		return -1;
+	}
+
+	// grorld finds the server the usual way
+	setenv("DISPLAY", name, 1);
+	for (int waited = 0; waited < LATENCY_STARTUP && running(pid); waited += 50)
+	{
+		*display = XOpenDisplay(name);
+		if (*display)
+		{
+			std::cout << "Latency: Xvfb on " << name << std::endl;
+			return pid;
+		}
+		rest(50);
+	}
+
+	std::cerr << "Latency: Unable to start Xvfb" << std::endl;
+	reap(pid);
+	return -1;
+}
+
+/**
+ * @brief Make an image of the server's format.
+ *
+ * The server runs at depth 24, 32 bits per pixel.
+ *
+ * @param [in] display The connection.
+ * @param [in] width The width.
+ * @param [in] height The height.
+ * @return The image, free it with XDestroyImage().
+ */
+static XImage *
+createImage(Display *display, int width, int height)
+{
+	char *data = static_cast<char *>(malloc(width * height * 4));
+	assert(data);
+
+	XImage *img = XCreateImage(display, DefaultVisual(display, DefaultScreen(display)), 24, ZPixmap, 0, data, width, height, 32, 0);
+	assert(img);
+
+	return img;
+}
+
+/**
+ * @brief Ask grorld for its statistics.
+ * @param [in] path The statistics socket of grorld.
+ * @param [out] text The statistics, NULL to only check that grorld is up.
+ * @return True if grorld answered.
+ */
+static bool
+statistics(const char *path, std::string *text)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert(fd >= 0);
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof (address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path, sizeof (address.sun_path) - 1);
+	if (connect(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof (address)) != 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	char buffer[1024];
+	ssize_t res;
+	while ((res = read(fd, buffer, sizeof (buffer))) > 0)
+	{
+		if (text)
+		{
+			text->append(buffer, res);
+		}
+	}
+	close(fd);
+
+	return true;
+}
+
+/**
+ * @brief Print the command line options.
+ * @param [in] name The name of the executable.
+ */
+static void
+usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " [-e grorld] [-n bubbles] [-t timeout] [-- grorld options]" << std::endl;
+	std::cerr << "  -e  the grorld executable (default: ./grorld)" << std::endl;
+	std::cerr << "  -n  the number of bubbles (default: 50)" << std::endl;
+	std::cerr << "  -t  milliseconds to wait for the pointer on a bubble (default: 3000)" << std::endl;
+}
+
+/**
+ * @brief Grorld end-to-end latency entry point
+ */
+int main(int argc, char **argv)
+{
+	std::cout << "Grorld latency, version 1" << std::endl;
+
+	const char *executable = "./grorld";
+	int bubbles = 50;
+	int timeout = 3000;
+	int option;
+	while ((option = getopt(argc, argv, "e:n:t:")) != -1)
+	{
+		switch (option)
+		{
+		case 'e':
+			executable = optarg;
+			break;
+
+		case 'n':
+			bubbles = atoi(optarg);
+			break;
+
+		case 't':
+			timeout = atoi(optarg);
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (bubbles < 1 || timeout < 1)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// The bubble, as the game draws it
+	const cv::Mat bonus = cv::imread("assets/bonus.png");
+	if (bonus.empty())
+	{
+		std::cerr << "Latency: Unable to load assets/bonus.png" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	Display *display = NULL;
+	pid_t server = startServer(&display);
+	if (server < 0)
+	{
+		return EXIT_FAILURE;
+	}
+
+	std::mt19937 engine(42);
+
+	// The fake game window, a map of flat coloured tiles
+	Window window = XCreateSimpleWindow(display, DefaultRootWindow(display), LATENCY_ORIGIN, LATENCY_ORIGIN, LATENCY_WIDTH, LATENCY_HEIGHT, 0, 0, 0);
+	XStoreName(display, window, "CivWorld on Facebook");
+	XMapRaised(display, window);
+	GC gc = XCreateGC(display, window, 0, NULL);
+
+	XImage *background = createImage(display, LATENCY_WIDTH, LATENCY_HEIGHT);
+	std::uniform_int_distribution<int> colour(0, 0xffffff);
+	for (int y = 0; y < LATENCY_HEIGHT; y += LATENCY_TILE)
+	{
+		for (int x = 0; x < LATENCY_WIDTH; x += LATENCY_TILE)
+		{
+			const unsigned long tile = colour(engine);
+			for (int i = y; i < std::min(y + LATENCY_TILE, LATENCY_HEIGHT); ++i)
+			{
+				for (int j = x; j < std::min(x + LATENCY_TILE, LATENCY_WIDTH); ++j)
+				{
+					XPutPixel(background, j, i, tile);
+				}
+			}
+		}
+	}
+	XPutImage(display, window, gc, background, 0, 0, 0, 0, LATENCY_WIDTH, LATENCY_HEIGHT);
+
+	XImage *bubble = createImage(display, bonus.cols, bonus.rows);
+	for (int y = 0; y < bonus.rows; ++y)
+	{
+		for (int x = 0; x < bonus.cols; ++x)
+		{
+			const cv::Vec3b &pixel = bonus.at<cv::Vec3b>(y, x);
+			XPutPixel(bubble, x, y, (pixel[2] << 16) | (pixel[1] << 8) | pixel[0]);
+		}
+	}
+	XSync(display, False);
+
+	// The pointer is read on the same connection, and parked with it
+	Mouse_Share(display);
+	Pointer *pointer = Mouse_Initialize(window);
+	Mouse_SetBackend(MOUSE_XTEST);
+
+	// grorld serves its statistics, that's also how we know it's up
+	char endpoint[64];
+	snprintf(endpoint, sizeof (endpoint), "/tmp/grorld-latency.%d.sock", getpid());
+	std::vector<char *> args;
+	args.push_back(const_cast<char *>(executable));
+	args.push_back(const_cast<char *>("-s"));
+	args.push_back(endpoint);
+	for (int i = optind; i < argc; ++i)
+	{
+		args.push_back(argv[i]);
+	}
+	args.push_back(NULL);
+
+	pid_t grorld = spawn(args.data(), true);
+	int waited = 0;
+	while (grorld > 0 && waited < LATENCY_STARTUP && running(grorld) && !statistics(endpoint, NULL))
+	{
+		rest(50);
+		waited += 50;
+	}
+	if (grorld < 0 || waited >= LATENCY_STARTUP || !statistics(endpoint, NULL))
+	{
+		std::cerr << "Latency: " << executable << " didn't start" << std::endl;
+		reap(grorld);
+		Mouse_Deinitialize(pointer);
+		XCloseDisplay(display);
+		reap(server);
+		return EXIT_FAILURE;
+	}
+
+	std::cout << "Latency, " << bubbles << " bubbles in a " << LATENCY_WIDTH << "x" << LATENCY_HEIGHT << " window, " << timeout << " ms timeout" << std::endl;
+	std::vector<double> latencies;
+	int found = 0, missed = 0, misplaced = 0;
+	for (int i = 0; i < bubbles && running(grorld); ++i)
+	{
+		// Park the pointer outside the window, and let grorld idle for a while
+		Mouse_SetCoords(pointer, 0, 0);
+		rest(std::uniform_int_distribution<int>(LATENCY_GAP_MIN, LATENCY_GAP_MAX)(engine));
+
+		// The clock starts once the server has drawn the bubble
+		const int x = std::uniform_int_distribution<int>(0, LATENCY_WIDTH - bonus.cols)(engine);
+		const int y = std::uniform_int_distribution<int>(0, LATENCY_HEIGHT - bonus.rows)(engine);
+		XPutImage(display, window, gc, bubble, 0, 0, x, y, bonus.cols, bonus.rows);
+		XSync(display, False);
+		const long long drawn = timer_now();
+
+		// grorld hovers anywhere on the bubble
+		bool moved = false, landed = false;
+		long long now = drawn;
+		while (!landed && now - drawn < timeout * 1000000ll)
+		{
+			int px, py;
+			Mouse_GetCoords(pointer, &px, &py);
+			now = timer_now();
+
+			px -= LATENCY_ORIGIN + x;
+			py -= LATENCY_ORIGIN + y;
+			landed = px >= 0 && px < bonus.cols && py >= 0 && py < bonus.rows;
+			moved = moved || px != -LATENCY_ORIGIN - x || py != -LATENCY_ORIGIN - y;
+			if (!landed)
+			{
+				rest(1);
+			}
+		}
+
+		if (landed)
+		{
+			++found;
+			latencies.push_back((now - drawn) / 1e6);
+		}
+		else
+		{
+			++(moved ? misplaced : missed);
+		}
+
+		XPutImage(display, window, gc, background, x, y, x, y, bonus.cols, bonus.rows);
+		XSync(display, False);
+	}
+
+	// Where the time went, according to grorld
+	std::string stages;
+	statistics(endpoint, &stages);
+
+	std::cout << "found\tmissed\tmisplaced\tp50 ms\tp90 ms\tp99 ms\tmax ms" << std::endl;
+	std::cout << found << "/" << bubbles << "\t" << missed << "\t" << misplaced << "\t\t" << std::fixed << std::setprecision(1)
+		<< percentile(latencies, 50) << "\t" << percentile(latencies, 90) << "\t" << percentile(latencies, 99) << "\t" << percentile(latencies, 100) << std::endl;
+	std::cout << std::endl << stages;
+
+	const bool alive = running(grorld);
+	if (!alive)
+	{
+		std::cerr << "Latency: " << executable << " stopped" << std::endl;
+	}
+
+	// Clean up and exit
+	reap(grorld);
+	unlink(endpoint);
+	Mouse_Deinitialize(pointer);
+	XDestroyImage(bubble);
+	XDestroyImage(background);
+	XFreeGC(display, gc);
+	XDestroyWindow(display, window);
+	XCloseDisplay(display);
+	reap(server);
+
+	return alive && found > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
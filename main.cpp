@@ -30,18 +30,68 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
  * Grorld is an application to automatically grind bonus resources in
  * CivWorld. As soon as one of these bonus bubbles appear on the screen
  * this application will automatically move the mouse to that location.
- * Hence you can have the computer grab bonuses all night while you
- * sleep...
+ * When several bubbles are up at once, the mouse visits all of them on
+ * one short path. Hence you can have the computer grab bonuses all night
+ * while you sleep...
  * 
  * @par Usage:
  * - Use the command "./grorld" from the directory where you installed
  * it to start the application.
+ * - Use "./grorld -a" to play in every open game window at once. The
+ * windows take turns, the busy ones more often than the idle ones, and
+ * share the matching threads and the CPU budget.
+ * - Use "./grorld -m pyramid" to search downsampled frames first, or
+ * "./grorld -m fft" to correlate in the frequency domain, or "./grorld
+ * -m ssd" to compare exact integer pixel differences with SIMD code.
+ * "./grorld -m ssda" compares the most telling pixels first and gives up
+ * on a position as soon as it can't be a hit. The default "-m exhaustive"
+ * searches every position at full resolution.
+ * - Use "./grorld -j 0" to spread the matching over all CPU cores, or
+ * "-j N" for N threads.
+ * - Use "./grorld -k" to look for the colours of the bonus bubbles and
+ * the city button while converting a frame, they are only searched for
+ * where their colours are. A frame without any costs little more than
+ * the conversion.
+ * - The templates, and what to do when they are found, are listed in
+ * assets/grorld.rules. Every rule has its own priority and interval, a
+ * template that is rarely needed is only searched for now and then. Use
+ * "./grorld -l FILE" to read the rules from another file.
+ * - Use "./grorld -o" to score the search on the fly instead of keeping
+ * the whole result, this saves memory bandwidth on large windows.
+ * - Use "./grorld -p" to grab, convert, match and act on separate
+ * threads, this shortens the time from a bubble to the mouse pointer.
+ * - Use "./grorld -g xcb" to have the next frame copied by the X server
+ * while the last one is searched. The statistics tell how much of the
+ * grab wait is hidden that way.
+ * - The mouse is moved and clicked with the XTEST extension, without
+ * waiting for the X server. Use "./grorld -i events" to warp the pointer
+ * and send the clicks to the window under it, like the first versions.
+ * - Use "./grorld -r FILE" to record the session into a capture log, and
+ * "./grorld -R FILE" to replay it without the game (or an X server). The
+ * replay runs at the recorded speed, add "-f" to replay it as fast as
+ * possible. Nothing is clicked during a replay, the hits are only printed.
+ * - Use "./grorld -t" to search around the places where something was
+ * found lately first, the whole window is only searched when that
+ * misses (or every 16 frames).
+ * - Use "./grorld -c 25" to keep Grorld below 25% of one CPU core. The
+ * frame rate follows the bonuses, it's high while they keep coming and
+ * drops when nothing happens. No frames are grabbed while the game
+ * window is minimized or covered.
+ * - Use "./grorld -s /tmp/grorld.sock" to serve statistics on a Unix
+ * socket, "nc -U /tmp/grorld.sock" prints the frame rate, hits per hour
+ * and the latency of every stage.
+ * - Use "./grorld_pack assets/bonus.png assets/city.png" to decode the
+ * templates once into assets/grorld.pack, Grorld maps the pack at startup
+ * instead of decoding the images.
  * @par Installation:
- * - Run "sudo apt-get install cmake libx11-dev libcv-dev libcvaux-dev
- * libhighgui-dev && cmake . && make" from the directory where the
- * source is located. Follow the instructions.
+ * - Run "sudo apt-get install cmake libx11-dev libxdamage-dev libxtst-dev
+ * libx11-xcb-dev libxcb-shm0-dev libxcb-damage0-dev libxcb-xfixes0-dev
+ * libcv-dev libcvaux-dev libhighgui-dev && cmake . && make" from the
+ * directory where the source is located. Follow the instructions.
  * 
- * @attention - Do NOT move the browser while playing
+ * @attention - The browser may be moved and resized while playing
+ * @attention - The browser may be zoomed from 67% to 150%, Grorld locks on to
+ * the zoom level it finds the bubbles at
  * @attention - Always have the browser window at front
  * 
  * Official homepage:
@@ -49,16 +99,29 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
  */
 
 // C++ Standard Library headers
+#include <algorithm>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <random>
+#include <vector>
 
 // C++ (C Standard Library) headers
 #include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+// POSIX headers
+#include <unistd.h>
+
+// OpenCV headers
+#include <opencv/highgui.h>
 
 // Local C headers
 extern "C"
 {
+#include "audit.h"
 #include "mouse.h"
 #include "screen.h"
 #include "timer.h"
@@ -66,16 +129,207 @@ extern "C"
 
 // Local C++ headers
 #include "match.hpp"
+#include "pipeline.hpp"
+#include "pool.hpp"
+#include "rules.hpp"
+#include "scheduler.hpp"
+#include "stats.hpp"
 
 /**
- * @def MATCHING_THRESHOLD
- * @brief A threshold determine template match or miss
- * 
- * The score each template matching need atleast reach to be treated
- * as a hit. If the score is below this value, the template is considered
- * NOT to be part of current search image.
+ * @brief A game window.
+ */
+struct Target
+{
+	Capture *capture; ///< The captured window
+	Pointer *pointer; ///< The mouse, NULL during a replay
+	std::unique_ptr<Match> match; ///< The matching algorithm of the window
+	long long due; ///< When the next frame should be grabbed
+	cv::Point hovered; ///< Where the mouse was sent last, on the screen
+	std::vector<long long> checked; ///< When every rule was checked last
+};
+
+/**
+ * @brief Configure a matching algorithm object.
+ * @param [in,out] m The matching algorithm.
+ * @param [in] mode The template matching mode.
+ * @param [in] pool The threads shared by all matching algorithms, NULL for none.
+ * @param [in] streaming Score the search without keeping the whole result.
+ * @param [in] tracking Search around the recent hits first.
+ * @param [in] rules The rules, their templates are registered.
+ */
+static void
+setup(Match &m, Match::Mode mode, const std::shared_ptr<Pool> &pool, bool streaming, bool tracking, const Rules &rules)
+{
+	m.setMode(mode);
+	m.setStreaming(streaming);
+	m.setTracking(tracking);
+	if (pool)
+	{
+		m.setPool(pool);
+	}
+
+	rules.attach(m);
+}
+
+/**
+ * @brief Print a hit.
+ * @param [in] rules The rules.
+ * @param [in] hit What was found.
+ */
+static void
+report(const Rules &rules, const Hit &hit)
+{
+	const cv::Point position = hit.position + hit.origin;
+
+	std::cout << time(NULL) << "\t" << rules[hit.what].name << ": at " << position.x << "x" << position.y << " (score: " << hit.score << ")";
+	if (hit.stops > 1)
+	{
+		std::cout << " and " << hit.stops - 1 << " more";
+	}
+	std::cout << std::endl;
+}
+
+/**
+ * @brief Order the places the mouse visits into a short path.
+ *
+ * Nearest neighbour first, then 2-opt: a part of the path is reversed for
+ * as long as that makes the path shorter. The path starts at the mouse
+ * and doesn't come back.
+ * @par More info here:
+ * - http://en.wikipedia.org/wiki/Nearest_neighbour_algorithm
+ * - http://en.wikipedia.org/wiki/2-opt
+ *
+ * @param [in,out] stops The places, in visiting order when done.
+ * @param [in] count The number of places.
+ * @param [in] start Where the mouse is.
+ */
+static void
+route(cv::Point *stops, int count, const cv::Point &start)
+{
+	auto distance = [](const cv::Point &a, const cv::Point &b) { return std::sqrt(static_cast<double>((a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y))); };
+
+	cv::Point from = start;
+	for (int i = 0; i < count; ++i)
+	{
+		int nearest = i;
+		for (int j = i + 1; j < count; ++j)
+		{
+			if (distance(from, stops[j]) < distance(from, stops[nearest]))
+			{
+				nearest = j;
+			}
+		}
+		std::swap(stops[i], stops[nearest]);
+		from = stops[i];
+	}
+
+	// Only the edges into and out of the reversed part change
+	bool improved = true;
+	while (improved)
+	{
+		improved = false;
+		for (int i = 0; i < count - 1; ++i)
+		{
+			for (int j = i + 1; j < count; ++j)
+			{
+				const cv::Point &before = i == 0 ? start : stops[i - 1];
+				const double now = distance(before, stops[i]) + (j + 1 < count ? distance(stops[j], stops[j + 1]) : 0);
+				const double then = distance(before, stops[j]) + (j + 1 < count ? distance(stops[i], stops[j + 1]) : 0);
+				if (then + 1e-9 < now)
+				{
+					std::reverse(stops + i, stops + j + 1);
+					improved = true;
+				}
+			}
+		}
+	}
+}
+
+/**
+ * @brief Move (and click) the mouse according to a hit.
+ * @param [in] rules The rules, the one of the hit tells what to do.
+ * @param [in] target Where it was found.
+ * @param [in] hit What was found.
+ * @param [in,out] engine The pseudorandom number generator.
+ * @param [in,out] stats Times the mouse and the waiting for a redraw.
+ */
+static void
+act(const Rules &rules, Target &target, const Hit &hit, std::mt19937 &engine, Stats &stats)
+{
+	const Rules::Rule &rule = rules[hit.what];
+	const long long start = timer_now();
+	stats.hit();
+
+	// We got a hit on the serach image, translate that point into a screen coordinate for the mouse to hover
+	const cv::Point position = hit.position + hit.origin;
+
+	if (rule.action == Rules::HOVER)
+	{
+		// Hover every place on one short path (use some randomness for the pointer placement...)
+		cv::Point stops[PIPELINE_STOPS];
+		for (int i = 0; i < hit.stops; ++i)
+		{
+			stops[i] = hit.route[i] + hit.origin;
+			stops[i].x += std::uniform_int_distribution<int>(0, hit.size.width - 1)(engine);
+			stops[i].y += std::uniform_int_distribution<int>(0, hit.size.height - 1)(engine);
+		}
+		route(stops, hit.stops, target.hovered);
+
+		for (int i = 0; i < hit.stops; ++i)
+		{
+			// Give the game a moment to notice every bubble
+			if (i > 0)
+			{
+				struct timespec dwell = millis_to_timespec(std::uniform_int_distribution<int>(30, 80)(engine));
+				clock_nanosleep(CLOCK_MONOTONIC, 0, &dwell, NULL);
+				stats.hit();
+			}
+			Mouse_SetCoords(target.pointer, stops[i].x, stops[i].y);
+		}
+		target.hovered = stops[hit.stops - 1];
+	}
+	else if (rule.action == Rules::CLICK)
+	{
+		// Hover the mouse over it and click
+		target.hovered = cv::Point(position.x + (hit.size.width / 2), position.y + (hit.size.height / 2));
+		Mouse_ClickAt(target.pointer, target.hovered.x, target.hovered.y, Button1);
+	}
+	long long t = stats.lap(Stats::ACT, start);
+	report(rules, hit);
+
+	// Wait for the window to redraw (it's slow after a click) before trying something clever
+	if (rule.pause[1] > 0)
+	{
+		struct timespec pause = millis_to_timespec(std::uniform_int_distribution<int>(rule.pause[0], rule.pause[1])(engine));
+		clock_nanosleep(CLOCK_MONOTONIC, 0, &pause, NULL);
+		stats.lap(Stats::SLEEP, t);
+	}
+}
+
+/**
+ * @brief Print the command line options.
+ * @param [in] name The name of the executable.
  */
-#define MATCHING_THRESHOLD 2.7
+static void
+usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " [-a | -p | -r file | -R file [-f]] [-c percent] [-g xlib|xcb] [-i events|xtest] [-j threads] [-k] [-l rules] [-m exhaustive|pyramid|fft|ssd|ssda] [-o] [-s socket] [-t]" << std::endl;
+	std::cerr << "  -a  play in every game window, taking turns" << std::endl;
+	std::cerr << "  -c  CPU budget in percent of one core (default: no limit)" << std::endl;
+	std::cerr << "  -f  replay as fast as possible, instead of at the recorded speed" << std::endl;
+	std::cerr << "  -g  how the frames are grabbed (default: xlib)" << std::endl;
+	std::cerr << "  -i  how the mouse is moved and clicked (default: xtest)" << std::endl;
+	std::cerr << "  -j  number of matching threads, 0 for one per core (default: no threads)" << std::endl;
+	std::cerr << "  -k  search only where the colours of the templates are" << std::endl;
+	std::cerr << "  -l  what to look for and what to do about it (default: assets/grorld.rules)" << std::endl;
+	std::cerr << "  -m  template matching mode (default: exhaustive)" << std::endl;
+	std::cerr << "  -o  score the search on the fly, without keeping the result" << std::endl;
+	std::cerr << "  -p  run capture, matching and actions on separate threads" << std::endl;
+	std::cerr << "  -r  record the captured frames into a capture log" << std::endl;
+	std::cerr << "  -s  serve statistics on a Unix socket" << std::endl;
+	std::cerr << "  -t  search around the recent hits first" << std::endl;
+	std::cerr << "  -R  replay a capture log instead of capturing the game, nothing is clicked" << std::endl;
+}
 
 /**
  * @brief Grorld entry point
@@ -83,80 +337,378 @@ extern "C"
  * Grorld application entry point and main loop. It also contains
  * the logic to automatically grind CivWorld bonus resources!
  */
-int main(const int argc, const char **argv)
+int main(int argc, char **argv)
 {
 	std::cout << "Grorld, version 1" << std::endl;
 
+	// Parse the command line options
+	Match::Mode mode = Match::EXHAUSTIVE;
+	int threads = -1;
+	bool all = false;
+	bool pipelined = false;
+	bool streaming = false;
+	bool tracking = false;
+	bool keyed = false;
+	bool fast = false;
+	const char *record = NULL;
+	const char *replay = NULL;
+	const char *endpoint = NULL;
+	const char *ruleset = "assets/grorld.rules";
+	int budget = 0;
+	int backend = MOUSE_XTEST;
+	int grabbing = SCREEN_XLIB;
+	int option;
+	while ((option = getopt(argc, argv, "ac:fg:i:j:kl:m:opr:R:s:t")) != -1)
+	{
+		switch (option)
+		{
+		case 'a':
+			all = true;
+			break;
+
+		case 'c':
+			budget = atoi(optarg);
+			if (budget < 1)
+			{
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'f':
+			fast = true;
+			break;
+
+		case 'g':
+			if (!strcmp(optarg, "xlib"))
+			{
+				grabbing = SCREEN_XLIB;
+			}
+			else if (!strcmp(optarg, "xcb"))
+			{
+				grabbing = SCREEN_XCB;
+			}
+			else
+			{
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'i':
+			if (!strcmp(optarg, "events"))
+			{
+				backend = MOUSE_EVENTS;
+			}
+			else if (!strcmp(optarg, "xtest"))
+			{
+				backend = MOUSE_XTEST;
+			}
+			else
+			{
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'j':
+			threads = atoi(optarg);
+			if (threads < 0)
+			{
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'k':
+			keyed = true;
+			break;
+
+		case 'l':
+			ruleset = optarg;
+			break;
+
+		case 'm':
+			if (!strcmp(optarg, "exhaustive"))
+			{
+				mode = Match::EXHAUSTIVE;
+			}
+			else if (!strcmp(optarg, "pyramid"))
+			{
+				mode = Match::PYRAMID;
+			}
+			else if (!strcmp(optarg, "fft"))
+			{
+				mode = Match::FFT;
+			}
+			else if (!strcmp(optarg, "ssd"))
+			{
+				mode = Match::SSD;
+			}
+			else if (!strcmp(optarg, "ssda"))
+			{
+				mode = Match::SSDA;
+			}
+			else
+			{
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'o':
+			streaming = true;
+			break;
+
+		case 'p':
+			pipelined = true;
+			break;
+
+		case 'r':
+			record = optarg;
+			break;
+
+		case 'R':
+			replay = optarg;
+			break;
+
+		case 's':
+			endpoint = optarg;
+			break;
+
+		case 't':
+			tracking = true;
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// A replay has one image only, and recording it again makes no sense
+	if (replay && (pipelined || record || all))
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// The pipeline and the capture log follow a single window
+	if (all && (pipelined || record))
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Load what we want to match/find on the screen, and what to do about it (the pack has the templates ready to use)
+	Rules rules;
+	if (!rules.load(ruleset, "assets/grorld.pack", keyed))
+	{
+		return EXIT_FAILURE;
+	}
+
 	// Create a pseudorandom number generator instance
 	// (http://en.wikipedia.org/wiki/C%2B%2B0x#Extensible_random_number_facility)
 	std::mt19937 engine(time(NULL));
 
-	// Initialize mouse & screen, put the target window in front
-	Mouse_Initialize();
-	XImage *grab = Screen_Initialize("CivWorld on Facebook");
-	assert(grab);
+	// The stages share the X connections
+	if (pipelined)
+	{
+		XInitThreads();
+	}
 
-	// Create the macthing algoritm object
-	Match m(grab);
+	std::vector<Target> targets;
+	if (replay)
+	{
+		// The frames come from the capture log, the mouse is left alone
+		Target target;
+		target.capture = Screen_Replay(replay, !fast);
+		target.pointer = NULL;
+		target.checked.assign(rules.size(), 0);
+		if (!target.capture)
+		{
+			return EXIT_FAILURE;
+		}
+		targets.push_back(std::move(target));
+	}
+	else
+	{
+		// Initialize mouse & screen, put the target windows in front
+		Capture *captures[SCREEN_MAX_WINDOWS];
+		int count = Screen_InitializeAll("CivWorld on Facebook", captures, all ? SCREEN_MAX_WINDOWS : 1);
+		assert(count > 0);
 
-	// Load images that we want to match/find on the screen
-	const cv::Mat bonus = Match::loadTemplate("assets/bonus.png");
-	const cv::Mat city = Match::loadTemplate("assets/city.png");
+		// The mouse shares the connection of the captures
+		Mouse_Share(Screen_Display());
+		for (int i = 0; i < count; ++i)
+		{
+			Target target;
+			target.capture = captures[i];
+			target.pointer = Mouse_Initialize(Screen_Window(captures[i]));
+			target.checked.assign(rules.size(), 0);
+			Screen_SetBackend(captures[i], grabbing);
+			targets.push_back(std::move(target));
+		}
+		Mouse_SetBackend(backend);
 
-	// Main loop (http://en.wikipedia.org/wiki/Event_loop)
-	while (true)
+		if (record && !Screen_Record(targets[0].capture, record))
+		{
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Time the stages of the main loop, and pace every window
+	Stats stats(endpoint);
+	Scheduler scheduler(budget, targets.size());
+
+	// All windows share the matching threads
+	std::shared_ptr<Pool> pool;
+	if (threads >= 0)
 	{
-		// Grab a new frame (much like doing a screenshot)
-		Screen_Get();
-		// Prepare the matching algoritm with the new frame...
-		m.prepare();
+		pool = std::make_shared<Pool>(threads);
+		std::cout << "Match: " << pool->size() << " thread(s)" << std::endl;
+	}
 
-		// Search (via a template matching algorithm) for a bonus bubbles
-		std::tuple<cv::Point, double> mr = m.match(bonus);
-#ifndef TEST
-		if (std::get<1>(mr) > MATCHING_THRESHOLD)
+	if (pipelined)
+	{
+		// One matching algoritm object per frame buffer
+		Target &target = targets[0];
+		Pipeline p(target.capture, stats);
+		for (int i = 0; i < p.size(); ++i)
 		{
-			// We got a hit on the serach image, translate that point into a screen coordinate for the mouse to hover
-			Screen_TranslateCoordinates(&std::get<0>(mr).x, &std::get<0>(mr).y);
+			setup(p.matcher(i), mode, pool, streaming, tracking, rules);
+		}
 
-			// Hover the mouse over it (use some randomness for the pointer placement...)
-			Mouse_SetCoords(std::get<0>(mr).x + std::uniform_int_distribution<int>(0, bonus.size().width)(engine), std::get<0>(mr).y + std::uniform_int_distribution<int>(0, bonus.size().height)(engine));
+		std::mt19937 pace(engine());
+		p.run(	[&](Match &m) { return rules.detect(m, target.checked, timer_now()); },
+				[&](const Hit &hit) { scheduler.hit(); act(rules, target, hit, engine, stats); },
+				[&]() { return scheduler.next(pace); });
+	}
 
-			std::cout << time(NULL) << "\tBONUS: at " << std::get<0>(mr).x << "x" << std::get<0>(mr).y << " (score: " << std::get<1>(mr) << ")" << std::endl;
-			continue;
+	// Create the macthing algoritm objects
+	for (size_t i = 0; i < targets.size(); ++i)
+	{
+		targets[i].match.reset(new Match(Screen_Buffer(targets[i].capture, 0)));
+		setup(*targets[i].match, mode, pool, streaming, tracking, rules);
+		targets[i].due = 0;
+	}
+
+	// Main loop (http://en.wikipedia.org/wiki/Event_loop)
+	size_t last = targets.size() - 1;
+	long frame = 0;
+	while (true)
+	{
+		// The window that is due first, the others get their turn in order at a tie
+		size_t i = (last + 1) % targets.size();
+		for (size_t j = 1; j < targets.size(); ++j)
+		{
+			size_t k = (last + 1 + j) % targets.size();
+			if (targets[k].due < targets[i].due)
+			{
+				i = k;
+			}
 		}
+		Target &target = targets[i];
+		last = i;
 
-		// Once in a while, check if we need to press the city button...
-		else
+		// Give the computer some time to rest before processing the next frame
+		long long t = timer_now();
+		if (target.due > t)
 		{
-			std::tuple<cv::Point, double> mr = m.match(city);
-			if (std::get<1>(mr) > MATCHING_THRESHOLD)
+			struct timespec due;
+			due.tv_sec = target.due / 1000000000ll;
+			due.tv_nsec = target.due % 1000000000ll;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+			t = stats.lap(Stats::SLEEP, t);
+		}
+
+		// Nothing to grab while the window is minimized or covered, the others go on meanwhile
+		if (!Screen_Visible(target.capture))
+		{
+			if (targets.size() > 1)
 			{
-				// We got a hit on the serach image, translate that point into a screen coordinate for the mouse to hover
-				Screen_TranslateCoordinates(&std::get<0>(mr).x, &std::get<0>(mr).y);
+				target.due = t + SCHEDULER_SLOW * 1000000ll;
+				continue;
+			}
+			Screen_WaitVisible(target.capture);
+			t = stats.lap(Stats::SLEEP, t);
+		}
+		scheduler.begin(i);
+
+		// Grab a new frame (much like doing a screenshot), only the parts that changed are copied
+		int damaged = Screen_Get(target.capture);
+		if (damaged < 0)
+		{
+			break;
+		}
+		t = stats.lap(Stats::GRAB, t);
+		if (grabbing == SCREEN_XCB && !replay)
+		{
+			long long hidden;
+			Screen_Waited(target.capture, &hidden);
+			stats.hide(hidden);
+		}
 
-				// Hover the mouse over it and click
-				Mouse_SetCoords(std::get<0>(mr).x + (city.size().width / 2), std::get<0>(mr).y + (city.size().height / 2));
-				Mouse_Click(Button1);
+		// A resized window (or the XCB backend) comes with a new buffer
+		target.match->setImage(Screen_Buffer(target.capture, 0));
 
-				std::cout << time(NULL) << "\tCITY: at " << std::get<0>(mr).x << "x" << std::get<0>(mr).y << " (score: " << std::get<1>(mr) << ")" << std::endl;
+		// Prepare the matching algoritm with the changed parts of the new frame...
+		const unsigned long allocations = Audit_Allocations();
+		target.match->prepare(Screen_GetDamage(target.capture, &damaged), damaged);
+		t = stats.lap(Stats::PREPARE, t);
 
-				// Wait for the window to redraw (it's slow) before trying something clever
-				struct timespec delay_click = millis_to_timespec(std::uniform_int_distribution<int>(2000, 4000)(engine));
-				clock_nanosleep(CLOCK_MONOTONIC, 0, &delay_click, NULL);
-				continue;
+		// ...search it...
+		Hit hit = rules.detect(*target.match, target.checked, timer_now());
+		Screen_TranslateCoordinates(target.capture, &hit.origin.x, &hit.origin.y);
+		t = stats.lap(Stats::MATCH, t);
+		stats.frame();
+
+		// The matching shouldn't touch the heap once the buffers are made (ALLOC_AUDIT builds only)
+		const unsigned long allocated = Audit_Allocations() - allocations;
+		if (++frame > AUDIT_WARMUP * static_cast<long>(targets.size()) && allocated > 0)
+		{
+			std::cerr << "Audit: " << allocated << " allocation(s) in the matching of frame " << frame << std::endl;
+		}
+		if (replay)
+		{
+			// Tell what would have been done, the capture log is already paced
+			for (int k = 0; k < hit.stops; ++k)
+			{
+				stats.hit();
+			}
+			if (hit.what != Hit::NONE)
+			{
+				report(rules, hit);
 			}
+			continue;
+		}
+#ifndef TEST
+		// ...and act on what was found, one window at a time since they share the mouse
+		if (hit.what != Hit::NONE)
+		{
+			scheduler.hit(i);
+			act(rules, target, hit, engine, stats);
+			target.due = timer_now();
+			continue;
 		}
 #endif
 
-		// Give the computer some time to rest before processing the next frame
-		struct timespec sleep = millis_to_timespec(std::uniform_int_distribution<int>(40, 60)(engine));
-		clock_nanosleep(CLOCK_MONOTONIC, 0, &sleep, NULL);
+		target.due = t + scheduler.next(engine, i) * 1000000ll;
 	}
 
+	// The whole replay in numbers
+	std::cout << stats.report();
+
 	// Clean up and exit
-	Screen_Deinitialize();
-	Mouse_Deinitialize();
+	for (size_t i = 0; i < targets.size(); ++i)
+	{
+		targets[i].match.reset();
+		if (targets[i].pointer)
+		{
+			Mouse_Deinitialize(targets[i].pointer);
+		}
+		Screen_Deinitialize(targets[i].capture);
+	}
 
 	return EXIT_SUCCESS;
 }
@@ -28,8 +28,20 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
  * @brief The template matching component implementation.
  */
 
+// C++ Standard Library headers
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
 // C++ (C Standard Library) headers
 #include <cassert>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // Xlib headers
 #include <X11/Xlib.h>
@@ -41,13 +53,563 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 // Local C headers
 extern "C"
 {
+#include "audit.h"
+#include "convert.h"
 #include "screen.h"
+#include "ssd.h"
 }
 
 // Local C++ headers
 #include "match.hpp"
+#include "pool.hpp"
+
+/**
+ * @def MATCH_MAX_DAMAGE
+ * @brief The number of pending damaged areas that forces a full search.
+ */
+#define MATCH_MAX_DAMAGE 64
+
+/**
+ * @def MATCH_RESYNC
+ * @brief The number of incremental updates before a full search.
+ *
+ * The result statistics are updated by subtracting and adding partial
+ * sums, a full search once in a while keeps the rounding errors away.
+ */
+#define MATCH_RESYNC 256
+
+/**
+ * @def MATCH_PYRAMID_LEVELS
+ * @brief The maximum number of downsampled levels in PYRAMID mode.
+ */
+#define MATCH_PYRAMID_LEVELS 2
+
+/**
+ * @def MATCH_PYRAMID_MIN
+ * @brief The minimum template size (in pixels) at the coarsest level.
+ */
+#define MATCH_PYRAMID_MIN 8
+
+/**
+ * @def MATCH_PYRAMID_CANDIDATES
+ * @brief The number of coarse candidates refined at full resolution.
+ */
+#define MATCH_PYRAMID_CANDIDATES 5
+
+/**
+ * @def MATCH_PYRAMID_RADIUS
+ * @brief The search radius (in pixels) around a candidate when refining.
+ */
+#define MATCH_PYRAMID_RADIUS 2
+
+/**
+ * @def MATCH_TILE
+ * @brief The width and height (in result pixels) of a tile when using threads.
+ */
+#define MATCH_TILE 256
+
+/**
+ * @def MATCH_BAND
+ * @brief The number of result rows searched at once when streaming.
+ */
+#define MATCH_BAND 64
+
+/**
+ * @def MATCH_SSD_TOLERANCE
+ * @brief The largest difference between SSD and EXHAUSTIVE scores that TEST builds accept.
+ *
+ * The SSD sums are exact, the difference is the rounding of the float
+ * cross correlation inside cv::matchTemplate().
+ */
+#define MATCH_SSD_TOLERANCE 1e-4
+
+/**
+ * @def MATCH_SSDA_SAMPLE
+ * @brief Every MATCH_SSDA_SAMPLE:th position in both directions is compared in full.
+ *
+ * The statistics of the SSDA result come from these positions, the
+ * others are abandoned as soon as they can't win.
+ */
+#define MATCH_SSDA_SAMPLE 8
+
+/**
+ * @def MATCH_PYRAMID_SAMPLE
+ * @brief Every MATCH_PYRAMID_SAMPLE:th position in both directions gives the PYRAMID statistics.
+ *
+ * The positions are compared in full at full resolution, hence the hits
+ * are scored in sigma of the same result as EXHAUSTIVE ones, and the
+ * same MATCHING_THRESHOLD applies.
+ */
+#define MATCH_PYRAMID_SAMPLE 8
+
+/**
+ * @def MATCH_SSDA_CHECK
+ * @brief The number of template pixels compared between two checks of the bound.
+ */
+#define MATCH_SSDA_CHECK 16
+
+/**
+ * @def MATCH_KEY_MAX
+ * @brief The number of templates that can be keyed, one bit each in a cell.
+ */
+#define MATCH_KEY_MAX 8
+
+/**
+ * @def MATCH_KEY_SHARE
+ * @brief The smallest part of the template that a colour of its key covers.
+ */
+#define MATCH_KEY_SHARE 0.02
+
+/**
+ * @def MATCH_KEY_RARE
+ * @brief The largest part of the frame that a colour of a key may cover.
+ */
+#define MATCH_KEY_RARE 0.002
+
+/**
+ * @def MATCH_KEY_BLOBS
+ * @brief The number of candidate blobs that forces a full search.
+ */
+#define MATCH_KEY_BLOBS 16
+
+/**
+ * @def MATCH_KEY_PERIOD
+ * @brief The number of keyed searches before a full search.
+ *
+ * The keyed searches are scored against the statistics of the last full
+ * search, which have to be refreshed once in a while.
+ */
+#define MATCH_KEY_PERIOD 64
+
+/**
+ * @def MATCH_TRACKS
+ * @brief The number of recent hit locations remembered per template.
+ */
+#define MATCH_TRACKS 4
+
+/**
+ * @def MATCH_TRACK_RADIUS
+ * @brief The search radius (in pixels) around a recent hit.
+ */
+#define MATCH_TRACK_RADIUS 16
+
+/**
+ * @def MATCH_TRACK_PERIOD
+ * @brief The number of tracked searches before a full search refreshes the statistics.
+ */
+#define MATCH_TRACK_PERIOD 16
+
+/**
+ * @def MATCH_TRACK_FADE
+ * @brief The confidence of a recent hit is multiplied by this on every full search.
+ */
+#define MATCH_TRACK_FADE 0.8
+
+/**
+ * @def MATCH_TRACK_FORGET
+ * @brief Recent hits with a lower confidence are forgotten.
+ */
+#define MATCH_TRACK_FORGET 0.1
+
+/**
+ * @def MATCH_ZOOM_PERIOD
+ * @brief The number of searches of a template bank before all zoom levels are compared again.
+ */
+#define MATCH_ZOOM_PERIOD 32
+
+/**
+ * @brief The browser zoom levels a template bank covers, 1 is the template itself.
+ */
+static const double Match_Zooms[] = {0.67, 0.75, 0.8, 0.9, 1.0, 1.1, 1.25, 1.5};
+
+/**
+ * @brief Find the minimum and the sum of a row of results.
+ *
+ * The sum is accumulated in double precision, four floats at a time.
+ *
+ * @param [in] row The results.
+ * @param [in] n The number of results.
+ * @param [out] sum The sum of the results.
+ * @return The smallest result.
+ */
+static float
+scan(const float *row, int n, double *sum)
+{
+	float low = FLT_MAX;
+	double total = 0;
+	int x = 0;
+
+#ifdef __SSE2__
+	__m128 vlow = _mm_set1_ps(FLT_MAX);
+	__m128d vsum0 = _mm_setzero_pd(), vsum1 = _mm_setzero_pd();
+	for (; x + 4 <= n; x += 4)
+	{
+		__m128 v = _mm_loadu_ps(row + x);
+		vlow = _mm_min_ps(vlow, v);
+		vsum0 = _mm_add_pd(vsum0, _mm_cvtps_pd(v));
+		vsum1 = _mm_add_pd(vsum1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+	}
+
+	float lows[4];
+	double sums[2];
+	_mm_storeu_ps(lows, vlow);
+	_mm_storeu_pd(sums, _mm_add_pd(vsum0, vsum1));
+	low = std::min(std::min(lows[0], lows[1]), std::min(lows[2], lows[3]));
+	total = sums[0] + sums[1];
+#endif
+
+	for (; x < n; ++x)
+	{
+		low = std::min(low, row[x]);
+		total += row[x];
+	}
+
+	*sum = total;
+	return low;
+}
+
+/**
+ * @brief Find the next result of a row below a value.
+ *
+ * Compares four floats at a time, rows without any are skipped quickly.
+ *
+ * @param [in] row The results.
+ * @param [in] x Where to start.
+ * @param [in] n The number of results.
+ * @param [in] cutoff The value.
+ * @return The location of the next result below cutoff, n if there is none.
+ */
+static int
+below(const float *row, int x, int n, float cutoff)
+{
+#ifdef __SSE2__
+	const __m128 vcutoff = _mm_set1_ps(cutoff);
+	for (; x + 4 <= n; x += 4)
+	{
+		if (_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(row + x), vcutoff)))
+		{
+			break;
+		}
+	}
+#endif
+
+	for (; x < n; ++x)
+	{
+		if (row[x] < cutoff)
+		{
+			return x;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * @brief Sum the squared deviations of a row of results.
+ * @param [in] row The results.
+ * @param [in] n The number of results.
+ * @param [in] mean The mean of the results.
+ * @return The sum of squared deviations.
+ */
+static double
+deviation(const float *row, int n, double mean)
+{
+	double total = 0;
+	int x = 0;
+
+#ifdef __SSE2__
+	const __m128d vmean = _mm_set1_pd(mean);
+	__m128d vsum0 = _mm_setzero_pd(), vsum1 = _mm_setzero_pd();
+	for (; x + 4 <= n; x += 4)
+	{
+		__m128 v = _mm_loadu_ps(row + x);
+		__m128d d0 = _mm_sub_pd(_mm_cvtps_pd(v), vmean);
+		__m128d d1 = _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(v, v)), vmean);
+		vsum0 = _mm_add_pd(vsum0, _mm_mul_pd(d0, d0));
+		vsum1 = _mm_add_pd(vsum1, _mm_mul_pd(d1, d1));
+	}
+
+	double sums[2];
+	_mm_storeu_pd(sums, _mm_add_pd(vsum0, vsum1));
+	total = sums[0] + sums[1];
+#endif
+
+	for (; x < n; ++x)
+	{
+		const double d = row[x] - mean;
+		total += d * d;
+	}
+
+	return total;
+}
+
+/**
+ * @brief Normalize a sum of squared differences like CV_TM_SQDIFF_NORMED.
+ *
+ * Rounding can make the sum a bit larger than the norm, such results are
+ * clamped the same way OpenCV does it.
+ *
+ * @param [in] num The sum of squared differences.
+ * @param [in] window The sum of the squared frame pixels under the template.
+ * @param [in] norm The square root of the sum of the squared template pixels.
+ * @return The normalized result.
+ */
+static float
+normalize(double num, double window, double norm)
+{
+	const double t = std::sqrt(std::max(window, 0.0)) * norm;
+	if (std::abs(num) < t)
+	{
+		num /= t;
+	}
+	else if (std::abs(num) < t * 1.125)
+	{
+		num = num > 0 ? 1 : -1;
+	}
+	else
+	{
+		num = 1;
+	}
+
+	return static_cast<float>(num);
+}
+
+/**
+ * @brief The sum of the squared frame pixels under a template, from the integral image.
+ * @param [in] top The integral row above the template.
+ * @param [in] bottom The integral row below the template.
+ * @param [in] x The left edge of the template.
+ * @param [in] width The width of the template.
+ * @param [in] channels The number of channels.
+ * @return The sum.
+ */
+static double
+window(const double *top, const double *bottom, int x, int width, int channels)
+{
+	double total = 0;
+	for (int c = 0; c < channels; ++c)
+	{
+		const int left = x * channels + c;
+		const int right = (x + width) * channels + c;
+		total += bottom[right] - bottom[left] - top[right] + top[left];
+	}
+
+	return total;
+}
+
+/**
+ * @brief Merge overlapping rectangles into their bounding boxes.
+ * @param [in,out] rects The rectangles, afterwards none of them overlap.
+ */
+static void
+merge(std::vector<cv::Rect> &rects)
+{
+	for (size_t i = 0; i < rects.size(); ++i)
+	{
+		for (size_t j = i + 1; j < rects.size(); ++j)
+		{
+			if ((rects[i] & rects[j]).area() > 0)
+			{
+				rects[i] = rects[i] | rects[j];
+				rects.erase(rects.begin() + j);
+
+				// The grown rectangle may overlap one that was already checked
+				j = i;
+			}
+		}
+	}
+}
+
+/**
+ * @brief Search a template in an image with CV_TM_SQDIFF_NORMED.
+ *
+ * The result is made here, hence a buffer (or a part of one) of the right
+ * size is written into without allocating. The temporaries that
+ * cv::matchTemplate() makes itself aren't counted by the allocation audit.
+ *
+ * @param [in] image The image.
+ * @param [in] templ The template.
+ * @param [in,out] result The result.
+ */
+static void
+correlate(const cv::Mat &image, const cv::Mat &templ, cv::Mat &result)
+{
+	result.create(image.rows - templ.rows + 1, image.cols - templ.cols + 1, CV_32F);
+
+	Audit_Suspend();
+	cv::matchTemplate(image, templ, result, CV_TM_SQDIFF_NORMED);
+	Audit_Resume();
+}
+
+/**
+ * @brief Transform a real image, like cv::dft().
+ *
+ * The output is made here, the temporaries of cv::dft() itself aren't
+ * counted by the allocation audit.
+ *
+ * @param [in] src The image, CV_32F.
+ * @param [in,out] dst The spectrum (or the image of an inverse transform), CV_32F.
+ * @param [in] flags The cv::dft() flags.
+ * @param [in] rows The rows that aren't zero.
+ */
+static void
+fourier(const cv::Mat &src, cv::Mat &dst, int flags, int rows)
+{
+	dst.create(src.rows, src.cols, CV_32F);
+
+	Audit_Suspend();
+	cv::dft(src, dst, flags, rows);
+	Audit_Resume();
+}
+
+/**
+ * @brief Downsample an image to half its size, like cv::pyrDown().
+ * @param [in] src The image.
+ * @param [in,out] dst The downsampled image, made here.
+ */
+static void
+halve(const cv::Mat &src, cv::Mat &dst)
+{
+	dst.create((src.rows + 1) / 2, (src.cols + 1) / 2, src.type());
+
+	Audit_Suspend();
+	cv::pyrDown(src, dst);
+	Audit_Resume();
+}
+
+/**
+ * @brief A result sized part of a buffer that only ever grows.
+ *
+ * For the results whose size changes from search to search, the buffer
+ * stops allocating once it's as large as the largest of them.
+ *
+ * @param [in,out] buffer The buffer, CV_32F.
+ * @param [in] rows The rows of the result.
+ * @param [in] cols The columns of the result.
+ * @return The top left part of the buffer.
+ */
+static cv::Mat
+grow(cv::Mat &buffer, int rows, int cols)
+{
+	if (buffer.rows < rows || buffer.cols < cols)
+	{
+		buffer.create(std::max(buffer.rows, rows), std::max(buffer.cols, cols), CV_32F);
+	}
+
+	return buffer(cv::Rect(0, 0, cols, rows));
+}
+
+Match::Summary::Summary(void) : n(0), mean(0), m2(0), score(FLT_MAX)
+{
+}
+
+/**
+ * @brief Combine with the summary of another part of the result.
+ *
+ * Uses the pairwise update of Chan et al. for the statistics. Ties for the
+ * best result go to the first location in row-major order, like cv::minMaxLoc().
+ *
+ * @param [in] other The summary of the other part.
+ */
+void
+Match::Summary::add(const Summary &other)
+{
+	if (other.score < score || (other.score == score && (other.position.y < position.y
+		|| (other.position.y == position.y && other.position.x < position.x))))
+	{
+		score = other.score;
+		position = other.position;
+	}
+
+	if (other.n == 0)
+	{
+		return;
+	}
+
+	const double total = n + other.n;
+	const double delta = other.mean - mean;
+	mean += delta * other.n / total;
+	m2 += other.m2 + delta * delta * n * other.n / total;
+	n = total;
+}
+
+/**
+ * @brief Take out the statistics of a part of the result.
+ *
+ * The reverse of add(), but the best result is left alone.
+ *
+ * @param [in] other The summary of the part.
+ */
+void
+Match::Summary::remove(const Summary &other)
+{
+	const double rest = n - other.n;
+	if (rest <= 0)
+	{
+		n = mean = m2 = 0;
+		return;
+	}
+
+	const double reduced = (n * mean - other.n * other.mean) / rest;
+	const double delta = other.mean - reduced;
+	m2 = std::max(m2 - other.m2 - delta * delta * rest * other.n / n, 0.0);
+	mean = reduced;
+	n = rest;
+}
+
+/**
+ * @brief The distance from the best result to the mean, in standard deviations.
+ * @return The score in sigma.
+ */
+double
+Match::Summary::sigma(void) const
+{
+	return std::abs(mean - score) / std::sqrt(m2 / n);
+}
+
+/**
+ * @brief Score a result in a single pass over memory.
+ *
+ * Every row is scanned for its minimum and sum, then for the squared
+ * deviations while it's still in the cache, and the row summaries are
+ * combined. Replaces cv::minMaxLoc() followed by cv::meanStdDev().
+ *
+ * @param [in] res The result, CV_32F.
+ * @param [in] offset The location of the result's first element.
+ * @return The summary.
+ */
+Match::Summary
+Match::summarize(const cv::Mat &res, const cv::Point &offset)
+{
+	assert(res.type() == CV_32F);
 
-Match::Match(XImage *img)
+	Summary total;
+	for (int y = 0; y < res.rows; ++y)
+	{
+		const float *row = res.ptr<float>(y);
+
+		double sum;
+		const float low = scan(row, res.cols, &sum);
+
+		Summary line;
+		line.n = res.cols;
+		line.mean = sum / res.cols;
+		line.m2 = deviation(row, res.cols, line.mean);
+
+		// Only look for the location if it's the best so far
+		if (low < total.score)
+		{
+			line.score = low;
+			line.position = cv::Point(std::find(row, row + res.cols, low) - row + offset.x, y + offset.y);
+		}
+
+		total.add(line);
+	}
+
+	return total;
+}
+
+Match::Match(XImage *img) : mode(EXHAUSTIVE), streaming(false), tracking(false), shrunk(0), transformed(false), integrated(false), positions(0), rejections(0), keys(0), fresh(false)
 {
 	assert(img);
 	this->img = img;
@@ -58,6 +620,10 @@ Match::Match(XImage *img)
 	mat = cv::Mat::zeros(this->img->height, this->img->width, CV_8UC3);
 #endif
 
+	Convert_Initialize();
+	std::cout << "Convert: " << Convert_Kernel() << std::endl;
+	Ssd_Initialize();
+
 #ifdef TEST
 	cv::namedWindow("debug", CV_WINDOW_AUTOSIZE);
 #endif
@@ -68,66 +634,1805 @@ Match::~Match(void)
 }
 
 void
-Match::prepare(void)
+Match::convert(const cv::Rect &area)
 {
-	// Convert screenshot to a opencv matrix
-	for (int y = 0; y < img->height; ++y)
+	// The colour key is looked up in the same pass, the cells of the area are cleared already
+	if (keys > 0)
 	{
-		for (int x = 0; x < img->width; ++x)
-		{
-			unsigned long pixel = XGetPixel(img, x, y);
-
 #ifndef COLOR
-			unsigned char grey = ((pixel & 0xff) + ((pixel >> 8) & 0xff) + ((pixel >> 16) & 0xff)) / 3;
-			mat.at<unsigned char>(y, x) = grey;
+		Convert_GreyKeyed(img, area.x, area.y, area.width, area.height, mat.data, mat.step, lut.data(), cells.data, cells.step);
 #else
-			mat.at<unsigned char>(y, x*mat.channels()) = pixel & 0xff;
-			mat.at<unsigned char>(y, x*mat.channels()+1) = (pixel >> 8) & 0xff;
-			mat.at<unsigned char>(y, x*mat.channels()+2) = (pixel >> 16) & 0xff;
+		Convert_BGRKeyed(img, area.x, area.y, area.width, area.height, mat.data, mat.step, lut.data(), cells.data, cells.step);
 #endif
-		}
+		return;
 	}
+
+#ifndef COLOR
+	Convert_Grey(img, area.x, area.y, area.width, area.height, mat.data, mat.step);
+#else
+	Convert_BGR(img, area.x, area.y, area.width, area.height, mat.data, mat.step);
+#endif
 }
 
-cv::Mat
-Match::loadTemplate(const char *filename)
+void
+Match::prepare(void)
 {
+	if (keys > 0)
+	{
+		cells = cv::Scalar(0);
+	}
+
+	// Convert screenshot to a opencv matrix, in bands of rows when using threads (whole rows of cells)
+	if (pool)
+	{
+		if (bands.empty())
+		{
+			for (int y = 0; y < img->height; y += MATCH_TILE)
+			{
+				const cv::Rect band(0, y, img->width, std::min(MATCH_TILE, img->height - y));
+				bands.push_back([this, band]() { convert(band); });
+			}
+		}
+		pool->run(bands);
+	}
+	else
+	{
+		convert(cv::Rect(0, 0, img->width, img->height));
+	}
+
+	shrunk = 0;
+	transformed = false;
+	integrated = false;
+	fresh = keys > 0;
+	for (std::map<const unsigned char *, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		it->second.stale = true;
+		it->second.dirty.clear();
+	}
+
+#ifdef TEST // Verify the fast conversion against the XGetPixel() one
+	cv::Mat reference = cv::Mat::zeros(mat.rows, mat.cols, mat.type());
 #ifndef COLOR
-	return cv::imread(filename, 0);
+	Convert_GreyReference(img, 0, 0, img->width, img->height, reference.data, reference.step);
 #else
-	return cv::imread(filename);
+	Convert_BGRReference(img, 0, 0, img->width, img->height, reference.data, reference.step);
+#endif
+	assert(std::equal(mat.datastart, mat.dataend, reference.datastart));
+
+	if (keys > 0)
+	{
+		cv::Mat keyed = cv::Mat::zeros(cells.rows, cells.cols, CV_8U);
+		for (int y = 0; y < img->height; ++y)
+		{
+			for (int x = 0; x < img->width; ++x)
+			{
+				unsigned long pixel = XGetPixel(img, x, y);
+				keyed.at<unsigned char>(y >> CONVERT_CELL_SHIFT, x >> CONVERT_CELL_SHIFT) |= lut[CONVERT_KEY(pixel & 0xff, (pixel >> 8) & 0xff, (pixel >> 16) & 0xff)];
+			}
+		}
+		assert(std::equal(cells.datastart, cells.dataend, keyed.datastart));
+	}
 #endif
 }
 
-std::tuple<cv::Point, double>
-Match::match(cv::Mat templ)
+void
+Match::prepare(const XRectangle *rects, int count)
 {
-	// Do 'quick' template matching, http://en.wikipedia.org/wiki/Template_matching
-	cv::Mat mres;
-	cv::matchTemplate(mat, templ, mres, CV_TM_SQDIFF_NORMED);
+	assert(rects || count == 0);
+
+	// The key has changed, the cells of the whole frame are redone
+	if (keys > 0 && !fresh)
+	{
+		prepare();
+		return;
+	}
+
+	if (count > 0)
+	{
+		shrunk = 0;
+		transformed = false;
+		integrated = false;
+	}
+
+	// The key is redone for whole cells, clear all of them before any is keyed again
+	damage.clear();
+	for (int i = 0; i < count; ++i)
+	{
+		cv::Rect area(rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+		if (keys > 0)
+		{
+			const int mask = (1 << CONVERT_CELL_SHIFT) - 1;
+			const int right = std::min(img->width, (area.x + area.width + mask) & ~mask);
+			const int bottom = std::min(img->height, (area.y + area.height + mask) & ~mask);
+			area = cv::Rect(area.x & ~mask, area.y & ~mask, right - (area.x & ~mask), bottom - (area.y & ~mask));
+			cells(cv::Rect(area.x >> CONVERT_CELL_SHIFT, area.y >> CONVERT_CELL_SHIFT, (area.width + mask) >> CONVERT_CELL_SHIFT, (area.height + mask) >> CONVERT_CELL_SHIFT)) = cv::Scalar(0);
+		}
+		damage.push_back(area);
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		// Convert the damaged parts of the screenshot
+		convert(damage[i]);
+
+		// Every template has to search the damaged area the next time it's used
+		for (std::map<const unsigned char *, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+		{
+			Entry &entry = it->second;
+			if (entry.stale)
+			{
+				continue;
+			}
+
+			entry.dirty.push_back(cv::Rect(rects[i].x, rects[i].y, rects[i].width, rects[i].height));
+			if (entry.dirty.size() > MATCH_MAX_DAMAGE)
+			{
+				entry.stale = true;
+				entry.dirty.clear();
+			}
+		}
+	}
+}
+
+void
+Match::setImage(XImage *img)
+{
+	assert(img);
+
+	// A buffer of the same size, like the other one of a double buffered grab, is read the same way
+	const bool same = img->width == this->img->width && img->height == this->img->height && img->bytes_per_line == this->img->bytes_per_line;
+	this->img = img;
+	if (same)
+	{
+		return;
+	}
+
+#ifndef COLOR
+	mat = cv::Mat::zeros(img->height, img->width, CV_8U);
+#else
+	mat = cv::Mat::zeros(img->height, img->width, CV_8UC3);
+#endif
+
+	if (keys > 0)
+	{
+		cells = cv::Mat::zeros((img->height + (1 << CONVERT_CELL_SHIFT) - 1) >> CONVERT_CELL_SHIFT, (img->width + (1 << CONVERT_CELL_SHIFT) - 1) >> CONVERT_CELL_SHIFT, CV_8U);
+		fresh = false;
+	}
+	bands.clear();
+	levels.clear();
+	spectrum.clear();
+	shrunk = 0;
+	transformed = false;
+	integrated = false;
+
+	// The results of the old size are gone, all at once
+	for (std::map<const unsigned char *, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		Entry &entry = it->second;
+		entry.stale = true;
+		entry.dirty.clear();
+		entry.tracks.clear();
+		entry.baseline = Summary();
+		entry.areas.clear();
+		entry.mres.release();
+		entry.shared.release();
+		entry.glance.release();
+
+		// The zoom may have changed with the size
+		entry.unlocked = MATCH_ZOOM_PERIOD - 1;
+	}
+	sums.clear();
+	tiles.clear();
+	arena.clear();
+
+	// A template larger than the window isn't searched until the window is large enough again
+	int unsearchable = 0;
+	for (std::map<const unsigned char *, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		transform(it->second);
+		reserve(it->second);
+		unsearchable += !fits(it->second);
+	}
+	if (unsearchable > 0)
+	{
+		std::cerr << "Match: " << unsearchable << " template(s) larger than the " << img->width << "x" << img->height << " window, not searched" << std::endl;
+	}
+}
+
+void
+Match::matchPeaks(cv::Mat templ, std::vector<std::tuple<cv::Point, double> > &peaks, double threshold)
+{
+	const std::tuple<cv::Point, double> best = match(templ);
+	const Entry &entry = current(entries[templ.data]);
+
+	peaks.clear();
+	if (std::get<1>(best) <= threshold)
+	{
+		return;
+	}
+	peaks.push_back(best);
+	if (!entry.whole)
+	{
+		return;
+	}
+
+	// Every result that scores above the threshold is below the cutoff, most rows have none
+	const double deviation = std::sqrt(entry.summary.m2 / entry.summary.n);
+	const float cutoff = entry.summary.mean - threshold * deviation;
+	candidates.clear();
+	for (int y = 0; y < entry.mres.rows; ++y)
+	{
+		const float *row = entry.mres.ptr<float>(y);
+		for (int x = below(row, 0, entry.mres.cols, cutoff); x < entry.mres.cols; x = below(row, x + 1, entry.mres.cols, cutoff))
+		{
+			candidates.push_back(std::make_pair(row[x], cv::Point(x, y)));
+		}
+	}
+
+	// Best first, ties in row-major order like match()
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<float, cv::Point> &a, const std::pair<float, cv::Point> &b)
+	{
+		return a.first < b.first || (a.first == b.first && (a.second.y < b.second.y || (a.second.y == b.second.y && a.second.x < b.second.x)));
+	});
+
+	// Greedy suppression, a candidate overlapping a better hit is a part of it
+	for (size_t i = 0; i < candidates.size() && peaks.size() < MATCH_PEAKS; ++i)
+	{
+		const cv::Point &position = candidates[i].second;
+		bool suppressed = false;
+		for (size_t j = 0; j < peaks.size() && !suppressed; ++j)
+		{
+			const cv::Point &peak = std::get<0>(peaks[j]);
+			suppressed = std::abs(position.x - peak.x) < entry.templ.cols && std::abs(position.y - peak.y) < entry.templ.rows;
+		}
+
+		if (!suppressed)
+		{
+			peaks.push_back(std::tuple<cv::Point, double>(position, std::abs(entry.summary.mean - candidates[i].first) / deviation));
+		}
+	}
+}
+
+std::vector<std::tuple<cv::Point, double> >
+Match::matchAll(void)
+{
+	std::vector<std::tuple<cv::Point, double> > results;
+	for (size_t i = 0; i < registered.size(); ++i)
+	{
+		results.push_back(match(entries[registered[i]].templ));
+	}
+
+	return results;
+}
+
+void
+Match::registerTemplate(const cv::Mat &templ, const std::vector<cv::Mat> &pyramid)
+{
+	assert(templ.type() == mat.type());
+
+	if (entries.find(templ.data) != entries.end())
+	{
+		return;
+	}
+
+	registered.push_back(templ.data);
+	reserve(enter(templ, pyramid));
+}
+
+void
+Match::registerBank(const cv::Mat &templ, const std::vector<cv::Mat> &bank, const std::vector<cv::Mat> &pyramid)
+{
+	assert(templ.type() == mat.type());
+
+	// Registered here, the result buffer of the template itself is the shared one
+	if (entries.find(templ.data) == entries.end())
+	{
+		registered.push_back(templ.data);
+		enter(templ, pyramid);
+	}
+	Entry &entry = entries[templ.data];
+	if (!entry.scales.empty())
+	{
+		return;
+	}
+
+	// Every zoom level that fits the frame, the pyramids are needed to compare them
+	if (entry.pyramid.empty())
+	{
+		entry.pyramid = downsample(templ);
+	}
+	for (size_t i = 0; i < bank.size(); ++i)
+	{
+		if (bank[i].data == templ.data)
+		{
+			entry.locked = entry.scales.size();
+			entry.scales.push_back(templ.data);
+		}
+		else if (bank[i].cols <= mat.cols && bank[i].rows <= mat.rows && entries.find(bank[i].data) == entries.end())
+		{
+			assert(bank[i].type() == templ.type());
+			entry.scales.push_back(bank[i].data);
+			enter(bank[i], downsample(bank[i]));
+		}
+	}
+	if (entry.scales.empty() || entry.scales[entry.locked] != templ.data)
+	{
+		entry.locked = entry.scales.size();
+		entry.scales.push_back(templ.data);
+	}
+
+	// All zoom levels share one result buffer, the first search compares them
+	entry.unlocked = MATCH_ZOOM_PERIOD - 1;
+	entry.level = MATCH_PYRAMID_LEVELS;
+	for (size_t i = 0; i < entry.scales.size(); ++i)
+	{
+		Entry &scale = entries[entry.scales[i]];
+		scale.bank = &entry;
+		scale.mres.release();
+		entry.level = std::min(entry.level, static_cast<int>(scale.pyramid.size()) - 1);
+	}
+	for (size_t i = 0; i < entry.scales.size(); ++i)
+	{
+		reserve(entries[entry.scales[i]]);
+	}
+}
+
+/**
+ * @brief Make the state of a template.
+ *
+ * Everything that doesn't depend on the mode, the buffers are made by
+ * reserve() once it's known whether the template belongs to a bank.
+ *
+ * @param [in] templ The template image.
+ * @param [in] pyramid The downsampled versions of the template, may be empty.
+ * @return The template state.
+ */
+Match::Entry &
+Match::enter(const cv::Mat &templ, const std::vector<cv::Mat> &pyramid)
+{
+	Entry &entry = entries[templ.data];
+	entry.templ = templ;
+	entry.pyramid = pyramid;
+
+	transform(entry);
+	entry.energy = templ.dot(templ);
+
+	// The damaged areas and the recent hits are never more than this
+	entry.dirty.reserve(MATCH_MAX_DAMAGE + 1);
+	entry.held.reserve(MATCH_MAX_DAMAGE + 1);
+	entry.tracks.reserve(MATCH_TRACKS + 1);
+
+	return entry;
+}
+
+/**
+ * @brief Transform a template for the FFT mode.
+ *
+ * The template is zero padded to the frame's DFT size, its spectrum is
+ * kept handy for every frame of that size.
+ *
+ * @param [in,out] entry The template state.
+ */
+void
+Match::transform(Entry &entry)
+{
+	entry.spectrum.clear();
+	if (!fits(entry))
+	{
+		return;
+	}
+
+	const cv::Size size(cv::getOptimalDFTSize(mat.cols), cv::getOptimalDFTSize(mat.rows));
+	std::vector<cv::Mat> planes;
+	cv::split(entry.templ, planes);
+
+	for (size_t c = 0; c < planes.size(); ++c)
+	{
+		cv::Mat padded = cv::Mat::zeros(size, CV_32F);
+		cv::Mat roi = padded(cv::Rect(0, 0, entry.templ.cols, entry.templ.rows));
+		planes[c].convertTo(roi, CV_32F);
+
+		cv::Mat plane;
+		fourier(padded, plane, 0, entry.templ.rows);
+		entry.spectrum.push_back(plane);
+	}
+}
+
+/**
+ * @brief Make the buffers the current mode needs for a template.
+ *
+ * The tile grid is made once, the whole result comes from the arena for
+ * the modes that keep it. A later search of the same size writes into
+ * these, instead of allocating its own.
+ *
+ * @param [in,out] entry The template state.
+ */
+void
+Match::reserve(Entry &entry)
+{
+	// Nothing to search, the buffers are made when the window is large enough again
+	if (!fits(entry))
+	{
+		entry.areas.clear();
+		entry.tasks.clear();
+		entry.mres.release();
+		entry.glance.release();
+		return;
+	}
+
+	const int rows = mat.rows - entry.templ.rows + 1;
+	const int cols = mat.cols - entry.templ.cols + 1;
+
+	if (entry.areas.empty())
+	{
+		for (int y = 0; y < rows; y += MATCH_TILE)
+		{
+			for (int x = 0; x < cols; x += MATCH_TILE)
+			{
+				entry.areas.push_back(cv::Rect(x, y, std::min(MATCH_TILE, cols - x), std::min(MATCH_TILE, rows - y)));
+			}
+		}
+		entry.summaries.resize(entry.areas.size());
+		entry.counts.resize(entry.areas.size());
+	}
+
+	// The tasks belong to the mode
+	entry.tasks.clear();
+
+	// The SSD sums of a tile are integers, every template searches the same grid one after the other
+	while (mode == SSD && sums.size() < entry.areas.size())
+	{
+		sums.push_back(arena.mat(MATCH_TILE, MATCH_TILE, CV_32S));
+	}
+
+	// The streamed tiles are scored and thrown away, but not freed
+	while (mode == EXHAUSTIVE && streaming && pool && tiles.size() < entry.areas.size())
+	{
+		tiles.push_back(arena.mat(MATCH_TILE, MATCH_TILE, CV_32F));
+	}
+
+	const bool whole = (mode == EXHAUSTIVE && !streaming) || mode == FFT || mode == SSD;
+	if (!entry.bank)
+	{
+		if (whole && (entry.mres.rows != rows || entry.mres.cols != cols || entry.mres.type() != CV_32F))
+		{
+			entry.mres = arena.mat(rows, cols, CV_32F);
+		}
+		return;
+	}
+
+	// Only one zoom level of a bank has a result at a time, it's a part of a buffer of the frame size
+	Entry &bank = *entry.bank;
+	if (whole && bank.shared.empty())
+	{
+		bank.shared = arena.mat(mat.rows, mat.cols, CV_32F);
+	}
+	if (whole && (entry.mres.rows != rows || entry.mres.cols != cols || entry.mres.data != bank.shared.data))
+	{
+		entry.mres = bank.shared(cv::Rect(0, 0, cols, rows));
+	}
+
+	// The zoom levels are compared at the coarsest level they all have
+	int coarse_rows = mat.rows, coarse_cols = mat.cols;
+	for (int l = 0; l < bank.level; ++l)
+	{
+		coarse_rows = (coarse_rows + 1) / 2;
+		coarse_cols = (coarse_cols + 1) / 2;
+	}
+	coarse_rows -= entry.pyramid[bank.level].rows - 1;
+	coarse_cols -= entry.pyramid[bank.level].cols - 1;
+	if (entry.glance.rows != coarse_rows || entry.glance.cols != coarse_cols)
+	{
+		entry.glance = arena.mat(coarse_rows, coarse_cols, CV_32F);
+	}
+}
+
+/**
+ * @brief Run the tasks of a search, on the pool if there is one.
+ * @param [in] tasks The tasks.
+ */
+void
+Match::run(std::vector<std::function<void(void)> > &tasks)
+{
+	if (pool)
+	{
+		pool->run(tasks);
+	}
+	else
+	{
+		for (size_t i = 0; i < tasks.size(); ++i)
+		{
+			tasks[i]();
+		}
+	}
+}
+
+void
+Match::setMode(Mode mode)
+{
+	this->mode = mode;
+	if (mode == SSD)
+	{
+		std::cout << "SSD: " << Ssd_Kernel() << std::endl;
+	}
+
+	// The cached results belong to the old mode
+	for (std::map<const unsigned char *, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		it->second.stale = true;
+		it->second.dirty.clear();
+		reserve(it->second);
+	}
+}
+
+void
+Match::setStreaming(bool streaming)
+{
+	this->streaming = streaming;
+
+	for (std::map<const unsigned char *, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		it->second.stale = true;
+		it->second.dirty.clear();
+		if (streaming)
+		{
+			it->second.mres.release();
+		}
+		reserve(it->second);
+	}
+}
+
+void
+Match::setTracking(bool tracking)
+{
+	this->tracking = tracking;
+
+	for (std::map<const unsigned char *, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		it->second.tracks.clear();
+		it->second.since = 0;
+	}
+}
+
+long long
+Match::rejected(long long *positions) const
+{
+	if (positions)
+	{
+		*positions = this->positions;
+	}
+
+	return rejections;
+}
+
+void
+Match::setKey(const cv::Mat &templ, const cv::Mat &colour)
+{
+	assert(colour.type() == CV_8UC3 && colour.size() == templ.size());
+
+	if (entries.find(templ.data) == entries.end())
+	{
+		registerTemplate(templ);
+	}
+	Entry &entry = entries[templ.data];
+	if (entry.key >= 0)
+	{
+		return;
+	}
+
+	if (keys == MATCH_KEY_MAX)
+	{
+		std::cerr << "Match: No more than " << MATCH_KEY_MAX << " templates can be keyed" << std::endl;
+		return;
+	}
+
+	if (keys == 0)
+	{
+		lut.assign(CONVERT_KEY_SIZE, 0);
+		cells = cv::Mat::zeros((img->height + (1 << CONVERT_CELL_SHIFT) - 1) >> CONVERT_CELL_SHIFT, (img->width + (1 << CONVERT_CELL_SHIFT) - 1) >> CONVERT_CELL_SHIFT, CV_8U);
+	}
+
+	// The key is picked from the first frame that the template is searched in
+	entry.key = keys++;
+	entry.colour = colour;
+	entry.calibrated = false;
+	fresh = false;
+}
+
+void
+Match::setThreads(int threads)
+{
+	setPool(std::make_shared<Pool>(threads));
+	std::cout << "Match: " << pool->size() << " thread(s)" << std::endl;
+}
+
+void
+Match::setPool(const std::shared_ptr<Pool> &pool)
+{
+	assert(pool);
+	this->pool = pool;
+
+	for (std::map<const unsigned char *, Entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		it->second.stale = true;
+		it->second.dirty.clear();
+		reserve(it->second);
+	}
+}
+
+cv::Mat
+Match::loadTemplate(const char *filename, std::vector<cv::Mat> *bank)
+{
+#ifndef COLOR
+	cv::Mat templ = cv::imread(filename, 0);
+#else
+	cv::Mat templ = cv::imread(filename);
+#endif
+
+	if (bank && !templ.empty())
+	{
+		*bank = zoom(templ);
+	}
+
+	return templ;
+}
+
+std::vector<cv::Mat>
+Match::zoom(const cv::Mat &templ)
+{
+	std::vector<cv::Mat> bank;
+	for (size_t i = 0; i < sizeof (Match_Zooms) / sizeof (Match_Zooms[0]); ++i)
+	{
+		// The template itself isn't resampled, shrinking averages the pixels like a browser does
+		if (Match_Zooms[i] == 1)
+		{
+			bank.push_back(templ);
+			continue;
+		}
+
+		const cv::Size size(cvRound(templ.cols * Match_Zooms[i]), cvRound(templ.rows * Match_Zooms[i]));
+		if (size.width < MATCH_PYRAMID_MIN || size.height < MATCH_PYRAMID_MIN)
+		{
+			continue;
+		}
+
+		cv::Mat scaled;
+		cv::resize(templ, scaled, size, 0, 0, Match_Zooms[i] < 1 ? cv::INTER_AREA : cv::INTER_LINEAR);
+		bank.push_back(scaled);
+	}
+
+	return bank;
+}
+
+std::vector<cv::Mat>
+Match::downsample(const cv::Mat &templ)
+{
+	std::vector<cv::Mat> pyramid(1, templ);
+	while (pyramid.size() <= MATCH_PYRAMID_LEVELS && std::min(pyramid.back().cols, pyramid.back().rows) >= 2 * MATCH_PYRAMID_MIN)
+	{
+		cv::Mat level;
+		cv::pyrDown(pyramid.back(), level);
+		pyramid.push_back(level);
+	}
+
+	return pyramid;
+}
+
+void
+Match::update(Entry &entry, const cv::Mat &templ)
+{
+	// Every result position where the template overlaps a damaged area
+	regions.clear();
+	for (size_t i = 0; i < entry.dirty.size(); ++i)
+	{
+		const cv::Rect &r = entry.dirty[i];
+		cv::Rect region(r.x - templ.cols + 1, r.y - templ.rows + 1, r.width + templ.cols - 1, r.height + templ.rows - 1);
+		region &= cv::Rect(0, 0, entry.mres.cols, entry.mres.rows);
+		if (region.area() > 0)
+		{
+			regions.push_back(region);
+		}
+	}
+	entry.dirty.clear();
+	merge(regions);
+
+	bool lost = false;
+	for (size_t i = 0; i < regions.size(); ++i)
+	{
+		const cv::Rect &region = regions[i];
+		cv::Mat res = entry.mres(region);
+
+		// Replace the old result of this region, in place
+		entry.summary.remove(summarize(res, region.tl()));
+		correlate(mat(cv::Rect(region.x, region.y, region.width + templ.cols - 1, region.height + templ.rows - 1)), templ, res);
+
+		lost = lost || region.contains(entry.summary.position);
+		entry.summary.add(summarize(res, region.tl()));
+	}
+
+	// The best location was overwritten, it might have gotten worse
+	if (lost)
+	{
+		entry.summary = summarize(entry.mres, cv::Point(0, 0));
+	}
+
+	++entry.updates;
+}
+
+/**
+ * @brief Search the windows around the recent hits.
+ *
+ * The best result is scored against the statistics of the last full
+ * search, the windows are too small for their own statistics to mean
+ * anything. The damage of a tracked frame is held back, so the next
+ * full search only updates the result where the frame has changed.
+ *
+ * @param [in,out] entry The template state.
+ * @param [in] templ The template.
+ * @return If the template was found, then the entry holds the result.
+ */
+bool
+Match::track(Entry &entry, const cv::Mat &templ)
+{
+	if (entry.tracks.empty() || entry.since >= MATCH_TRACK_PERIOD || entry.baseline.n == 0)
+	{
+		return false;
+	}
+
+	const cv::Rect bounds(0, 0, mat.cols - templ.cols + 1, mat.rows - templ.rows + 1);
+	Summary best;
+	size_t which = 0;
+	for (size_t i = 0; i < entry.tracks.size(); ++i)
+	{
+		const cv::Point &at = entry.tracks[i].position;
+		const cv::Rect window = cv::Rect(at.x - MATCH_TRACK_RADIUS, at.y - MATCH_TRACK_RADIUS, 2 * MATCH_TRACK_RADIUS + 1, 2 * MATCH_TRACK_RADIUS + 1) & bounds;
+		if (window.area() == 0)
+		{
+			continue;
+		}
+
+		cv::Mat res = grow(part, window.height, window.width);
+		correlate(mat(cv::Rect(window.x, window.y, window.width + templ.cols - 1, window.height + templ.rows - 1)), templ, res);
+		const Summary local = summarize(res, window.tl());
+		if (local.score < best.score)
+		{
+			best = local;
+			which = i;
+		}
+	}
+
+	Summary result = entry.baseline;
+	result.score = best.score;
+	result.position = best.position;
+	if (best.n == 0 || result.sigma() <= MATCHING_THRESHOLD)
+	{
+		return false;
+	}
+
+	entry.summary = result;
+	entry.tracks[which].position = result.position;
+	entry.tracks[which].confidence += 1;
+	++entry.since;
+
+	// The result is left as it was, what changed meanwhile is redone by the next full search
+	if (entry.held.size() + entry.dirty.size() > MATCH_MAX_DAMAGE)
+	{
+		entry.stale = true;
+		entry.held.clear();
+	}
+	else
+	{
+		entry.held.insert(entry.held.end(), entry.dirty.begin(), entry.dirty.end());
+	}
+	entry.dirty.clear();
+
+	return true;
+}
+
+/**
+ * @brief Remember the statistics and the hit of a full search.
+ * @param [in,out] entry The template state, after a full search.
+ */
+void
+Match::learn(Entry &entry)
+{
+	entry.baseline = entry.summary;
+	entry.since = 0;
+
+	for (size_t i = 0; i < entry.tracks.size(); ++i)
+	{
+		entry.tracks[i].confidence *= MATCH_TRACK_FADE;
+	}
+
+	if (entry.summary.sigma() > MATCHING_THRESHOLD)
+	{
+		// A hit close to a known place moves it, otherwise it's a new place
+		const cv::Point &at = entry.summary.position;
+		size_t i = 0;
+		while (i < entry.tracks.size() && (std::abs(entry.tracks[i].position.x - at.x) > MATCH_TRACK_RADIUS || std::abs(entry.tracks[i].position.y - at.y) > MATCH_TRACK_RADIUS))
+		{
+			++i;
+		}
+
+		if (i == entry.tracks.size())
+		{
+			Track track;
+			track.confidence = 0;
+			entry.tracks.push_back(track);
+		}
+		entry.tracks[i].position = at;
+		entry.tracks[i].confidence += 1;
+	}
+
+	// Keep the most confident places in place, those are searched first (insertion sort, stable and without a buffer)
+	size_t kept = 0;
+	for (size_t i = 0; i < entry.tracks.size(); ++i)
+	{
+		if (entry.tracks[i].confidence < MATCH_TRACK_FORGET)
+		{
+			continue;
+		}
+
+		const Track track = entry.tracks[i];
+		size_t j = kept++;
+		for (; j > 0 && entry.tracks[j - 1].confidence < track.confidence; --j)
+		{
+			entry.tracks[j] = entry.tracks[j - 1];
+		}
+		entry.tracks[j] = track;
+	}
+	entry.tracks.resize(std::min<size_t>(kept, MATCH_TRACKS));
+}
+
+void
+Match::tiled(Entry &entry, const cv::Mat &templ)
+{
+	const int rows = mat.rows - templ.rows + 1;
+	const int cols = mat.cols - templ.cols + 1;
+	if (streaming)
+	{
+		entry.mres.release();
+	}
+	else
+	{
+		entry.mres.create(rows, cols, CV_32F);
+	}
+
+	// The grid doesn't depend on the number of threads, the tasks are made once
+	if (entry.tasks.empty())
+	{
+		for (size_t i = 0; i < entry.areas.size(); ++i)
+		{
+			Entry *owner = &entry;
+			entry.tasks.push_back([this, owner, i]()
+			{
+				// The frame tile overlaps the next one by the template size minus one
+				const cv::Rect &area = owner->areas[i];
+				const cv::Mat &templ = owner->templ;
+				cv::Mat res = streaming ? tiles[i](cv::Rect(0, 0, area.width, area.height)) : owner->mres(area);
+				correlate(mat(cv::Rect(area.x, area.y, area.width + templ.cols - 1, area.height + templ.rows - 1)), templ, res);
+
+				owner->summaries[i] = summarize(res, area.tl());
+			});
+		}
+	}
+	run(entry.tasks);
+
+	// Reduce in grid order, hence the same result for any number of threads
+	entry.summary = Summary();
+	for (size_t i = 0; i < entry.summaries.size(); ++i)
+	{
+		entry.summary.add(entry.summaries[i]);
+	}
+}
+
+void
+Match::stream(Entry &entry, const cv::Mat &templ)
+{
+	const int rows = mat.rows - templ.rows + 1;
+	const int cols = mat.cols - templ.cols + 1;
+
+	// Score every band while it's still in the cache, then reuse the memory
+	entry.summary = Summary();
+	for (int y = 0; y < rows; y += MATCH_BAND)
+	{
+		const int height = std::min(MATCH_BAND, rows - y);
+		cv::Mat band = grow(part, height, cols);
+		correlate(mat(cv::Rect(0, y, mat.cols, height + templ.rows - 1)), templ, band);
+		entry.summary.add(summarize(band, cv::Point(0, y)));
+	}
+}
+
+void
+Match::pyramid(Entry &entry, const cv::Mat &templ)
+{
+	// Downsample the template once (unless it came from a pack)...
+	if (entry.pyramid.empty())
+	{
+		entry.pyramid = downsample(templ);
+	}
+
+	// ...and the frame once per frame
+	shrink(entry.pyramid.size());
+
+	// Search everything at the coarsest level for the candidates
+	const size_t coarsest = entry.pyramid.size() - 1;
+	correlate(levels[coarsest], entry.pyramid[coarsest], entry.mres);
+
+	// The statistics are those of the full resolution result, like EXHAUSTIVE has, from a grid of it
+	integrate();
+	rank(entry);
+	entry.summary = sample(entry, MATCH_PYRAMID_SAMPLE);
+
+	// Pick the best candidates, suppress the neighbourhood of each one (in a copy that only grows)
+	candidates.clear();
+	cv::Mat coarse = grow(suppressed, entry.mres.rows, entry.mres.cols);
+	entry.mres.copyTo(coarse);
+	const cv::Rect bounds(0, 0, coarse.cols, coarse.rows);
+	for (int i = 0; i < MATCH_PYRAMID_CANDIDATES; ++i)
+	{
+		double score;
+		cv::Point position;
+		cv::minMaxLoc(coarse, &score, NULL, &position, NULL);
+		if (score == FLT_MAX)
+		{
+			break;
+		}
+		candidates.push_back(std::make_pair(static_cast<float>(score), position));
+
+		const cv::Size &size = entry.pyramid[coarsest].size();
+		coarse(cv::Rect(position.x - size.width / 2, position.y - size.height / 2, size.width, size.height) & bounds) = cv::Scalar(FLT_MAX);
+	}
+
+	// Follow every candidate down to full resolution, the best one there is the hit
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		cv::Point position = candidates[i].second;
+		double score = FLT_MAX;
+		for (int l = static_cast<int>(coarsest) - 1; l >= 0; --l)
+		{
+			const cv::Mat &t = entry.pyramid[l];
+			const cv::Rect area(0, 0, levels[l].cols - t.cols + 1, levels[l].rows - t.rows + 1);
+			const cv::Rect window = cv::Rect(position.x * 2 - MATCH_PYRAMID_RADIUS, position.y * 2 - MATCH_PYRAMID_RADIUS, 2 * MATCH_PYRAMID_RADIUS + 1, 2 * MATCH_PYRAMID_RADIUS + 1) & area;
+
+			cv::Mat res = grow(part, window.height, window.width);
+			correlate(levels[l](cv::Rect(window.x, window.y, window.width + t.cols - 1, window.height + t.rows - 1)), t, res);
+			cv::minMaxLoc(res, &score, NULL, &position, NULL);
+			position += window.tl();
+		}
+
+		// No finer level, the template was to small to be downsampled
+		if (coarsest == 0)
+		{
+			score = entry.mres.at<float>(position.y, position.x);
+		}
+
+		if (score < entry.summary.score)
+		{
+			entry.summary.score = score;
+			entry.summary.position = position;
+		}
+	}
+
+	entry.stale = false;
+	entry.dirty.clear();
+}
+
+/**
+ * @brief Downsample the frame, once per frame for all templates.
+ * @param [in] count The number of levels needed, the frame itself included.
+ */
+void
+Match::shrink(size_t count)
+{
+	// The buffers of the levels are kept from frame to frame, the first one is the frame itself
+	if (levels.empty())
+	{
+		levels.push_back(mat);
+	}
+	shrunk = std::max<size_t>(shrunk, 1);
+	for (; shrunk < count; ++shrunk)
+	{
+		if (levels.size() == shrunk)
+		{
+			levels.push_back(cv::Mat());
+		}
+		halve(levels[shrunk - 1], levels[shrunk]);
+	}
+}
+
+void
+Match::transform(void)
+{
+	if (transformed)
+	{
+		return;
+	}
+
+	// Zero pad the frame to a size the DFT likes, one transform per channel, into the buffers of the last frame
+	const cv::Size size(cv::getOptimalDFTSize(mat.cols), cv::getOptimalDFTSize(mat.rows));
+	if (padded.rows != size.height || padded.cols != size.width)
+	{
+		padded = cv::Mat::zeros(size, CV_32F);
+	}
+	cv::split(mat, planes);
+	spectrum.resize(planes.size());
+	for (size_t c = 0; c < planes.size(); ++c)
+	{
+		// Only the frame part of the padded image is written, the padding stays zero
+		cv::Mat roi = padded(cv::Rect(0, 0, mat.cols, mat.rows));
+		planes[c].convertTo(roi, CV_32F);
+		fourier(padded, spectrum[c], 0, mat.rows);
+	}
+	transformed = true;
+
+	integrate();
+}
+
+void
+Match::integrate(void)
+{
+	if (integrated)
+	{
+		return;
+	}
+
+	// The energy of every template sized window comes from the integral image, into the same buffers every frame
+	cv::integral(mat, sum, sqsum, CV_64F);
+	integrated = true;
+}
+
+void
+Match::fft(Entry &entry)
+{
+	transform();
+
+	// Correlate all channels at once, the transform is linear
+	for (size_t c = 0; c < spectrum.size(); ++c)
+	{
+		if (c == 0)
+		{
+			cv::mulSpectrums(spectrum[c], entry.spectrum[c], correlation, 0, true);
+		}
+		else
+		{
+			cv::mulSpectrums(spectrum[c], entry.spectrum[c], product, 0, true);
+			cv::add(correlation, product, correlation);
+		}
+	}
+
+	const cv::Mat &templ = entry.templ;
+	const int rows = mat.rows - templ.rows + 1;
+	const int cols = mat.cols - templ.cols + 1;
+	fourier(correlation, product, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT, rows);
+
+	// Normalize the same way as CV_TM_SQDIFF_NORMED
+	const int channels = mat.channels();
+	const double norm = std::sqrt(entry.energy);
+	entry.mres.create(rows, cols, CV_32F);
+	entry.summary = Summary();
+	for (int y = 0; y < rows; ++y)
+	{
+		const double *top = sqsum.ptr<double>(y);
+		const double *bottom = sqsum.ptr<double>(y + templ.rows);
+		const float *ccorr = product.ptr<float>(y);
+		float *result = entry.mres.ptr<float>(y);
+
+		for (int x = 0; x < cols; ++x)
+		{
+			const double energy = window(top, bottom, x, templ.cols, channels);
+			result[x] = normalize(energy - 2 * ccorr[x] + entry.energy, energy, norm);
+		}
+
+		// Score the row while it's still in the cache
+		entry.summary.add(summarize(entry.mres.row(y), cv::Point(0, y)));
+	}
+
+	entry.stale = false;
+	entry.dirty.clear();
+}
+
+void
+Match::ssd(Entry &entry, const cv::Mat &templ)
+{
+	integrate();
+
+	const int rows = mat.rows - templ.rows + 1;
+	const int cols = mat.cols - templ.cols + 1;
+	entry.mres.create(rows, cols, CV_32F);
+
+	// Same grid as the threaded EXHAUSTIVE search, every tile is summed and normalized while it's in the cache
+	if (entry.tasks.empty())
+	{
+		for (size_t i = 0; i < entry.areas.size(); ++i)
+		{
+			Entry *owner = &entry;
+			entry.tasks.push_back([this, owner, i]()
+			{
+				const cv::Rect &area = owner->areas[i];
+				const cv::Mat &templ = owner->templ;
+				const int channels = mat.channels();
+				const double norm = std::sqrt(owner->energy);
+
+				// The sums go into the scratch tile, and are normalized into the tile of the result
+				cv::Mat &sums = this->sums[i];
+				Ssd_Compute(mat.ptr(area.y) + area.x * channels, mat.step, templ.data, templ.step, templ.cols, templ.rows, channels, area.width, area.height, sums.ptr<int>(0), sums.step / sizeof (int));
+
+				for (int y = 0; y < area.height; ++y)
+				{
+					const double *top = sqsum.ptr<double>(area.y + y);
+					const double *bottom = sqsum.ptr<double>(area.y + y + templ.rows);
+					const int *sum = sums.ptr<int>(y);
+					float *result = owner->mres.ptr<float>(area.y + y) + area.x;
+					for (int x = 0; x < area.width; ++x)
+					{
+						result[x] = normalize(sum[x], window(top, bottom, area.x + x, templ.cols, channels), norm);
+					}
+				}
+
+				owner->summaries[i] = summarize(owner->mres(area), area.tl());
+			});
+		}
+	}
+	run(entry.tasks);
+
+	// Reduce in grid order, hence the same result for any number of threads
+	entry.summary = Summary();
+	for (size_t i = 0; i < entry.summaries.size(); ++i)
+	{
+		entry.summary.add(entry.summaries[i]);
+	}
+
+	entry.stale = false;
+	entry.dirty.clear();
+
+#ifdef TEST // Verify the integer sums against the float ones of OpenCV
+	cv::Mat reference;
+	cv::matchTemplate(mat, templ, reference, CV_TM_SQDIFF_NORMED);
+	assert(cv::norm(reference, entry.mres, cv::NORM_INF) <= MATCH_SSD_TOLERANCE);
+#endif
+}
+
+/**
+ * @brief Sum the squared differences at a position, in the SSDA order.
+ *
+ * The sum is checked against the limit now and then, and the comparison
+ * is abandoned as soon as it's passed.
+ *
+ * @param [in] entry The template state, with the comparison order.
+ * @param [in] x The column of the position.
+ * @param [in] y The row of the position.
+ * @param [in] limit The largest interesting sum.
+ * @param [out] sum The sum, if it's within the limit.
+ * @return If the whole template was compared within the limit.
+ */
+bool
+Match::compare(const Entry &entry, int x, int y, double limit, double *sum) const
+{
+	const Pixel *order = entry.order.data();
+	const size_t count = entry.order.size();
+	// The rows are found with the stride of the current frame, it changes with the window size
+	const unsigned char *origin = mat.ptr(y) + x * mat.channels();
+	const size_t step = mat.step;
+	long long total = 0;
+	for (size_t i = 0; i < count; )
+	{
+		const size_t end = std::min(i + MATCH_SSDA_CHECK, count);
+		for (; i < end; ++i)
+		{
+			const int d = origin[order[i].row * step + order[i].column] - order[i].value;
+			total += d * d;
+		}
+		if (total > limit)
+		{
+			return false;
+		}
+	}
+
+	*sum = total;
+	return true;
+}
+
+/**
+ * @brief The energy of the frame under the template at a position.
+ * @param [in] entry The template state.
+ * @param [in] x The column of the position.
+ * @param [in] y The row of the position.
+ * @return The sum of the squared frame pixels.
+ */
+double
+Match::energy(const Entry &entry, int x, int y) const
+{
+	return window(sqsum.ptr<double>(y), sqsum.ptr<double>(y + entry.templ.rows), x, entry.templ.cols, mat.channels());
+}
+
+/**
+ * @brief Put the template pixels in the SSDA comparison order, once.
+ *
+ * The template pixels that differ most from the template's mean tell the
+ * most, they go first.
+ *
+ * @param [in,out] entry The template state.
+ */
+void
+Match::rank(Entry &entry)
+{
+	if (!entry.order.empty())
+	{
+		return;
+	}
+
+	const cv::Mat &templ = entry.templ;
+	const int width = templ.cols * templ.channels();
+	double mean = 0;
+	for (int r = 0; r < templ.rows; ++r)
+	{
+		for (int i = 0; i < width; ++i)
+		{
+			Pixel pixel = {r, i, templ.ptr(r)[i]};
+			entry.order.push_back(pixel);
+			mean += pixel.value;
+		}
+	}
+	mean /= entry.order.size();
+
+	std::stable_sort(entry.order.begin(), entry.order.end(), [mean](const Pixel &a, const Pixel &b) { return std::abs(a.value - mean) > std::abs(b.value - mean); });
+}
+
+/**
+ * @brief The statistics of the full resolution result, from a grid of positions.
+ *
+ * Every step:th position in both directions is compared in full and
+ * normalized like CV_TM_SQDIFF_NORMED. Needs the integral images and the
+ * comparison order.
+ *
+ * @param [in] entry The template state.
+ * @param [in] step The distance between two sampled positions.
+ * @return The statistics of the sampled positions, and the best of them.
+ */
+Match::Summary
+Match::sample(const Entry &entry, int step) const
+{
+	const int rows = mat.rows - entry.templ.rows + 1;
+	const int cols = mat.cols - entry.templ.cols + 1;
+	const double norm = std::sqrt(entry.energy);
+
+	Summary total;
+	for (int y = 0; y < rows; y += step)
+	{
+		for (int x = 0; x < cols; x += step)
+		{
+			double sum = 0;
+			compare(entry, x, y, DBL_MAX, &sum);
+
+			Summary one;
+			one.n = 1;
+			one.mean = one.score = normalize(sum, energy(entry, x, y), norm);
+			one.position = cv::Point(x, y);
+			total.add(one);
+		}
+	}
+
+	return total;
+}
+
+void
+Match::ssda(Entry &entry, const cv::Mat &templ)
+{
+	integrate();
+	rank(entry);
+
+	const int rows = mat.rows - templ.rows + 1;
+	const int cols = mat.cols - templ.cols + 1;
+
+	// The sampled positions are compared in full, they give the statistics and a first best
+	const Summary sample = this->sample(entry, MATCH_SSDA_SAMPLE);
+
+	// Only positions better than the best so far, and good enough to be a hit, are of any interest
+	const double hit = sample.mean - MATCHING_THRESHOLD * std::sqrt(sample.m2 / sample.n);
+	entry.bound = std::min(sample.score, hit);
+
+	if (entry.tasks.empty())
+	{
+		for (size_t i = 0; i < entry.areas.size(); ++i)
+		{
+			Entry *owner = &entry;
+			entry.tasks.push_back([this, owner, i]()
+			{
+				const cv::Rect &area = owner->areas[i];
+				const double norm = std::sqrt(owner->energy);
+				Summary &best = owner->summaries[i];
+				best = Summary();
+				owner->counts[i] = 0;
+
+				for (int y = area.y; y < area.y + area.height; ++y)
+				{
+					for (int x = area.x; x < area.x + area.width; ++x)
+					{
+						if (x % MATCH_SSDA_SAMPLE == 0 && y % MATCH_SSDA_SAMPLE == 0)
+						{
+							continue;
+						}
+
+						// A flat black window scores 1, it never wins
+						const double window = energy(*owner, x, y);
+						const double limit = std::min(owner->bound, best.score) * std::sqrt(std::max(window, 0.0)) * norm;
+						double sum;
+						if (limit <= 0 || !compare(*owner, x, y, limit, &sum))
+						{
+							++owner->counts[i];
+							continue;
+						}
+
+						const float score = normalize(sum, window, norm);
+						if (score < best.score)
+						{
+							best.score = score;
+							best.position = cv::Point(x, y);
+						}
+					}
+				}
+			});
+		}
+	}
+	run(entry.tasks);
+
+	// The statistics are the sampled ones, the best is exact (when it's a hit)
+	entry.summary = sample;
+	for (size_t i = 0; i < entry.summaries.size(); ++i)
+	{
+		entry.summary.add(entry.summaries[i]);
+		rejections += entry.counts[i];
+	}
+	positions += static_cast<long long>(rows) * cols;
+
+	entry.stale = false;
+	entry.dirty.clear();
+
+#ifdef TEST // Verify that a hit is the best position of a full search
+	if (entry.summary.score <= hit)
+	{
+		cv::Mat reference;
+		double best;
+		cv::matchTemplate(mat, templ, reference, CV_TM_SQDIFF_NORMED);
+		cv::minMaxLoc(reference, &best, NULL, NULL, NULL);
+		assert(std::abs(best - entry.summary.score) <= MATCH_SSD_TOLERANCE);
+	}
+#endif
+}
+
+/**
+ * @brief Pick the colours that key a template.
+ *
+ * A colour is part of the key if it covers a fair share of the template
+ * but hardly any of the current frame. The place of the keyed pixels in
+ * the template tells the size of the blobs to look for.
+ *
+ * @param [in,out] entry The template state.
+ */
+void
+Match::calibrate(Entry &entry)
+{
+	std::vector<unsigned int> frame(CONVERT_KEY_SIZE, 0);
+	std::vector<unsigned int> templ(CONVERT_KEY_SIZE, 0);
+	Convert_Histogram(img, frame.data());
+	for (int y = 0; y < entry.colour.rows; ++y)
+	{
+		for (int x = 0; x < entry.colour.cols; ++x)
+		{
+			const cv::Vec3b &pixel = entry.colour.at<cv::Vec3b>(y, x);
+			++templ[CONVERT_KEY(pixel[0], pixel[1], pixel[2])];
+		}
+	}
+
+	const unsigned char bit = 1 << entry.key;
+	for (int i = 0; i < CONVERT_KEY_SIZE; ++i)
+	{
+		if (templ[i] > 0 && templ[i] >= MATCH_KEY_SHARE * entry.colour.total() && frame[i] <= MATCH_KEY_RARE * img->width * img->height)
+		{
+			lut[i] |= bit;
+		}
+	}
+
+	// The bounding box of the keyed pixels
+	int left = entry.colour.cols, top = entry.colour.rows, right = -1, bottom = -1;
+	for (int y = 0; y < entry.colour.rows; ++y)
+	{
+		for (int x = 0; x < entry.colour.cols; ++x)
+		{
+			const cv::Vec3b &pixel = entry.colour.at<cv::Vec3b>(y, x);
+			if (lut[CONVERT_KEY(pixel[0], pixel[1], pixel[2])] & bit)
+			{
+				left = std::min(left, x);
+				top = std::min(top, y);
+				right = std::max(right, x);
+				bottom = std::max(bottom, y);
+			}
+		}
+	}
+
+	entry.extent = cv::Rect();
+	if (right >= 0)
+	{
+		entry.extent = cv::Rect(left, top, right - left + 1, bottom - top + 1);
+	}
+	else
+	{
+		std::cerr << "Match: No distinctive colours to key a template on, it's searched in full" << std::endl;
+	}
+
+	entry.calibrated = true;
+
+	// The cells of the current frame lack the new key
+	fresh = false;
+}
+
+/**
+ * @brief Search only where the colours of the template are.
+ *
+ * The keyed cells are grouped into blobs of connected cells, and only the
+ * blobs of about the size of the keyed part of the template are searched.
+ * Without any such blob the template isn't there at all. The scores are
+ * put in the statistics of the last full search, like track() does.
+ *
+ * @param [in,out] entry The template state.
+ * @param [in] templ The template.
+ * @return If the entry holds the result, otherwise a full search is needed.
+ */
+bool
+Match::cascade(Entry &entry, const cv::Mat &templ)
+{
+	if (!entry.calibrated)
+	{
+		calibrate(entry);
+		return false;
+	}
+
+	if (!fresh || entry.extent.area() == 0 || entry.baseline.n == 0 || entry.keyed >= MATCH_KEY_PERIOD)
+	{
+		return false;
+	}
+
+	// A span of n pixels covers n / cell (rounded up) cells or one more, allow one more either way
+	const int cell = 1 << CONVERT_CELL_SHIFT;
+	const cv::Size least(std::max(1, (entry.extent.width + cell - 1) / cell - 1), std::max(1, (entry.extent.height + cell - 1) / cell - 1));
+	const cv::Size most((entry.extent.width + cell - 1) / cell + 2, (entry.extent.height + cell - 1) / cell + 2);
+	const unsigned char bit = 1 << entry.key;
+
+	// Flood fill the blobs of 8-connected cells, most frames don't have any
+	blobs.clear();
+	seen.assign(cells.rows * cells.cols, 0);
+	stack.clear();
+	for (int y = 0; y < cells.rows; ++y)
+	{
+		const unsigned char *row = cells.ptr(y);
+		for (int x = 0; x < cells.cols; ++x)
+		{
+			if (!(row[x] & bit) || seen[y * cells.cols + x])
+			{
+				continue;
+			}
+
+			cv::Point first(x, y), last(x, y);
+			seen[y * cells.cols + x] = 1;
+			stack.push_back(cv::Point(x, y));
+			while (!stack.empty())
+			{
+				const cv::Point p = stack.back();
+				stack.pop_back();
+				first = cv::Point(std::min(first.x, p.x), std::min(first.y, p.y));
+				last = cv::Point(std::max(last.x, p.x), std::max(last.y, p.y));
+
+				for (int dy = -1; dy <= 1; ++dy)
+				{
+					for (int dx = -1; dx <= 1; ++dx)
+					{
+						const cv::Point q(p.x + dx, p.y + dy);
+						if (q.x >= 0 && q.y >= 0 && q.x < cells.cols && q.y < cells.rows && (cells.at<unsigned char>(q.y, q.x) & bit) && !seen[q.y * cells.cols + q.x])
+						{
+							seen[q.y * cells.cols + q.x] = 1;
+							stack.push_back(q);
+						}
+					}
+				}
+			}
+
+			const cv::Size size(last.x - first.x + 1, last.y - first.y + 1);
+			if (size.width >= least.width && size.height >= least.height && size.width <= most.width && size.height <= most.height)
+			{
+				blobs.push_back(cv::Rect(first.x * cell, first.y * cell, size.width * cell, size.height * cell));
+			}
+
+			if (blobs.size() > MATCH_KEY_BLOBS)
+			{
+				return false;
+			}
+		}
+	}
+
+	// Every position where the keyed part of the template is in the blob, give or take a cell
+	const cv::Rect bounds(0, 0, mat.cols - templ.cols + 1, mat.rows - templ.rows + 1);
+	Summary best;
+	for (size_t i = 0; i < blobs.size(); ++i)
+	{
+		const cv::Rect &blob = blobs[i];
+		const cv::Rect window = cv::Rect(blob.x - entry.extent.x - cell, blob.y - entry.extent.y - cell, blob.width - entry.extent.width + 2 * cell + 1, blob.height - entry.extent.height + 2 * cell + 1) & bounds;
+		if (window.area() == 0)
+		{
+			continue;
+		}
+
+		cv::Mat res = grow(part, window.height, window.width);
+		correlate(mat(cv::Rect(window.x, window.y, window.width + templ.cols - 1, window.height + templ.rows - 1)), templ, res);
+		const Summary local = summarize(res, window.tl());
+		if (local.score < best.score)
+		{
+			best = local;
+		}
+	}
+
+	// Nothing to search means nothing found, at the mean of the statistics
+	Summary result = entry.baseline;
+	result.score = best.n > 0 ? best.score : result.mean;
+	result.position = best.n > 0 ? best.position : entry.summary.position;
+	entry.summary = result;
+	++entry.keyed;
+
+	// There is no result to update incrementally anymore
+	entry.stale = true;
+	entry.dirty.clear();
+
+	return true;
+}
+
+/**
+ * @brief If a template fits the search image.
+ * @param [in] entry The template state.
+ * @return True if there is at least one position to search.
+ */
+bool
+Match::fits(const Entry &entry) const
+{
+	return entry.templ.cols <= mat.cols && entry.templ.rows <= mat.rows;
+}
+
+/**
+ * @brief The zoom level of a template that is searched.
+ * @param [in] entry The template state.
+ * @return The locked zoom level of a bank, else the template itself.
+ */
+Match::Entry &
+Match::current(Entry &entry)
+{
+	return entry.scales.empty() ? entry : entries[entry.scales[entry.locked]];
+}
+
+/**
+ * @brief Pick the zoom level of a template bank to search.
+ *
+ * Every MATCH_ZOOM_PERIOD changed frames all zoom levels are compared at
+ * the coarsest level of the frame pyramid, which the PYRAMID searches
+ * share. A better one than the locked zoom level is searched in full,
+ * and only a hit moves the lock. A frame without the template doesn't
+ * move it around at random that way.
+ *
+ * @param [in,out] entry The template state.
+ * @return The zoom level to search.
+ */
+Match::Entry &
+Match::lock(Entry &entry)
+{
+	Entry &locked = current(entry);
+	if (entry.scales.empty() || (!locked.stale && locked.dirty.empty()) || ++entry.unlocked < MATCH_ZOOM_PERIOD)
+	{
+		return locked;
+	}
+	entry.unlocked = 0;
+
+	shrink(entry.level + 1);
+	size_t best = entry.locked;
+	double score = -DBL_MAX;
+	for (size_t i = 0; i < entry.scales.size(); ++i)
+	{
+		Entry &scale = entries[entry.scales[i]];
+		if (!fits(scale))
+		{
+			continue;
+		}
+		correlate(levels[entry.level], scale.pyramid[entry.level], scale.glance);
+		const double sigma = summarize(scale.glance, cv::Point(0, 0)).sigma();
+		if (sigma > score)
+		{
+			score = sigma;
+			best = i;
+		}
+	}
+	if (best == entry.locked)
+	{
+		return locked;
+	}
+
+	// The zoom levels share the result buffer, the others have to search everything again
+	Entry &candidate = entries[entry.scales[best]];
+	const double sigma = std::get<1>(search(candidate));
+	for (size_t i = 0; i < entry.scales.size(); ++i)
+	{
+		if (i != best)
+		{
+			entries[entry.scales[i]].stale = true;
+			entries[entry.scales[i]].dirty.clear();
+		}
+	}
+	if (sigma <= MATCHING_THRESHOLD)
+	{
+		return locked;
+	}
+
+	entry.locked = best;
+	std::cout << "Match: Locked on " << candidate.templ.cols << "x" << candidate.templ.rows << " for the " << entry.templ.cols << "x" << entry.templ.rows << " template" << std::endl;
+	return candidate;
+}
+
+std::tuple<cv::Point, double>
+Match::match(cv::Mat templ)
+{
+	if (entries.find(templ.data) == entries.end())
+	{
+		registerTemplate(templ);
+	}
+
+	// A bank is searched at one zoom level at a time
+	return search(lock(entries[templ.data]));
+}
+
+cv::Size
+Match::extent(const cv::Mat &templ)
+{
+	if (entries.find(templ.data) == entries.end())
+	{
+		return templ.size();
+	}
+
+	return current(entries[templ.data]).templ.size();
+}
+
+/**
+ * @brief Search the frame for one template, or one zoom level of it.
+ * @param [in,out] entry The template state.
+ * @return The best match and its score.
+ */
+std::tuple<cv::Point, double>
+Match::search(Entry &entry)
+{
+	const cv::Mat &templ = entry.templ;
+
+	// A template larger than the window is never a hit, it's searched in full once it fits again
+	if (!fits(entry))
+	{
+		entry.stale = true;
+		entry.dirty.clear();
+		entry.whole = false;
+		return std::tuple<cv::Point, double>(cv::Point(0, 0), 0);
+	}
+
+	// A changed frame is searched around the recent hits first
+	const bool changed = entry.stale || !entry.dirty.empty();
+	const bool tracked = tracking && changed && track(entry, templ);
+	const bool keyed = !tracked && entry.key >= 0 && changed && cascade(entry, templ);
+	if (!tracked && !entry.held.empty())
+	{
+		// The damage of the tracked frames is due, against the statistics the result had before them
+		if (entry.dirty.size() + entry.held.size() > MATCH_MAX_DAMAGE)
+		{
+			entry.stale = true;
+			entry.dirty.clear();
+		}
+		else if (!entry.stale)
+		{
+			entry.dirty.insert(entry.dirty.end(), entry.held.begin(), entry.held.end());
+			entry.summary = entry.baseline;
+		}
+		entry.held.clear();
+	}
+	if (tracked)
+	{
+		// Found close to a recent hit, no need to search the rest
+		entry.whole = false;
+	}
+	else if (keyed)
+	{
+		// Searched where the colours of the template are, if anywhere
+		entry.whole = false;
+	}
+	else if (mode == PYRAMID)
+	{
+		// The refined hit is scored against the sampled statistics of the full resolution result
+		if (entry.stale || !entry.dirty.empty())
+		{
+			pyramid(entry, templ);
+			entry.whole = false;
+		}
+	}
+	else if (mode == FFT)
+	{
+		// The frame spectrum is shared by all templates
+		if (entry.stale || !entry.dirty.empty())
+		{
+			fft(entry);
+			entry.whole = true;
+		}
+	}
+	else if (mode == SSDA)
+	{
+		// Nothing to update incrementally, there is no whole result
+		if (entry.stale || !entry.dirty.empty())
+		{
+			ssda(entry, templ);
+			entry.whole = false;
+		}
+	}
+	else if (mode == SSD && templ.total() * templ.channels() <= SSD_MAX_AREA)
+	{
+		// The frame integral image is shared by all templates, larger templates would overflow the sums
+		if (entry.stale || !entry.dirty.empty())
+		{
+			ssd(entry, templ);
+			entry.whole = true;
+		}
+	}
+	else if (entry.stale || entry.updates >= MATCH_RESYNC || (entry.mres.empty() && !entry.dirty.empty()))
+	{
+		entry.whole = !streaming;
+		if (streaming && !pool)
+		{
+			// Band by band without keeping the result
+			stream(entry, templ);
+		}
+		else
+		{
+			// Do 'quick' template matching (http://en.wikipedia.org/wiki/Template_matching) tile by tile,
+			// on all threads or on this one, the same grid and reduction give the same result either way
+			tiled(entry, templ);
+		}
+		entry.stale = false;
+		entry.updates = 0;
+		entry.dirty.clear();
+	}
+	else if (!entry.dirty.empty())
+	{
+		// Only search where the frame has changed
+		update(entry, templ);
+		entry.whole = !streaming;
+	}
+
+	if (tracking && changed && !tracked && !keyed)
+	{
+		learn(entry);
+	}
+
+	// The keyed searches are scored against the statistics of the last full one
+	if (entry.key >= 0 && changed && !tracked && !keyed)
+	{
+		entry.baseline = entry.summary;
+		entry.keyed = 0;
+	}
 
-	// Retrieve the absolute score for the best location
-	double score;
-	cv::Point local_position;
-	cv::minMaxLoc(mres, &score, NULL, &local_position, NULL);
+	const cv::Point local_position = entry.summary.position;
 
 	// Calculate a real/relative score for the hit, in sigma (http://en.wikipedia.org/wiki/Standard_deviation)
-	cv::Scalar mean, stddev;
-	cv::meanStdDev(mres, mean, stddev);
-	double sigma = std::abs(mean[0] - score) / stddev[0];
+	double sigma = entry.summary.sigma();
 
-#ifdef TEST // Debug helper
-	cv::Mat color;
+#ifdef TEST // Debug helper, drawn into the same image every frame
 #ifndef COLOR
-	cv::cvtColor(mat, color, CV_GRAY2BGR);
+	cv::cvtColor(mat, debug, CV_GRAY2BGR);
 #else
-	mat.copyTo(color);
+	mat.copyTo(debug);
 #endif
 	char tmp[256];
 	snprintf(tmp, 256, "sigma: %0.2lf", sigma);
-	cv::circle(color, local_position, 20, cv::Scalar(255, 0, 255), 5);
-	cv::putText(color, tmp, local_position, cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(255, 255, 0), 2);
-	cv::imshow("debug", color);
+	cv::circle(debug, local_position, 20, cv::Scalar(255, 0, 255), 5);
+	cv::putText(debug, tmp, local_position, cv::FONT_HERSHEY_SIMPLEX, 1, cv::Scalar(255, 255, 0), 2);
+	cv::imshow("debug", debug);
 	cv::waitKey(20);
 #endif
 
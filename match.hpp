@@ -29,7 +29,11 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 #define __MATCH_H__
 
 // C++ Standard Library headers
+#include <functional>
+#include <map>
+#include <memory>
 #include <tuple>
+#include <vector>
 
 // OpenCV headers
 #include <opencv/cv.h>
@@ -37,6 +41,27 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 // Xlib headers
 #include <X11/Xlib.h>
 
+// Local C++ headers
+#include "arena.hpp"
+
+/**
+ * @def MATCHING_THRESHOLD
+ * @brief A threshold determine template match or miss
+ * 
+ * The score each template matching need atleast reach to be treated
+ * as a hit. If the score is below this value, the template is considered
+ * NOT to be part of current search image.
+ */
+#define MATCHING_THRESHOLD 2.7
+
+/**
+ * @def MATCH_PEAKS
+ * @brief The maximum number of hits of one template that matchPeaks() returns.
+ */
+#define MATCH_PEAKS 16
+
+class Pool;
+
 /**
  * @class Match
  * @brief An image template matching class.
@@ -48,6 +73,18 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 class Match
 {
 public:
+	/**
+	 * @brief The available search strategies.
+	 */
+	enum Mode
+	{
+		EXHAUSTIVE, ///< Search every position at full resolution (the reference)
+		PYRAMID, ///< Search a downsampled image, refine the best candidates
+		FFT, ///< Correlate in the frequency domain, with cached template spectra
+		SSD, ///< Exact integer differences with SIMD kernels, normalized like EXHAUSTIVE
+		SSDA ///< Like SSD, but positions are abandoned as soon as they can't win
+	};
+
 	/**
 	 * @brief Constructor.
 	 * 
@@ -66,7 +103,37 @@ public:
 	 */
 	void
 	prepare(void);
-	
+
+	/**
+	 * @brief Prepares the matching algorithm with a partially updated search image.
+	 *
+	 * Same as prepare(), but only the damaged areas of the search image are
+	 * converted. The following calls to match() will only search the parts
+	 * of the image that the damage could have changed, cached results are
+	 * used for the rest.
+	 *
+	 * @param [in] rects The damaged areas of the search image.
+	 * @param [in] count The number of damaged areas.
+	 */
+	void
+	prepare(const XRectangle *rects, int count);
+
+	/**
+	 * @brief Replace the search image.
+	 *
+	 * When the window was resized its search image is replaced too. The
+	 * buffers of the frame and of every template are made again for the
+	 * new size, the registered templates and keys are kept. A template
+	 * larger than the image is never a hit until the image is large
+	 * enough for it again. An image of the same size is only read from,
+	 * the next prepare() converts the damage of the new image. Call
+	 * prepare() before the next match().
+	 *
+	 * @param [in] img The new search image.
+	 */
+	void
+	setImage(XImage *img);
+
 	/**
 	 * @brief Do template matching on the search image.
 	 * 
@@ -78,20 +145,409 @@ public:
 	std::tuple<cv::Point, double>
 	match(cv::Mat templ);
 
+	/**
+	 * @brief Find every place where a template is.
+	 *
+	 * Same search as match(), but every local best of the result that
+	 * scores above the threshold is returned, best first. No two of
+	 * them are closer than the template size (non-maximum suppression).
+	 * Only the searches that keep the whole result (EXHAUSTIVE without
+	 * streaming, FFT and SSD, unless tracked or keyed) find more than one,
+	 * the others return the best one if it's a hit.
+	 *
+	 * @param [in] templ The template image
+	 * @param [out] peaks The hits and their scores, cleared first. The
+	 * capacity is kept, pass the same vector every frame.
+	 * @param [in] threshold The score a hit needs.
+	 */
+	void
+	matchPeaks(cv::Mat templ, std::vector<std::tuple<cv::Point, double> > &peaks, double threshold = MATCHING_THRESHOLD);
+
+	/**
+	 * @brief Do template matching for all registered templates.
+	 *
+	 * In FFT mode the frame is transformed once and every template only
+	 * costs a spectrum multiplication and an inverse transform.
+	 *
+	 * @return The best match of each template, in registration order.
+	 * @see registerTemplate()
+	 */
+	std::vector<std::tuple<cv::Point, double> >
+	matchAll(void);
+
+	/**
+	 * @brief Register a template image.
+	 *
+	 * Precomputes everything about the template that doesn't depend on the
+	 * frame, like its spectrum and energy for the FFT mode. Templates that
+	 * are used without being registered are registered on first use.
+	 *
+	 * @param [in] templ The template image, from loadTemplate().
+	 * @param [in] pyramid The downsampled versions of the template, from
+	 * downsample() or a Pack. Made when needed if empty.
+	 */
+	void
+	registerTemplate(const cv::Mat &templ, const std::vector<cv::Mat> &pyramid = std::vector<cv::Mat>());
+
+	/**
+	 * @brief Search a template at every browser zoom level.
+	 *
+	 * The template is searched at one zoom level of the bank, the one that
+	 * was found last. Every few frames all of them are compared at the
+	 * coarsest level of the frame pyramid, that is made once per frame for
+	 * all templates. Only a hit at another zoom level moves the lock onto
+	 * it. match() and matchPeaks() return the places of the zoom level,
+	 * extent() tells its size.
+	 *
+	 * @param [in] templ The template image, from loadTemplate().
+	 * @param [in] bank The template at every zoom level, from zoom().
+	 * @param [in] pyramid The downsampled versions of the template, from
+	 * downsample() or a Pack. Made when needed if empty.
+	 */
+	void
+	registerBank(const cv::Mat &templ, const std::vector<cv::Mat> &bank, const std::vector<cv::Mat> &pyramid = std::vector<cv::Mat>());
+
+	/**
+	 * @brief The size a template is found at.
+	 * @param [in] templ The template image.
+	 * @return The size of the locked zoom level of a bank, else of the template.
+	 */
+	cv::Size
+	extent(const cv::Mat &templ);
+
 	/**
 	 * @brief Loads an template image
 	 * 
 	 * Use this helper to load a template image with the correct format.
 	 * 
 	 * @param [in] filename A file path to the desired template image.
+	 * @param [out] bank The template at every zoom level, from zoom(). NULL if not wanted.
 	 * @return A template image in the correct format.
 	 */
 	static cv::Mat
-	loadTemplate(const char *filename);
+	loadTemplate(const char *filename, std::vector<cv::Mat> *bank = NULL);
+
+	/**
+	 * @brief Resample a template for the browser zoom levels.
+	 *
+	 * The game is drawn larger or smaller when the browser is zoomed, the
+	 * template is resampled for the usual zoom levels from 67% to 150%.
+	 *
+	 * @param [in] templ The template image.
+	 * @return The template at every zoom level that isn't too small, the
+	 * template itself among them.
+	 */
+	static std::vector<cv::Mat>
+	zoom(const cv::Mat &templ);
+
+	/**
+	 * @brief Downsample a template for the PYRAMID mode.
+	 *
+	 * @param [in] templ The template image.
+	 * @return The template followed by ever smaller versions of it.
+	 */
+	static std::vector<cv::Mat>
+	downsample(const cv::Mat &templ);
+
+	/**
+	 * @brief Select the search strategy used by match().
+	 *
+	 * The default is EXHAUSTIVE, which is also the reference for validating
+	 * the other modes.
+	 *
+	 * @param [in] mode The search strategy.
+	 */
+	void
+	setMode(Mode mode);
+
+	/**
+	 * @brief Split the work over several threads.
+	 *
+	 * Full frame conversion and EXHAUSTIVE searches are split into tiles
+	 * on a fixed grid, the result tiles overlap by the template size minus
+	 * one in the frame. The tiles are reduced in a fixed order, hence the
+	 * result is exactly the same for every thread count, and the same as
+	 * without threads, which searches the same tiles one by one.
+	 *
+	 * @param [in] threads The number of threads, 0 means one per CPU core.
+	 */
+	void
+	setThreads(int threads);
+
+	/**
+	 * @brief Split the work over the threads of a shared pool.
+	 *
+	 * Like setThreads(), but several matching algorithm objects can use
+	 * the same threads. Their searches take turns on the pool.
+	 *
+	 * @param [in] pool The thread pool.
+	 */
+	void
+	setPool(const std::shared_ptr<Pool> &pool);
+
+	/**
+	 * @brief Score the search without keeping the whole result.
+	 *
+	 * The EXHAUSTIVE search is done in bands of rows, each band is scored
+	 * while it's still in the cache and then thrown away. Saves memory
+	 * bandwidth, but damaged frames are searched as a whole since there
+	 * is no cached result to update.
+	 *
+	 * @param [in] streaming If the result should be thrown away.
+	 */
+	void
+	setStreaming(bool streaming);
+
+	/**
+	 * @brief Search around the recent hits first.
+	 *
+	 * Every template remembers where it was found lately. A changed frame
+	 * is first searched in small windows around those places, scored
+	 * against the statistics of the last full search. Only when that
+	 * misses, or every few frames to refresh the statistics, is the whole
+	 * frame searched the usual way.
+	 *
+	 * @param [in] tracking If the recent hits should be searched first.
+	 */
+	void
+	setTracking(bool tracking);
+
+	/**
+	 * @brief The positions abandoned early by the SSDA searches.
+	 *
+	 * Counts every search since the matching algorithm was created.
+	 *
+	 * @param [out] positions The number of positions searched, NULL if not wanted.
+	 * @return The number of positions rejected before the whole template was compared.
+	 */
+	long long
+	rejected(long long *positions = NULL) const;
+
+	/**
+	 * @brief Key a template on its colours.
+	 *
+	 * The colours that cover a fair share of the template, but hardly any
+	 * of the first frame it's searched in, become its key. Every frame is
+	 * keyed while it's converted, and the template is only searched where
+	 * blobs of its colours of about its size are. A frame without such a
+	 * blob costs little more than the conversion. Every few frames the
+	 * whole frame is searched anyway, to keep the statistics up to date.
+	 *
+	 * @param [in] templ The template image, from loadTemplate().
+	 * @param [in] colour The same template in colour, BGR.
+	 */
+	void
+	setKey(const cv::Mat &templ, const cv::Mat &colour);
 
 private:
+	/**
+	 * @brief The best location and the statistics of a result.
+	 *
+	 * The mean and the sum of squared deviations are kept the way Welford
+	 * does it, summaries of parts can be combined without losing precision.
+	 * @par More info here:
+	 * - http://en.wikipedia.org/wiki/Algorithms_for_calculating_variance
+	 */
+	struct Summary
+	{
+		Summary(void);
+
+		void
+		add(const Summary &other);
+
+		void
+		remove(const Summary &other);
+
+		double
+		sigma(void) const;
+
+		double n; ///< Number of results
+		double mean; ///< Mean of the results
+		double m2; ///< Sum of squared deviations from the mean
+		double score; ///< The best result
+		cv::Point position; ///< Location of the best result
+	};
+
+	/**
+	 * @brief A place where a template was found lately.
+	 */
+	struct Track
+	{
+		cv::Point position; ///< Location of the last hit
+		double confidence; ///< Grows with every hit, fades with every miss
+	};
+
+	/**
+	 * @brief A template pixel (one channel of it) in the SSDA comparison order.
+	 */
+	struct Pixel
+	{
+		int row; ///< The template row
+		int column; ///< From the start of the row, in bytes
+		int value; ///< The template pixel
+	};
+
+	/**
+	 * @brief Cached matching state for one template.
+	 */
+	struct Entry
+	{
+		Entry(void) : stale(true), updates(0), since(0), key(-1), calibrated(false), keyed(0), bound(0), whole(false), bank(NULL), locked(0), unlocked(0), level(0) {}
+
+		bool stale; ///< The cached result is invalid, search everything
+		int updates; ///< Incremental updates since the last full search
+		std::vector<cv::Rect> dirty; ///< Damaged areas since the last match()
+		std::vector<cv::Rect> held; ///< Damaged areas of the tracked frames, for the next full search
+		cv::Mat mres; ///< The result of the last search
+		Summary summary; ///< The score and statistics of the result
+		std::vector<cv::Mat> pyramid; ///< Downsampled versions of the template
+		cv::Mat templ; ///< The template itself
+		std::vector<cv::Mat> spectrum; ///< The template spectrum, one per channel
+		double energy; ///< Sum of the squared template
+		std::vector<Track> tracks; ///< Recent hits, most confident first
+		Summary baseline; ///< The statistics of the last full search
+		int since; ///< Tracked searches since the last full search
+		std::vector<Pixel> order; ///< The template pixels, most informative first
+		int key; ///< The bit of the template in the colour key table, -1 if not keyed
+		cv::Mat colour; ///< The template in colour, for picking the key
+		bool calibrated; ///< The key has been picked
+		cv::Rect extent; ///< Where the keyed colours are in the template
+		int keyed; ///< Keyed searches since the last full search
+		std::vector<cv::Rect> areas; ///< The tiles of the result, on the MATCH_TILE grid
+		std::vector<Summary> summaries; ///< The summary of every tile
+		std::vector<long long> counts; ///< The positions rejected early in every tile
+		std::vector<std::function<void(void)> > tasks; ///< One per tile for the current mode, made on first use
+		double bound; ///< The SSDA limit of the current search
+		bool whole; ///< The result of the last search covers the whole frame
+		Entry *bank; ///< The template this is a zoom level of, NULL if none
+		std::vector<const unsigned char *> scales; ///< Every zoom level, of a template with a bank
+		size_t locked; ///< The zoom level that is searched, index into scales
+		int unlocked; ///< Changed frames since the zoom levels were compared
+		int level; ///< The pyramid level the zoom levels are compared at
+		cv::Mat shared; ///< The result buffer of all zoom levels, frame sized
+		cv::Mat glance; ///< The result of the comparison at the pyramid level
+	};
+
+	static Summary
+	summarize(const cv::Mat &res, const cv::Point &offset);
+
+	Entry &
+	enter(const cv::Mat &templ, const std::vector<cv::Mat> &pyramid);
+
+	bool
+	fits(const Entry &entry) const;
+
+	Entry &
+	current(Entry &entry);
+
+	Entry &
+	lock(Entry &entry);
+
+	std::tuple<cv::Point, double>
+	search(Entry &entry);
+
+	void
+	update(Entry &entry, const cv::Mat &templ);
+
+	bool
+	track(Entry &entry, const cv::Mat &templ);
+
+	void
+	learn(Entry &entry);
+
+	void
+	stream(Entry &entry, const cv::Mat &templ);
+
+	void
+	pyramid(Entry &entry, const cv::Mat &templ);
+
+	void
+	tiled(Entry &entry, const cv::Mat &templ);
+
+	void
+	shrink(size_t count);
+
+	void
+	convert(const cv::Rect &area);
+
+	void
+	integrate(void);
+
+	void
+	transform(void);
+
+	void
+	transform(Entry &entry);
+
+	void
+	fft(Entry &entry);
+
+	void
+	ssd(Entry &entry, const cv::Mat &templ);
+
+	void
+	ssda(Entry &entry, const cv::Mat &templ);
+
+	void
+	rank(Entry &entry);
+
+	Summary
+	sample(const Entry &entry, int step) const;
+
+	bool
+	compare(const Entry &entry, int x, int y, double limit, double *sum) const;
+
+	double
+	energy(const Entry &entry, int x, int y) const;
+
+	void
+	reserve(Entry &entry);
+
+	void
+	run(std::vector<std::function<void(void)> > &tasks);
+
+	void
+	calibrate(Entry &entry);
+
+	bool
+	cascade(Entry &entry, const cv::Mat &templ);
+
 	XImage *img;
 	cv::Mat mat;
+	Mode mode;
+	bool streaming;
+	bool tracking;
+	std::vector<cv::Mat> levels;
+	size_t shrunk;
+	std::vector<const unsigned char *> registered;
+	std::vector<cv::Mat> spectrum;
+	bool transformed;
+	std::vector<cv::Mat> planes;
+	cv::Mat padded;
+	cv::Mat sum, sqsum;
+	bool integrated;
+	cv::Mat product, correlation;
+	cv::Mat part;
+	std::shared_ptr<Pool> pool;
+	long long positions;
+	long long rejections;
+	std::vector<unsigned char> lut;
+	cv::Mat cells;
+	int keys;
+	bool fresh;
+	std::vector<unsigned char> seen;
+	std::vector<cv::Point> stack;
+	std::vector<cv::Rect> blobs;
+	std::vector<cv::Rect> damage;
+	std::vector<cv::Rect> regions;
+	std::vector<std::function<void(void)> > bands;
+	cv::Mat debug;
+	std::vector<std::pair<float, cv::Point> > candidates;
+	cv::Mat suppressed;
+	std::vector<cv::Mat> sums;
+	std::vector<cv::Mat> tiles;
+	Arena arena;
+	std::map<const unsigned char *, Entry> entries;
 };
 
 #endif
@@ -20,8 +20,12 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 /**
  * @file mouse.c
  * The mouse moving component uses the Xlib API for all the dirty work.
- * @par More info about the used library:
+ * The XTEST backend fakes absolute pointer motion and button events in
+ * the X server, the requests are queued on the shared connection and
+ * flushed without waiting for a reply.
+ * @par More info about the used libraries:
  * - http://en.wikipedia.org/wiki/Xlib
+ * - http://www.x.org/releases/current/doc/libXtst/xtestlib.html
  * @author Marcus Stjärnås
  * @date July, 2011
  * @version 1
@@ -31,37 +35,118 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 // C Standard Library headers
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+// Xlib headers
+#include <X11/extensions/XTest.h>
+
 // Local C headers
 #include "mouse.h"
 
+/**
+ * @brief The mouse of one target window.
+ */
+struct Pointer
+{
+	Window window; ///< The target window, or None
+};
+
+// All targets share the X connection
 static Display *display = NULL;
+static int users = 0;
+static int backend = MOUSE_EVENTS;
+static int shared = 0; ///< The connection belongs to someone else
 
 void
-Mouse_Initialize(void)
+Mouse_Share(Display *connection)
 {
-	display = XOpenDisplay(NULL);
-	assert(display);
+	assert(users == 0);
+
+	display = connection;
+	shared = connection != NULL;
+}
+
+Pointer *
+Mouse_Initialize(Window window)
+{
+	if (users++ == 0 && !shared)
+	{
+		display = XOpenDisplay(NULL);
+		assert(display);
+	}
+
+	Pointer *pointer = malloc(sizeof (Pointer));
+	assert(pointer);
+	pointer->window = window;
+
+	return pointer;
 }
 
 void
-Mouse_Deinitialize(void)
+Mouse_Deinitialize(Pointer *pointer)
 {
+	assert(pointer);
 	assert(display);
-	XCloseDisplay(display);
-	display = NULL;
+	free(pointer);
+
+	if (--users == 0)
+	{
+		if (!shared)
+		{
+			XCloseDisplay(display);
+		}
+		display = NULL;
+		shared = 0;
+		backend = MOUSE_EVENTS;
+	}
+}
+
+int
+Mouse_SetBackend(int selected)
+{
+	assert(display);
+	assert(selected == MOUSE_EVENTS || selected == MOUSE_XTEST);
+
+	backend = MOUSE_EVENTS;
+	if (selected == MOUSE_XTEST)
+	{
+		int ignore, major, minor;
+		if (XTestQueryExtension(display, &ignore, &ignore, &major, &minor))
+		{
+			fprintf(stdout, "XTEST: %d.%d\n", major, minor);
+			backend = MOUSE_XTEST;
+		}
+		else
+		{
+			fprintf(stderr, "Mouse: No XTEST extension, the events are sent instead\n");
+		}
+	}
+
+	return backend;
 }
 
 void
-Mouse_Click(int button)
+Mouse_Click(const Pointer *pointer, int button)
 {
+	assert(pointer);
+	assert(display);
+
+	if (backend == MOUSE_XTEST)
+	{
+		XTestFakeButtonEvent(display, button, True, CurrentTime);
+		XTestFakeButtonEvent(display, button, False, CurrentTime);
+		XFlush(display);
+		return;
+	}
+
 	// Create and setting up the event
 	XEvent event;
 	memset(&event, 0, sizeof (event));
 	event.xbutton.button = button;
 	event.xbutton.same_screen = True;
 	event.xbutton.subwindow = DefaultRootWindow(display);
+	int over = pointer->window == None;
 	while (event.xbutton.subwindow)
 	{
 		event.xbutton.window = event.xbutton.subwindow;
@@ -74,6 +159,14 @@ Mouse_Click(int button)
 						&event.xbutton.x,
 						&event.xbutton.y,
 						&event.xbutton.state);
+		over |= event.xbutton.window == pointer->window;
+	}
+
+	// Another window is in the way
+	if (!over)
+	{
+		fprintf(stderr, "Mouse: The pointer is not over the target window!\n");
+		return;
 	}
 
 	// Press
@@ -94,8 +187,9 @@ Mouse_Click(int button)
 }
 
 void
-Mouse_GetCoords(int *x, int *y)
+Mouse_GetCoords(const Pointer *pointer, int *x, int *y)
 {
+	assert(pointer);
 	assert(x);
 	assert(y);
 
@@ -112,13 +206,40 @@ Mouse_GetCoords(int *x, int *y)
 }
 
 void
-Mouse_SetCoords(int x, int y)
+Mouse_SetCoords(const Pointer *pointer, int x, int y)
 {
 	assert(display);
 
+	if (backend == MOUSE_XTEST)
+	{
+		XTestFakeMotionEvent(display, DefaultScreen(display), x, y, CurrentTime);
+		XFlush(display);
+		return;
+	}
+
 	int oy, ox;
-	Mouse_GetCoords(&ox, &oy);
+	Mouse_GetCoords(pointer, &ox, &oy);
 
 	XWarpPointer(display, None, None, 0, 0, 0, 0, x-ox, y-oy);
 	XSync(display, False);
 }
+
+void
+Mouse_ClickAt(const Pointer *pointer, int x, int y, int button)
+{
+	assert(pointer);
+	assert(display);
+
+	if (backend != MOUSE_XTEST)
+	{
+		Mouse_SetCoords(pointer, x, y);
+		Mouse_Click(pointer, button);
+		return;
+	}
+
+	// One flush for the whole action, the X server takes them in order
+	XTestFakeMotionEvent(display, DefaultScreen(display), x, y, CurrentTime);
+	XTestFakeButtonEvent(display, button, True, CurrentTime);
+	XTestFakeButtonEvent(display, button, False, CurrentTime);
+	XFlush(display);
+}
@@ -31,59 +31,141 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 // Xlib headers
 #include <X11/Xlib.h>
 
+/**
+ * @brief The mouse of one target window.
+ *
+ * There is only one mouse pointer, all targets share it (and the X
+ * connection). The caller has to take care that only one target moves
+ * it at a time.
+ */
+typedef struct Pointer Pointer;
+
+/**
+ * @def MOUSE_EVENTS
+ * @brief Warp the pointer and send the button events to the window under it.
+ *
+ * Every move and click waits for the X server, a click first walks the
+ * window tree to check that the target window is under the pointer.
+ */
+#define MOUSE_EVENTS 0
+
+/**
+ * @def MOUSE_XTEST
+ * @brief Fake the pointer with the XTEST extension.
+ *
+ * Moves and clicks are absolute and are only flushed to the X server,
+ * nothing waits for a reply. The window under the pointer isn't checked,
+ * the screen capture tells when the target window is covered.
+ */
+#define MOUSE_XTEST 1
+
+/**
+ * @brief Use an X connection of someone else.
+ *
+ * Without it the first target opens a connection of its own. A shared
+ * connection isn't closed by the mouse, it has to stay open until the
+ * last target is deinitialized.
+ *
+ * @param [in] connection The connection, NULL to open one.
+ * @attention Has to be called before the first Mouse_Initialize().
+ */
+void
+Mouse_Share(Display *connection);
+
 /**
  * @brief Initialize the mouse moving component.
  * 
  * Allocate needed system resouces.
+ *
+ * @param [in] window The target window, clicks outside of it are refused.
+ * None for any window.
+ * @return The mouse of the target.
  */
-void
-Mouse_Initialize(void);
+Pointer *
+Mouse_Initialize(Window window);
 
 /**
  * @brief Deinitialize the mouse moving component.
  *
- * Free used system resources.
+ * Free used system resources, the X connection is closed together with
+ * the last target.
+ *
+ * @param [in] pointer The mouse of the target, not valid after the call.
  */
 void
-Mouse_Deinitialize(void);
+Mouse_Deinitialize(Pointer *pointer);
+
+/**
+ * @brief Select how the pointer is moved and clicked.
+ *
+ * The default is MOUSE_EVENTS. MOUSE_XTEST falls back to it if the X
+ * server doesn't have the XTEST extension.
+ *
+ * @param [in] selected MOUSE_EVENTS or MOUSE_XTEST, for every target.
+ * @return The backend in use.
+ * @attention A successful call to Mouse_Initialize() has to be performed
+ * before a call to this function.
+ */
+int
+Mouse_SetBackend(int selected);
 
 /**
  * @brief Simulate a mouse click.
  * 
  * The function simulates that a mouse button has been pressed and
- * released.
+ * released. Nothing is clicked if the pointer isn't over the target
+ * window, it may have been covered by another one.
  * 
+ * @param [in] pointer The mouse of the target.
  * @param [in] button The button id to simluate (Button1 etc.).
  * @attention A successful call to Mouse_Initialize() has to be performed
  * before a call to this function.
  */
 void
-Mouse_Click(int button);
+Mouse_Click(const Pointer *pointer, int button);
 
 /**
  * @brief Retrieve current mouse pointer coordinates.
  * 
  * This function retrieves the current position of the mouse pointer.
  * 
+ * @param [in] pointer The mouse of the target.
  * @param [out] x The current absolute x-coordinate of the mouse pointer.
  * @param [out] y The current absolute y-coordinate of the mouse pointer.
  * @attention A successful call to Mouse_Initialize() has to be performed
  * before a call to this function.
  */
 void
-Mouse_GetCoords(int *x, int *y);
+Mouse_GetCoords(const Pointer *pointer, int *x, int *y);
 
 /**
  * @brief Simulate an instant mouse movement to the desired location.
  * 
  * This function sets position of the mouse pointer instantly.
  * 
+ * @param [in] pointer The mouse of the target.
  * @param [in] x The absolute x-coordinate of the desired location.
  * @param [in] y the absolute y-coordinate of the desired location.
  * @attention A successful call to Mouse_Initialize() has to be performed
  * before a call to this function.
  */
 void
-Mouse_SetCoords(int x, int y);
+Mouse_SetCoords(const Pointer *pointer, int x, int y);
+
+/**
+ * @brief Simulate a mouse movement followed by a click.
+ *
+ * Same as Mouse_SetCoords() and Mouse_Click(), but with MOUSE_XTEST the
+ * move, press and release go to the X server in one flush.
+ *
+ * @param [in] pointer The mouse of the target.
+ * @param [in] x The absolute x-coordinate of the desired location.
+ * @param [in] y the absolute y-coordinate of the desired location.
+ * @param [in] button The button id to simluate (Button1 etc.).
+ * @attention A successful call to Mouse_Initialize() has to be performed
+ * before a call to this function.
+ */
+void
+Mouse_ClickAt(const Pointer *pointer, int x, int y, int button);
 
 #endif
@@ -0,0 +1,398 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file pack.cpp
+ * The template pack component stores the decoded templates, and every
+ * preprocessed form of them, in one file. A pack starts with a header,
+ * followed by a table of templates and a table of images. The pixels of
+ * every image start on a PACK_ALIGN byte boundary and every row on a
+ * PACK_STEP byte boundary, hence they can be used by SIMD code right from
+ * the memory mapping. Nothing is decoded or copied at startup.
+ * @par More info about the used techniques:
+ * - http://en.wikipedia.org/wiki/Mmap
+ * - http://en.wikipedia.org/wiki/Data_structure_alignment
+ *
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The template pack component implementation.
+ */
+
+// C++ Standard Library headers
+#include <iostream>
+
+// C++ (C Standard Library) headers
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+// POSIX headers
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// OpenCV headers
+#include <opencv/highgui.h>
+
+// Local C++ headers
+#include "match.hpp"
+#include "pack.hpp"
+
+/**
+ * @brief The first bytes of a pack.
+ */
+static const char Pack_Magic[8] = "GRPACK";
+
+/**
+ * @brief The start of a pack.
+ */
+struct Pack_Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t templates; ///< Number of templates in the template table
+	uint32_t images; ///< Number of images in the image table
+	uint32_t reserved;
+	uint64_t size; ///< The whole pack, a truncated pack is refused
+};
+
+/**
+ * @brief A template in the template table.
+ */
+struct Pack_Template
+{
+	char name[48]; ///< Zero terminated
+	uint32_t first; ///< The first image in the image table
+	uint32_t images; ///< Number of images, every form and pyramid level
+	uint64_t reserved;
+};
+
+/**
+ * @brief An image in the image table.
+ */
+struct Pack_Image
+{
+	uint32_t kind; ///< Pack::Kind
+	uint32_t level; ///< The pyramid level, 0 is the template itself
+	uint32_t rows;
+	uint32_t cols;
+	uint32_t channels;
+	uint32_t step; ///< Bytes per row, including the padding
+	uint64_t offset; ///< Where the pixels are, from the start of the pack
+};
+
+/**
+ * @brief Round up to a multiple of an alignment.
+ * @param [in] size The size.
+ * @param [in] align The alignment, a power of two.
+ * @return The aligned size.
+ */
+static size_t
+align(size_t size, size_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+/**
+ * @brief Write bytes to a file.
+ * @param [in] file The file.
+ * @param [in] data The bytes.
+ * @param [in] size The number of bytes, may be 0.
+ * @return If all bytes were written.
+ */
+static bool
+put(FILE *file, const void *data, size_t size)
+{
+	return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+Pack::Pack(void) : map(NULL), size(0)
+{
+}
+
+Pack::~Pack(void)
+{
+	close();
+}
+
+void
+Pack::close(void)
+{
+	if (map)
+	{
+		munmap(const_cast<char *>(map), size);
+		map = NULL;
+		size = 0;
+	}
+}
+
+bool
+Pack::open(const char *filename)
+{
+	assert(filename);
+	close();
+
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		std::cerr << "Pack: Unable to open " << filename << std::endl;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof (Pack_Header))
+	{
+		std::cerr << "Pack: " << filename << " is not a template pack" << std::endl;
+		::close(fd);
+		return false;
+	}
+
+	// The mapping outlives the descriptor
+	size = st.st_size;
+	void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	assert(p != MAP_FAILED);
+	map = static_cast<const char *>(p);
+
+	// Check everything once, the lookups can trust the tables
+	const Pack_Header *header = reinterpret_cast<const Pack_Header *>(map);
+	if (memcmp(header->magic, Pack_Magic, sizeof (header->magic)) != 0 || header->size != size)
+	{
+		std::cerr << "Pack: " << filename << " is not a template pack" << std::endl;
+		close();
+		return false;
+	}
+
+	if (header->version != PACK_VERSION)
+	{
+		std::cerr << "Pack: " << filename << " is version " << header->version << ", run grorld_pack again" << std::endl;
+		close();
+		return false;
+	}
+
+	const size_t tables = align(sizeof (Pack_Header), PACK_ALIGN) + header->templates * sizeof (Pack_Template) + header->images * sizeof (Pack_Image);
+	bool valid = tables <= size;
+
+	const Pack_Template *templates = reinterpret_cast<const Pack_Template *>(map + align(sizeof (Pack_Header), PACK_ALIGN));
+	for (uint32_t i = 0; valid && i < header->templates; ++i)
+	{
+		valid = templates[i].name[sizeof (templates[i].name) - 1] == '\0' && templates[i].first + (uint64_t)templates[i].images <= header->images;
+	}
+
+	const Pack_Image *images = reinterpret_cast<const Pack_Image *>(templates + header->templates);
+	for (uint32_t i = 0; valid && i < header->images; ++i)
+	{
+		const Pack_Image &image = images[i];
+		valid = (image.channels == 1 || image.channels == 3) && image.step >= (uint64_t)image.cols * image.channels
+			&& image.offset % PACK_ALIGN == 0 && image.offset >= tables && image.offset + (uint64_t)image.step * image.rows <= size;
+	}
+
+	if (!valid)
+	{
+		std::cerr << "Pack: " << filename << " is damaged" << std::endl;
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+cv::Mat
+Pack::templ(const char *name, std::vector<cv::Mat> *pyramid) const
+{
+#ifndef COLOR
+	return lookup(name, GREY, pyramid);
+#else
+	return lookup(name, BGR, pyramid);
+#endif
+}
+
+cv::Mat
+Pack::colour(const char *name) const
+{
+	return lookup(name, BGR, NULL);
+}
+
+/**
+ * @brief Find one form of a template.
+ * @param [in] name The name of the template.
+ * @param [in] kind The form.
+ * @param [out] pyramid The levels of the form, NULL if they are not wanted.
+ * @return The template image, empty if there is no such template.
+ */
+cv::Mat
+Pack::lookup(const char *name, Kind kind, std::vector<cv::Mat> *pyramid) const
+{
+	assert(map);
+	assert(name);
+
+	const Pack_Header *header = reinterpret_cast<const Pack_Header *>(map);
+	const Pack_Template *templates = reinterpret_cast<const Pack_Template *>(map + align(sizeof (Pack_Header), PACK_ALIGN));
+	const Pack_Image *images = reinterpret_cast<const Pack_Image *>(templates + header->templates);
+
+	if (pyramid)
+	{
+		pyramid->clear();
+	}
+
+	for (uint32_t i = 0; i < header->templates; ++i)
+	{
+		if (strcmp(templates[i].name, name) != 0)
+		{
+			continue;
+		}
+
+		// The levels of every form are stored in order
+		cv::Mat templ;
+		for (uint32_t j = templates[i].first; j < templates[i].first + templates[i].images; ++j)
+		{
+			const Pack_Image &image = images[j];
+			if (image.kind != kind)
+			{
+				continue;
+			}
+
+			cv::Mat level(image.rows, image.cols, CV_8UC(image.channels), const_cast<char *>(map + image.offset), image.step);
+			if (image.level == 0)
+			{
+				templ = level;
+			}
+			if (pyramid)
+			{
+				pyramid->push_back(level);
+			}
+		}
+
+		return templ;
+	}
+
+	std::cerr << "Pack: No template named " << name << std::endl;
+	return cv::Mat();
+}
+
+bool
+Pack::write(const char *filename, const std::vector<std::string> &files)
+{
+	assert(filename);
+
+	// Decode and preprocess everything first, nothing is written for a broken image
+	std::vector<Pack_Template> templates;
+	std::vector<Pack_Image> images;
+	std::vector<cv::Mat> pixels;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		// The name is the file name, without directory and extension
+		std::string name = files[i].substr(files[i].find_last_of('/') + 1);
+		name = name.substr(0, name.find_last_of('.'));
+
+		Pack_Template templ;
+		memset(&templ, 0, sizeof (templ));
+		if (name.empty() || name.size() >= sizeof (templ.name))
+		{
+			std::cerr << "Pack: Bad template name " << files[i] << std::endl;
+			return false;
+		}
+		strcpy(templ.name, name.c_str());
+		templ.first = images.size();
+
+		const cv::Mat forms[] = {cv::imread(files[i], 0), cv::imread(files[i])};
+		for (uint32_t kind = GREY; kind <= BGR; ++kind)
+		{
+			if (forms[kind].empty())
+			{
+				std::cerr << "Pack: Unable to load " << files[i] << std::endl;
+				return false;
+			}
+
+			const std::vector<cv::Mat> pyramid = Match::downsample(forms[kind]);
+			for (size_t level = 0; level < pyramid.size(); ++level)
+			{
+				Pack_Image image;
+				memset(&image, 0, sizeof (image));
+				image.kind = kind;
+				image.level = level;
+				image.rows = pyramid[level].rows;
+				image.cols = pyramid[level].cols;
+				image.channels = pyramid[level].channels();
+				image.step = align(image.cols * image.channels, PACK_STEP);
+				images.push_back(image);
+				pixels.push_back(pyramid[level]);
+			}
+		}
+
+		templ.images = images.size() - templ.first;
+		templates.push_back(templ);
+	}
+
+	// Lay out the pixels after the tables
+	size_t offset = align(sizeof (Pack_Header), PACK_ALIGN) + templates.size() * sizeof (Pack_Template) + images.size() * sizeof (Pack_Image);
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		images[i].offset = offset = align(offset, PACK_ALIGN);
+		offset += (size_t)images[i].step * images[i].rows;
+	}
+
+	Pack_Header header;
+	memset(&header, 0, sizeof (header));
+	memcpy(header.magic, Pack_Magic, sizeof (header.magic));
+	header.version = PACK_VERSION;
+	header.templates = templates.size();
+	header.images = images.size();
+	header.size = offset;
+
+	FILE *file = fopen(filename, "wb");
+	if (!file)
+	{
+		std::cerr << "Pack: Unable to create " << filename << std::endl;
+		return false;
+	}
+
+	// The padding is written as zeroes
+	static const char padding[PACK_ALIGN] = {0};
+	size_t at = align(sizeof (header), PACK_ALIGN) + templates.size() * sizeof (Pack_Template) + images.size() * sizeof (Pack_Image);
+	bool ok = put(file, &header, sizeof (header));
+	ok = ok && put(file, padding, align(sizeof (header), PACK_ALIGN) - sizeof (header));
+	ok = ok && put(file, templates.data(), templates.size() * sizeof (Pack_Template));
+	ok = ok && put(file, images.data(), images.size() * sizeof (Pack_Image));
+
+	for (size_t i = 0; ok && i < images.size(); ++i)
+	{
+		ok = put(file, padding, images[i].offset - at);
+		for (uint32_t y = 0; ok && y < images[i].rows; ++y)
+		{
+			const size_t row = images[i].cols * images[i].channels;
+			ok = put(file, pixels[i].ptr(y), row) && put(file, padding, images[i].step - row);
+		}
+		at = images[i].offset + (size_t)images[i].step * images[i].rows;
+	}
+
+	if (fclose(file) != 0 || !ok)
+	{
+		std::cerr << "Pack: Unable to write " << filename << std::endl;
+		remove(filename);
+		return false;
+	}
+
+	std::cout << "Pack: " << filename << ", " << templates.size() << " template(s), " << offset << " bytes" << std::endl;
+	return true;
+}
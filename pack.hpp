@@ -0,0 +1,142 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file pack.hpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The template pack component API.
+ */
+
+#ifndef __PACK_H__
+#define __PACK_H__
+
+// C++ Standard Library headers
+#include <string>
+#include <vector>
+
+// OpenCV headers
+#include <opencv/cv.h>
+
+/**
+ * @def PACK_VERSION
+ * @brief The version of the pack format, packs of other versions are refused.
+ */
+#define PACK_VERSION 1
+
+/**
+ * @def PACK_ALIGN
+ * @brief The alignment (in bytes) of every image in a pack.
+ */
+#define PACK_ALIGN 64
+
+/**
+ * @def PACK_STEP
+ * @brief The alignment (in bytes) of every image row in a pack.
+ */
+#define PACK_STEP 16
+
+/**
+ * @class Pack
+ * @brief A pack of preprocessed template images.
+ *
+ * The templates are decoded and preprocessed once by grorld_pack, every
+ * form of them that the matching needs is stored in the pack. The pack
+ * is memory mapped, the images are used right from the mapping.
+ * @par More info here:
+ * - http://en.wikipedia.org/wiki/Mmap
+ */
+class Pack
+{
+public:
+	/**
+	 * @brief The stored forms of a template.
+	 */
+	enum Kind
+	{
+		GREY, ///< As loaded by Match::loadTemplate() without COLOR
+		BGR ///< As loaded by Match::loadTemplate() with COLOR
+	};
+
+	Pack(void);
+	~Pack(void);
+
+	/**
+	 * @brief Map a pack.
+	 *
+	 * @param [in] filename The pack, from grorld_pack.
+	 * @return If the pack could be mapped, it's valid and of the right version.
+	 */
+	bool
+	open(const char *filename);
+
+	/**
+	 * @brief Retrieve a template, in the form the matching uses.
+	 *
+	 * The images point right into the mapping, they are valid for as long
+	 * as the pack is and must not be written to.
+	 *
+	 * @param [in] name The name of the template, its file name without
+	 * directory and extension.
+	 * @param [out] pyramid The downsampled versions of the template, like
+	 * Match::downsample() makes them. NULL if they are not wanted.
+	 * @return The template image, empty if there is no such template.
+	 */
+	cv::Mat
+	templ(const char *name, std::vector<cv::Mat> *pyramid = NULL) const;
+
+	/**
+	 * @brief Retrieve the colour form of a template.
+	 *
+	 * For keying the template on its colours, also when the matching
+	 * works in grey scale.
+	 *
+	 * @param [in] name The name of the template.
+	 * @return The BGR template image, empty if there is no such template.
+	 * @see Match::setKey()
+	 */
+	cv::Mat
+	colour(const char *name) const;
+
+	/**
+	 * @brief Write a pack.
+	 *
+	 * Decodes the template images and stores every form of them.
+	 *
+	 * @param [in] filename The pack, an existing file is replaced.
+	 * @param [in] files The template images.
+	 * @return If the pack could be written.
+	 */
+	static bool
+	write(const char *filename, const std::vector<std::string> &files);
+
+private:
+	void
+	close(void);
+
+	cv::Mat
+	lookup(const char *name, Kind kind, std::vector<cv::Mat> *pyramid) const;
+
+	const char *map;
+	size_t size;
+};
+
+#endif
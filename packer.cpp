@@ -0,0 +1,95 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file packer.cpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief Grorld template packer application
+ *
+ * Decodes the template images once and writes them, with every form of
+ * them that the matching needs, into a template pack (see pack.hpp).
+ * Grorld maps the pack at startup instead of decoding the images.
+ *
+ * @par Usage:
+ * - Use the command "./grorld_pack assets/bonus.png assets/city.png"
+ * from the source directory to write assets/grorld.pack.
+ * - Use "-o FILE" to write the pack somewhere else.
+ * - Run it again whenever a template changes, or when Grorld refuses the
+ * pack because of its version.
+ */
+
+// C++ Standard Library headers
+#include <iostream>
+#include <string>
+#include <vector>
+
+// C++ (C Standard Library) headers
+#include <cstdlib>
+
+// POSIX headers
+#include <unistd.h>
+
+// Local C++ headers
+#include "pack.hpp"
+
+/**
+ * @brief Print the command line options.
+ * @param [in] name The name of the executable.
+ */
+static void
+usage(const char *name)
+{
+	std::cerr << "Usage: " << name << " [-o pack] image..." << std::endl;
+	std::cerr << "  -o  the pack to write (default: assets/grorld.pack)" << std::endl;
+}
+
+/**
+ * @brief Grorld template packer entry point
+ */
+int main(int argc, char **argv)
+{
+	const char *output = "assets/grorld.pack";
+	int option;
+	while ((option = getopt(argc, argv, "o:")) != -1)
+	{
+		switch (option)
+		{
+		case 'o':
+			output = optarg;
+			break;
+
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (optind >= argc)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const std::vector<std::string> files(argv + optind, argv + argc);
+
+	return Pack::write(output, files) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,252 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file pipeline.cpp
+ * The frame pipeline component has one thread per stage, connected by
+ * single producer, single consumer queues of frame buffer numbers.
+ * @par More info about the used library:
+ * - http://en.wikipedia.org/wiki/C%2B%2B0x#Threading_facilities
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The frame pipeline component implementation.
+ */
+
+// C++ Standard Library headers
+#include <thread>
+
+// C++ (C Standard Library) headers
+#include <cassert>
+
+// Local C headers
+extern "C"
+{
+#include "timer.h"
+}
+
+// Local C++ headers
+#include "pipeline.hpp"
+
+/**
+ * @def PIPELINE_IDLE
+ * @brief The time (in microseconds) a stage waits before polling its queue again.
+ */
+#define PIPELINE_IDLE 200
+
+/**
+ * @brief Wait a moment for the neighbouring stage.
+ */
+static void
+idle(void)
+{
+	struct timespec delay;
+	delay.tv_sec = 0;
+	delay.tv_nsec = PIPELINE_IDLE * 1000l;
+	clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, NULL);
+}
+
+/**
+ * @brief Check if a timespec value is earlier than another.
+ * @param [in] ts1 The first time.
+ * @param [in] ts2 The second time.
+ * @return If ts1 is earlier than ts2.
+ */
+static bool
+earlier(const struct timespec &ts1, const struct timespec &ts2)
+{
+	return ts1.tv_sec < ts2.tv_sec || (ts1.tv_sec == ts2.tv_sec && ts1.tv_nsec < ts2.tv_nsec);
+}
+
+Pipeline::Pipeline(Capture *window, Stats &stats) : window(window), stats(stats)
+{
+	assert(window);
+
+	const int count = Screen_AllocateBuffers(window, SCREEN_BUFFERS);
+	for (int i = 0; i < count; ++i)
+	{
+		matchers.push_back(std::unique_ptr<Match>(new Match(Screen_Buffer(window, i))));
+
+		bool res = vacant.push(i);
+		assert(res);
+	}
+}
+
+Pipeline::~Pipeline(void)
+{
+}
+
+int
+Pipeline::size(void) const
+{
+	return matchers.size();
+}
+
+Match &
+Pipeline::matcher(int index)
+{
+	assert(index >= 0 && index < size());
+
+	return *matchers[index];
+}
+
+void
+Pipeline::run(Detect detect, Act act, Rest rest)
+{
+	std::thread capturing(&Pipeline::capture, this, rest);
+	std::thread converting(&Pipeline::convert, this);
+	std::thread searching(&Pipeline::search, this, detect);
+
+	struct timespec acted;
+	clock_gettime(CLOCK_MONOTONIC, &acted);
+
+	while (true)
+	{
+		// Only the newest hit is interesting...
+		Hit hit, newest;
+		while (hits.pop(hit))
+		{
+			newest = hit;
+		}
+
+		// ...and only if the frame was grabbed after the last action
+		if (newest.what == Hit::NONE || earlier(newest.captured, acted))
+		{
+			idle();
+			continue;
+		}
+
+		act(newest);
+		clock_gettime(CLOCK_MONOTONIC, &acted);
+	}
+}
+
+/**
+ * @brief The capture stage, grabs frames into free buffers.
+ * @param [in] rest Paces the frame grabbing.
+ */
+void
+Pipeline::capture(Rest rest)
+{
+	while (true)
+	{
+		// Nothing to grab while the window is minimized or covered
+		long long t = timer_now();
+		if (!Screen_Visible(window))
+		{
+			Screen_WaitVisible(window);
+			t = stats.lap(Stats::SLEEP, t);
+		}
+
+		int index;
+		if (!vacant.pop(index))
+		{
+			do
+			{
+				idle();
+			}
+			while (!vacant.pop(index));
+			t = stats.lap(Stats::WAIT, t);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &captured[index]);
+		Screen_GetInto(window, index);
+		matchers[index]->setImage(Screen_Buffer(window, index));
+		t = stats.lap(Stats::GRAB, t);
+
+		// The window moves with the events of this thread, the hit takes the geometry along through the queues
+		origins[index] = cv::Point(0, 0);
+		Screen_TranslateCoordinates(window, &origins[index].x, &origins[index].y);
+
+		bool res = grabbed.push(index);
+		assert(res);
+
+		// Give the computer some time to rest before grabbing the next frame
+		struct timespec sleep = millis_to_timespec(rest());
+		clock_nanosleep(CLOCK_MONOTONIC, 0, &sleep, NULL);
+		stats.lap(Stats::SLEEP, t);
+	}
+}
+
+/**
+ * @brief The conversion stage, prepares the matcher of grabbed frames.
+ */
+void
+Pipeline::convert(void)
+{
+	while (true)
+	{
+		int index;
+		long long t = timer_now();
+		if (!grabbed.pop(index))
+		{
+			do
+			{
+				idle();
+			}
+			while (!grabbed.pop(index));
+			t = stats.lap(Stats::WAIT, t);
+		}
+
+		matchers[index]->prepare();
+		stats.lap(Stats::PREPARE, t);
+
+		bool res = prepared.push(index);
+		assert(res);
+	}
+}
+
+/**
+ * @brief The matching stage, searches prepared frames and passes on the hits.
+ * @param [in] detect Searches a frame.
+ */
+void
+Pipeline::search(Detect detect)
+{
+	while (true)
+	{
+		int index;
+		long long t = timer_now();
+		if (!prepared.pop(index))
+		{
+			do
+			{
+				idle();
+			}
+			while (!prepared.pop(index));
+			t = stats.lap(Stats::WAIT, t);
+		}
+
+		Hit hit = detect(*matchers[index]);
+		hit.captured = captured[index];
+		hit.origin = origins[index];
+		stats.lap(Stats::MATCH, t);
+		stats.frame();
+
+		// The buffer is free to be grabbed into again
+		bool res = vacant.push(index);
+		assert(res);
+
+		// If the actions lag behind the queue fills up, those hits would be stale anyway
+		if (hit.what != Hit::NONE)
+		{
+			hits.push(hit);
+		}
+	}
+}
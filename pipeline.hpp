@@ -0,0 +1,165 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file pipeline.hpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The frame pipeline component API.
+ */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+// C++ Standard Library headers
+#include <functional>
+#include <memory>
+#include <vector>
+
+// C Standard Library headers
+#include <time.h>
+
+// Local C headers
+extern "C"
+{
+#include "screen.h"
+}
+
+// Local C++ headers
+#include "match.hpp"
+#include "spsc.hpp"
+#include "stats.hpp"
+
+/**
+ * @def PIPELINE_STOPS
+ * @brief The most places one hit sends the mouse to.
+ */
+#define PIPELINE_STOPS 8
+
+/**
+ * @brief Something found on a frame that calls for an action.
+ */
+struct Hit
+{
+	static const int NONE = -1;
+
+	Hit(void) : what(NONE), score(0), stops(0) {}
+
+	int what; ///< The rule that was a hit, NONE if nothing
+	cv::Point position; ///< Location on the frame
+	cv::Size size; ///< The size of what was found, at the zoom of the game
+	double score; ///< The matching score
+	cv::Point route[PIPELINE_STOPS]; ///< Every location on the frame, best first
+	int stops; ///< The number of locations in route, at least 1 for a hit
+	struct timespec captured; ///< When the frame was grabbed (CLOCK_MONOTONIC)
+	cv::Point origin; ///< Where the top left corner of the frame was on the screen when it was grabbed
+};
+
+/**
+ * @class Pipeline
+ * @brief Runs capture, conversion, matching and actions on separate threads.
+ *
+ * Every stage works on its own frame buffer, the buffers rotate between
+ * the stages through lock-free queues. Hence the frame rate is bounded by
+ * the slowest stage instead of the sum of all stages. The actions always
+ * use the newest hit, hits from frames grabbed before the last action are
+ * dropped.
+ * @par More info here:
+ * - http://en.wikipedia.org/wiki/Pipeline_(computing)
+ */
+class Pipeline
+{
+public:
+	/**
+	 * @brief Searches a prepared frame, runs on the matching thread.
+	 */
+	typedef std::function<Hit(Match &)> Detect;
+
+	/**
+	 * @brief Acts on a hit, runs on the thread calling run().
+	 */
+	typedef std::function<void(const Hit &)> Act;
+
+	/**
+	 * @brief The time (in milliseconds) to rest between two frame grabs.
+	 */
+	typedef std::function<long(void)> Rest;
+
+	/**
+	 * @brief Constructor.
+	 *
+	 * Allocates SCREEN_BUFFERS frame buffers and a matcher for each one.
+	 *
+	 * @param [in,out] window The captured window.
+	 * @param [in,out] stats Times the stages, and the waiting between them.
+	 * @attention XInitThreads() has to be called before any other Xlib call.
+	 */
+	Pipeline(Capture *window, Stats &stats);
+	~Pipeline(void);
+
+	/**
+	 * @brief The number of frame buffers (and matchers).
+	 * @return The number of frame buffers.
+	 */
+	int
+	size(void) const;
+
+	/**
+	 * @brief Retrieve the matcher of a frame buffer, to configure it.
+	 * @param [in] index The frame buffer number.
+	 * @return The matcher.
+	 */
+	Match &
+	matcher(int index);
+
+	/**
+	 * @brief Starts the stage threads and acts on the hits.
+	 *
+	 * @param [in] detect Searches a frame.
+	 * @param [in] act Acts on the newest hit.
+	 * @param [in] rest Paces the frame grabbing.
+	 * @attention Never returns, just like the main loop.
+	 */
+	void
+	run(Detect detect, Act act, Rest rest);
+
+private:
+	void
+	capture(Rest rest);
+
+	void
+	convert(void);
+
+	void
+	search(Detect detect);
+
+	Capture *window;
+	Stats &stats;
+	std::vector<std::unique_ptr<Match> > matchers;
+	struct timespec captured[SCREEN_BUFFERS];
+	cv::Point origins[SCREEN_BUFFERS];
+
+	Spsc<int, SCREEN_BUFFERS + 1> vacant;
+	Spsc<int, SCREEN_BUFFERS + 1> grabbed;
+	Spsc<int, SCREEN_BUFFERS + 1> prepared;
+	Spsc<Hit, 64> hits;
+};
+
+#endif
@@ -0,0 +1,214 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file pool.cpp
+ * The thread pool component uses the C++0x thread library.
+ * @par More info about the used library:
+ * - http://en.wikipedia.org/wiki/C%2B%2B0x#Threading_facilities
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The thread pool component implementation.
+ */
+
+// C++ Standard Library headers
+#include <algorithm>
+
+// C++ (C Standard Library) headers
+#include <cassert>
+
+// Local C++ headers
+#include "pool.hpp"
+
+Pool::Pool(int threads) : batch(NULL), remaining(0), generation(0), quit(false)
+{
+	assert(threads >= 0);
+
+	if (threads == 0)
+	{
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// Queue 0 belongs to the calling thread
+	for (int i = 0; i < threads; ++i)
+	{
+		queues.push_back(std::unique_ptr<Queue>(new Queue()));
+	}
+
+	for (int i = 1; i < threads; ++i)
+	{
+		this->threads.push_back(std::thread(&Pool::work, this, i));
+	}
+}
+
+Pool::~Pool(void)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (size_t i = 0; i < threads.size(); ++i)
+	{
+		threads[i].join();
+	}
+}
+
+int
+Pool::size(void) const
+{
+	return queues.size();
+}
+
+void
+Pool::run(const std::vector<std::function<void(void)> > &tasks)
+{
+	if (tasks.empty())
+	{
+		return;
+	}
+
+	// No workers, no need for the bookkeeping
+	if (threads.empty())
+	{
+		for (size_t i = 0; i < tasks.size(); ++i)
+		{
+			tasks[i]();
+		}
+		return;
+	}
+
+	// One batch at a time, the bookkeeping is shared
+	std::lock_guard<std::mutex> turn(serial);
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		batch = &tasks;
+		remaining = tasks.size();
+	}
+
+	// Deal the tasks round robin, the stealing evens out the rest
+	for (size_t i = 0; i < tasks.size(); ++i)
+	{
+		Queue &queue = *queues[i % queues.size()];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (queue.head == queue.tasks.size())
+		{
+			queue.tasks.clear();
+			queue.head = 0;
+		}
+		queue.tasks.push_back(i);
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		++generation;
+	}
+	wake.notify_all();
+
+	// Lend a hand, then wait for the stragglers
+	while (execute(0))
+	{
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+	while (remaining > 0)
+	{
+		done.wait(guard);
+	}
+	batch = NULL;
+}
+
+void
+Pool::work(int id)
+{
+	unsigned long seen = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			while (!quit && generation == seen)
+			{
+				wake.wait(guard);
+			}
+			if (quit)
+			{
+				return;
+			}
+			seen = generation;
+		}
+
+		while (execute(id))
+		{
+		}
+	}
+}
+
+/**
+ * @brief Run one task, from the own queue or stolen from another.
+ * @param [in] id The queue of the calling thread.
+ * @return If a task was run.
+ */
+bool
+Pool::execute(int id)
+{
+	size_t task = 0;
+	bool found = false;
+
+	// Newest work from the own queue is still warm in the cache...
+	{
+		Queue &queue = *queues[id];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (queue.head < queue.tasks.size())
+		{
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	// ...otherwise steal the oldest work from someone else
+	for (size_t i = 1; !found && i < queues.size(); ++i)
+	{
+		Queue &queue = *queues[(id + i) % queues.size()];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if (queue.head < queue.tasks.size())
+		{
+			task = queue.tasks[queue.head++];
+			found = true;
+		}
+	}
+
+	if (!found)
+	{
+		return false;
+	}
+
+	(*batch)[task]();
+
+	if (--remaining == 0)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done.notify_all();
+	}
+
+	return true;
+}
@@ -0,0 +1,117 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file pool.hpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The thread pool component API.
+ */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+// C++ Standard Library headers
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @class Pool
+ * @brief A persistent work-stealing thread pool.
+ *
+ * Every thread has its own queue of tasks. A thread takes tasks from the
+ * back of its own queue and, when that runs dry, steals from the front of
+ * the other queues. The calling thread takes part in the work.
+ * @par More info here:
+ * - http://en.wikipedia.org/wiki/Work_stealing
+ */
+class Pool
+{
+public:
+	/**
+	 * @brief Constructor.
+	 *
+	 * Starts the worker threads, they are kept until the pool is destroyed.
+	 *
+	 * @param [in] threads The number of threads including the caller,
+	 * 0 means one per CPU core.
+	 */
+	Pool(int threads);
+	~Pool(void);
+
+	/**
+	 * @brief The number of threads including the caller.
+	 * @return The number of threads.
+	 */
+	int
+	size(void) const;
+
+	/**
+	 * @brief Run a batch of tasks and wait for all of them to finish.
+	 *
+	 * Several threads may share the pool, their batches run one at a time.
+	 * A task must not run a batch of its own.
+	 *
+	 * @param [in] tasks The tasks, they may run in any order.
+	 */
+	void
+	run(const std::vector<std::function<void(void)> > &tasks);
+
+private:
+	/**
+	 * @brief A queue of task indices.
+	 *
+	 * The owner works at the back, thieves take from the head. The memory
+	 * is kept when the queue runs dry, the next batch doesn't allocate.
+	 */
+	struct Queue
+	{
+		Queue(void) : head(0) {}
+
+		std::mutex lock;
+		std::vector<size_t> tasks;
+		size_t head; ///< The oldest task not yet taken
+	};
+
+	void
+	work(int id);
+
+	bool
+	execute(int id);
+
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<Queue> > queues;
+	const std::vector<std::function<void(void)> > *batch;
+	std::atomic<size_t> remaining;
+	std::mutex serial;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable done;
+	unsigned long generation;
+	bool quit;
+};
+
+#endif
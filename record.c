@@ -0,0 +1,601 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file record.c
+ * The capture log component writes the captured frames to a file and
+ * plays them back later, without an X server. A log starts with the
+ * image layout, followed by one record per frame. Each record holds the
+ * capture time, the window position, the damaged rectangles and bands
+ * of changed rows. Every RECORD_KEYFRAME frames all rows are stored.
+ * The row data is aligned to RECORD_ALIGN bytes in the file, hence the
+ * complete frames can be used right from the memory mapping.
+ * @par More info about the used techniques:
+ * - http://en.wikipedia.org/wiki/Delta_encoding
+ * - http://en.wikipedia.org/wiki/Mmap
+ *
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The capture log component implementation.
+ */
+
+// C Standard Library headers
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// POSIX headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Xlib headers
+#include <X11/Xutil.h>
+
+// Local C headers
+#include "record.h"
+
+/**
+ * @def RECORD_ALIGN
+ * @brief The alignment (in bytes) of the headers and row data in a capture log.
+ */
+#define RECORD_ALIGN 64
+
+/**
+ * @def RECORD_KEY
+ * @brief Frame flag, the frame holds all rows.
+ */
+#define RECORD_KEY 1
+
+/**
+ * @brief The first bytes of a capture log, version 1.
+ */
+static const char Record_Magic[8] = "GRORLD1";
+
+/**
+ * @brief The image layout, at the start of a capture log.
+ */
+struct Record_Header
+{
+	char magic[8];
+	int32_t width;
+	int32_t height;
+	int32_t depth;
+	int32_t bits_per_pixel;
+	int32_t bytes_per_line;
+	int32_t byte_order;
+	uint32_t red_mask;
+	uint32_t green_mask;
+	uint32_t blue_mask;
+	uint32_t reserved;
+};
+
+/**
+ * @brief The start of a frame record.
+ *
+ * Followed by the damaged rectangles, the bands and (aligned) the rows
+ * of every band.
+ */
+struct Record_Frame
+{
+	uint32_t flags;
+	uint32_t rects;
+	uint32_t bands;
+	int32_t x;
+	int32_t y;
+	uint32_t reserved;
+	int64_t sec;
+	int64_t nsec;
+	uint64_t size; ///< The whole record, including the padding
+};
+
+/**
+ * @brief A band of consecutive rows in a frame record.
+ */
+struct Record_Band
+{
+	uint32_t y;
+	uint32_t height;
+};
+
+static const char padding[RECORD_ALIGN];
+
+static FILE *file = NULL;
+static char *shadow = NULL;
+static unsigned char *changed = NULL;
+static struct Record_Band *bands = NULL;
+static long frames;
+
+static int fd = -1;
+static const char *map = NULL;
+static size_t map_size;
+static size_t offset;
+static XImage image;
+static char *frame = NULL;
+static int borrowed;
+static const XRectangle *damage;
+static int damage_count;
+static int position_x;
+static int position_y;
+static int pacing;
+static int started;
+static struct timespec start;
+static struct timespec first;
+
+/**
+ * @brief Round up to the next multiple of RECORD_ALIGN.
+ * @param [in] size A size or file offset.
+ * @return The aligned size.
+ */
+static size_t
+Record_Align(size_t size)
+{
+	return (size + RECORD_ALIGN - 1) & ~(size_t)(RECORD_ALIGN - 1);
+}
+
+/**
+ * @brief Write zeros up to the next multiple of RECORD_ALIGN.
+ * @param [in] size The number of bytes written since the last aligned offset.
+ */
+static void
+Record_Pad(size_t size)
+{
+	fwrite(padding, 1, Record_Align(size) - size, file);
+}
+
+int
+Record_Open(const char *filename, const XImage *img)
+{
+	assert(filename);
+	assert(img);
+	assert(!file);
+
+	file = fopen(filename, "wb");
+	if (!file)
+	{
+		fprintf(stderr, "Record: Unable to create %s\n", filename);
+		return 0;
+	}
+
+	struct Record_Header header;
+	memset(&header, 0, sizeof (header));
+	memcpy(header.magic, Record_Magic, sizeof (header.magic));
+	header.width = img->width;
+	header.height = img->height;
+	header.depth = img->depth;
+	header.bits_per_pixel = img->bits_per_pixel;
+	header.bytes_per_line = img->bytes_per_line;
+	header.byte_order = img->byte_order;
+	header.red_mask = img->red_mask;
+	header.green_mask = img->green_mask;
+	header.blue_mask = img->blue_mask;
+	fwrite(&header, sizeof (header), 1, file);
+	Record_Pad(sizeof (header));
+
+	shadow = malloc((size_t)img->bytes_per_line * img->height);
+	changed = malloc(img->height);
+	bands = malloc(img->height * sizeof (struct Record_Band));
+	assert(shadow && changed && bands);
+	frames = 0;
+
+	fprintf(stdout, "Record: %s\n", filename);
+	return 1;
+}
+
+void
+Record_Close(void)
+{
+	assert(file);
+
+	fclose(file);
+	file = NULL;
+
+	free(shadow);
+	free(changed);
+	free(bands);
+	shadow = NULL;
+	changed = NULL;
+	bands = NULL;
+}
+
+void
+Record_Frame(const XImage *img, const XRectangle *rects, int count, int x, int y)
+{
+	assert(file);
+	assert(img);
+	assert(count == 0 || rects);
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	const size_t stride = img->bytes_per_line;
+	int i, row, band_count = 0;
+	if (frames % RECORD_KEYFRAME == 0)
+	{
+		memcpy(shadow, img->data, stride * img->height);
+		bands[0].y = 0;
+		bands[0].height = img->height;
+		band_count = 1;
+	}
+	else
+	{
+		// Only the damaged rows can have changed...
+		memset(changed, 0, img->height);
+		for (i = 0; i < count; ++i)
+		{
+			memset(changed + rects[i].y, 1, rects[i].height);
+		}
+
+		// ...but a redrawn row often looks just like before
+		for (row = 0; row < img->height; ++row)
+		{
+			const char *line = img->data + row * stride;
+			if (changed[row] && memcmp(line, shadow + row * stride, stride) != 0)
+			{
+				memcpy(shadow + row * stride, line, stride);
+				if (band_count > 0 && bands[band_count - 1].y + bands[band_count - 1].height == (uint32_t)row)
+				{
+					++bands[band_count - 1].height;
+				}
+				else
+				{
+					bands[band_count].y = row;
+					bands[band_count].height = 1;
+					++band_count;
+				}
+			}
+		}
+	}
+
+	struct Record_Frame header;
+	memset(&header, 0, sizeof (header));
+	header.flags = frames % RECORD_KEYFRAME == 0 ? RECORD_KEY : 0;
+	header.rects = count;
+	header.bands = band_count;
+	header.x = x;
+	header.y = y;
+	header.sec = now.tv_sec;
+	header.nsec = now.tv_nsec;
+
+	const size_t head = sizeof (header) + count * sizeof (XRectangle) + band_count * sizeof (struct Record_Band);
+	header.size = Record_Align(head);
+	for (i = 0; i < band_count; ++i)
+	{
+		header.size += Record_Align(bands[i].height * stride);
+	}
+
+	fwrite(&header, sizeof (header), 1, file);
+	fwrite(rects, sizeof (XRectangle), count, file);
+	fwrite(bands, sizeof (struct Record_Band), band_count, file);
+	Record_Pad(head);
+	for (i = 0; i < band_count; ++i)
+	{
+		fwrite(img->data + bands[i].y * stride, stride, bands[i].height, file);
+		Record_Pad(bands[i].height * stride);
+	}
+
+	// Whatever happens to the application, the recorded frames are kept
+	fflush(file);
+	++frames;
+}
+
+/**
+ * @brief Check the image layout of a capture log.
+ * @param [in] header The header of the capture log.
+ * @return If the layout is one that Record_Open() could have written.
+ */
+static int
+Replay_Layout(const struct Record_Header *header)
+{
+	if (header->width <= 0 || header->height <= 0 || header->width > 32767 || header->height > 32767)
+	{
+		return 0;
+	}
+
+	if (header->bits_per_pixel != 8 && header->bits_per_pixel != 16 && header->bits_per_pixel != 24 && header->bits_per_pixel != 32)
+	{
+		return 0;
+	}
+
+	// The rows hold the whole width, and are no more than the alignment padded
+	const int64_t least = ((int64_t)header->width * header->bits_per_pixel + 7) / 8;
+	return header->bytes_per_line >= least && header->bytes_per_line <= least + RECORD_ALIGN;
+}
+
+XImage *
+Replay_Open(const char *filename, int paced)
+{
+	assert(filename);
+	assert(!map);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Replay: Unable to open %s\n", filename);
+		return NULL;
+	}
+
+	struct stat st;
+	struct Record_Header header;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof (header))
+	{
+		fprintf(stderr, "Replay: %s is not a capture log\n", filename);
+		close(fd);
+		return NULL;
+	}
+
+	map_size = st.st_size;
+	map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		fprintf(stderr, "Replay: Unable to map %s\n", filename);
+		map = NULL;
+		close(fd);
+		fd = -1;
+		return NULL;
+	}
+	madvise((void *)map, map_size, MADV_SEQUENTIAL);
+
+	memcpy(&header, map, sizeof (header));
+	if (memcmp(header.magic, Record_Magic, sizeof (header.magic)) != 0)
+	{
+		fprintf(stderr, "Replay: %s is not a capture log\n", filename);
+		Replay_Close();
+		return NULL;
+	}
+
+	// Every frame record is checked against this layout, it has to make sense itself
+	if (!Replay_Layout(&header) || Record_Align(sizeof (header)) > map_size)
+	{
+		fprintf(stderr, "Replay: %s has a corrupt header\n", filename);
+		Replay_Close();
+		return NULL;
+	}
+
+	memset(&image, 0, sizeof (image));
+	image.width = header.width;
+	image.height = header.height;
+	image.format = ZPixmap;
+	image.byte_order = header.byte_order;
+	image.bitmap_unit = 32;
+	image.bitmap_bit_order = header.byte_order;
+	image.bitmap_pad = 32;
+	image.depth = header.depth;
+	image.bits_per_pixel = header.bits_per_pixel;
+	image.bytes_per_line = header.bytes_per_line;
+	image.red_mask = header.red_mask;
+	image.green_mask = header.green_mask;
+	image.blue_mask = header.blue_mask;
+
+	if (XInitImage(&image) == 0)
+	{
+		fprintf(stderr, "Replay: %s has an image layout that Xlib doesn't know\n", filename);
+		Replay_Close();
+		return NULL;
+	}
+
+	frame = calloc((size_t)image.bytes_per_line, image.height);
+	assert(frame);
+	image.data = frame;
+	borrowed = 0;
+
+	offset = Record_Align(sizeof (header));
+	damage = NULL;
+	damage_count = 0;
+	position_x = position_y = 0;
+	pacing = paced;
+	started = 0;
+
+	fprintf(stdout, "Replay: %s, %dx%d\n", filename, image.width, image.height);
+	return &image;
+}
+
+void
+Replay_Close(void)
+{
+	assert(map);
+
+	munmap((void *)map, map_size);
+	close(fd);
+	map = NULL;
+	fd = -1;
+
+	free(frame);
+	frame = NULL;
+	image.data = NULL;
+}
+
+/**
+ * @brief Wait until the replayed frame is due.
+ * @param [in] recorded When the frame was captured.
+ */
+static void
+Replay_Pace(const struct timespec *recorded)
+{
+	if (!started)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		first = *recorded;
+		started = 1;
+		return;
+	}
+
+	struct timespec due;
+	due.tv_sec = start.tv_sec + (recorded->tv_sec - first.tv_sec);
+	due.tv_nsec = start.tv_nsec + (recorded->tv_nsec - first.tv_nsec);
+	while (due.tv_nsec < 0)
+	{
+		due.tv_nsec += 1000000000l;
+		--due.tv_sec;
+	}
+	while (due.tv_nsec >= 1000000000l)
+	{
+		due.tv_nsec -= 1000000000l;
+		++due.tv_sec;
+	}
+
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+}
+
+/**
+ * @brief Check a frame record against the replayed image.
+ *
+ * The rectangles, the bands and the rows of every band have to fit in
+ * the record, every band and rectangle in the image, and a complete frame
+ * has to be a single band of all rows.
+ *
+ * @param [in] header The start of the record.
+ * @param [in] record The record, header.size bytes.
+ * @return If the record can be replayed.
+ */
+static int
+Replay_Check(const struct Record_Frame *header, const char *record)
+{
+	const uint64_t stride = image.bytes_per_line;
+	if (header->size % RECORD_ALIGN != 0 || header->rects > header->size / sizeof (XRectangle) || header->bands > (uint32_t)image.height)
+	{
+		return 0;
+	}
+
+	uint64_t size = Record_Align(sizeof (*header) + (uint64_t)header->rects * sizeof (XRectangle) + (uint64_t)header->bands * sizeof (struct Record_Band));
+	if (size > header->size)
+	{
+		return 0;
+	}
+
+	const XRectangle *rects = (const XRectangle *)(record + sizeof (*header));
+	uint32_t i;
+	for (i = 0; i < header->rects; ++i)
+	{
+		if (rects[i].x < 0 || rects[i].y < 0 || rects[i].x + rects[i].width > image.width || rects[i].y + rects[i].height > image.height)
+		{
+			return 0;
+		}
+	}
+
+	const struct Record_Band *band = (const struct Record_Band *)(rects + header->rects);
+	for (i = 0; i < header->bands; ++i)
+	{
+		if (band[i].y > (uint32_t)image.height || band[i].height > (uint32_t)image.height - band[i].y)
+		{
+			return 0;
+		}
+		size += Record_Align(band[i].height * stride);
+	}
+	if (size > header->size)
+	{
+		return 0;
+	}
+
+	return !(header->flags & RECORD_KEY) || (header->bands == 1 && band[0].y == 0 && band[0].height == (uint32_t)image.height);
+}
+
+int
+Replay_Get(void)
+{
+	assert(map);
+
+	// A session that was killed may have left half a record behind
+	struct Record_Frame header;
+	if (offset + sizeof (header) > map_size)
+	{
+		return -1;
+	}
+	memcpy(&header, map + offset, sizeof (header));
+	if (header.size < sizeof (header) || header.size > map_size - offset)
+	{
+		return -1;
+	}
+
+	// A complete record has to hold what it says it holds, or it's corrupt
+	if (!Replay_Check(&header, map + offset))
+	{
+		fprintf(stderr, "Replay: Corrupt frame record at byte %lu, the replay ends here\n", (unsigned long)offset);
+		return -1;
+	}
+
+	if (pacing)
+	{
+		struct timespec recorded;
+		recorded.tv_sec = header.sec;
+		recorded.tv_nsec = header.nsec;
+		Replay_Pace(&recorded);
+	}
+
+	const char *record = map + offset;
+	const struct Record_Band *band = (const struct Record_Band *)(record + sizeof (header) + header.rects * sizeof (XRectangle));
+	const char *data = record + Record_Align(sizeof (header) + header.rects * sizeof (XRectangle) + header.bands * sizeof (struct Record_Band));
+	const size_t stride = image.bytes_per_line;
+
+	if (header.flags & RECORD_KEY)
+	{
+		// Use the complete frame as it is, it's never written to
+		image.data = (char *)data;
+		borrowed = 1;
+	}
+	else
+	{
+		// The changed rows go on top of the previous frame
+		if (borrowed)
+		{
+			memcpy(frame, image.data, stride * image.height);
+			image.data = frame;
+			borrowed = 0;
+		}
+
+		uint32_t i;
+		for (i = 0; i < header.bands; ++i)
+		{
+			memcpy(frame + band[i].y * stride, data, band[i].height * stride);
+			data += Record_Align(band[i].height * stride);
+		}
+	}
+
+	damage = (const XRectangle *)(record + sizeof (header));
+	damage_count = header.rects;
+	position_x = header.x;
+	position_y = header.y;
+	offset += header.size;
+
+	return damage_count;
+}
+
+const XRectangle *
+Replay_GetDamage(int *count)
+{
+	assert(count);
+
+	*count = damage_count;
+	return damage;
+}
+
+void
+Replay_GetPosition(int *x, int *y)
+{
+	assert(x);
+	assert(y);
+
+	*x = position_x;
+	*y = position_y;
+}
@@ -0,0 +1,128 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file record.h
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The capture log component API.
+ */
+
+#ifndef __RECORD_H__
+#define __RECORD_H__
+
+// Xlib headers
+#include <X11/Xlib.h>
+
+/**
+ * @def RECORD_KEYFRAME
+ * @brief The number of frames between two complete frames in a capture log.
+ *
+ * All other frames only hold the rows that changed since the frame before.
+ */
+#define RECORD_KEYFRAME 1024
+
+/**
+ * @brief Start recording the captured frames into a capture log.
+ *
+ * An existing file is replaced.
+ *
+ * @param [in] filename The capture log.
+ * @param [in] img The captured image, its layout is stored in the log.
+ * @return If the capture log could be created.
+ */
+int
+Record_Open(const char *filename, const XImage *img);
+
+/**
+ * @brief Stop recording and close the capture log.
+ */
+void
+Record_Close(void);
+
+/**
+ * @brief Append a captured frame to the capture log.
+ *
+ * Only the damaged rows that really differ from the previous frame are
+ * written, unless it's time for a complete frame.
+ *
+ * @param [in] img The captured image, with the same layout as in Record_Open().
+ * @param [in] rects The damaged areas of the frame.
+ * @param [in] count The number of damaged areas.
+ * @param [in] x The x-coordinate of the window on the screen.
+ * @param [in] y The y-coordinate of the window on the screen.
+ * @attention A successful call to Record_Open() has to be performed
+ * before a call to this function.
+ */
+void
+Record_Frame(const XImage *img, const XRectangle *rects, int count, int x, int y);
+
+/**
+ * @brief Open a capture log for replay.
+ *
+ * The log is memory mapped, complete frames are used right from the
+ * mapping without being copied.
+ *
+ * @param [in] filename The capture log.
+ * @param [in] paced If the frames should be replayed at the recorded speed,
+ * otherwise as fast as possible.
+ * @return The replayed image, valid until Replay_Close().
+ * @retval NULL Unable to open the capture log, or it's not a capture log.
+ */
+XImage *
+Replay_Open(const char *filename, int paced);
+
+/**
+ * @brief Close the replayed capture log.
+ */
+void
+Replay_Close(void);
+
+/**
+ * @brief Replay the next frame of the capture log.
+ *
+ * Updates the image returned by Replay_Open(), the image data may move
+ * between frames.
+ *
+ * @return The number of damaged rectangles in the new frame.
+ * @retval -1 The capture log has ended.
+ * @attention A successful call to Replay_Open() has to be performed
+ * before a call to this function.
+ */
+int
+Replay_Get(void);
+
+/**
+ * @brief Retrieve the recorded damage of the replayed frame.
+ * @param [out] count The number of damaged rectangles.
+ * @return The damaged rectangles, valid until the next Replay_Get().
+ */
+const XRectangle *
+Replay_GetDamage(int *count);
+
+/**
+ * @brief Retrieve the recorded window position of the replayed frame.
+ * @param [out] x The x-coordinate of the window on the screen.
+ * @param [out] y The y-coordinate of the window on the screen.
+ */
+void
+Replay_GetPosition(int *x, int *y);
+
+#endif
@@ -0,0 +1,255 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file rules.cpp
+ * The rule engine component reads the rule file with the C++ streams,
+ * every line is split on white space.
+ * @par More info about the used library:
+ * - http://www.cplusplus.com/reference/sstream/istringstream/
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The rule engine component implementation.
+ */
+
+// C++ Standard Library headers
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// C++ (C Standard Library) headers
+#include <cassert>
+#include <cstdio>
+
+// OpenCV headers
+#include <opencv/highgui.h>
+
+// Local C++ headers
+#include "rules.hpp"
+
+bool
+Rules::load(const char *filename, const char *pack, bool keyed)
+{
+	assert(filename);
+
+	std::ifstream file(filename);
+	if (!file)
+	{
+		std::cerr << "Rules: Unable to open " << filename << std::endl;
+		return false;
+	}
+
+	rules.clear();
+	std::string line;
+	for (int number = 1; std::getline(file, line); ++number)
+	{
+		std::istringstream fields(line);
+		Rule rule;
+		std::string action, pause;
+		if (!(fields >> rule.name) || rule.name[0] == '#')
+		{
+			continue;
+		}
+
+		// Every field is needed, nothing may follow them
+		std::string rest;
+		if (!(fields >> rule.file >> rule.threshold >> action >> pause >> rule.priority >> rule.interval) || fields >> rest)
+		{
+			std::cerr << "Rules: " << filename << ":" << number << ": Expected name, template, threshold, action, pause, priority and interval" << std::endl;
+			return false;
+		}
+
+		if (action == "hover")
+		{
+			rule.action = HOVER;
+		}
+		else if (action == "click")
+		{
+			rule.action = CLICK;
+		}
+		else if (action == "wait")
+		{
+			rule.action = WAIT;
+		}
+		else
+		{
+			std::cerr << "Rules: " << filename << ":" << number << ": Unknown action " << action << std::endl;
+			return false;
+		}
+
+		// A single pause, or a range to pick a random one from
+		int read = sscanf(pause.c_str(), "%d-%d", &rule.pause[0], &rule.pause[1]);
+		if (read == 1)
+		{
+			rule.pause[1] = rule.pause[0];
+		}
+		if (read < 1 || rule.pause[0] < 0 || rule.pause[1] < rule.pause[0] || rule.interval < 0 || rule.threshold <= 0)
+		{
+			std::cerr << "Rules: " << filename << ":" << number << ": Bad threshold, pause or interval" << std::endl;
+			return false;
+		}
+
+		rules.push_back(rule);
+	}
+
+	if (rules.empty())
+	{
+		std::cerr << "Rules: No rules in " << filename << std::endl;
+		return false;
+	}
+
+	// The templates are mapped from the pack if they are in it, or decoded
+	const bool packed = pack && this->pack.open(pack);
+	for (size_t i = 0; i < rules.size(); ++i)
+	{
+		Rule &rule = rules[i];
+		std::string name = rule.file.substr(rule.file.find_last_of('/') + 1);
+		name = name.substr(0, name.find_last_of('.'));
+
+		if (packed)
+		{
+			rule.templ = this->pack.templ(name.c_str(), &rule.pyramid);
+		}
+		if (rule.templ.empty())
+		{
+			rule.templ = Match::loadTemplate(rule.file.c_str(), &rule.bank);
+			rule.pyramid.clear();
+		}
+		else
+		{
+			// The zoom levels are quickly made from the small templates
+			rule.bank = Match::zoom(rule.templ);
+		}
+
+		// The colours of the template, also when matching in grey scale
+		if (keyed && packed)
+		{
+			rule.colour = this->pack.colour(name.c_str());
+		}
+		if (keyed && rule.colour.empty())
+		{
+			rule.colour = cv::imread(rule.file);
+		}
+
+		if (rule.templ.empty() || (keyed && rule.colour.empty()))
+		{
+			std::cerr << "Rules: Unable to load " << rule.file << std::endl;
+			return false;
+		}
+	}
+
+	// Highest priority first, in file order at a tie
+	order.clear();
+	for (size_t i = 0; i < rules.size(); ++i)
+	{
+		order.push_back(i);
+	}
+	std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) { return rules[a].priority > rules[b].priority; });
+
+	peaks.reserve(MATCH_PEAKS);
+	std::cout << "Rules: " << rules.size() << " rule(s) from " << filename << (packed ? ", templates from " : "") << (packed ? pack : "") << std::endl;
+	return true;
+}
+
+void
+Rules::attach(Match &m) const
+{
+	for (size_t i = 0; i < rules.size(); ++i)
+	{
+		m.registerBank(rules[i].templ, rules[i].bank, rules[i].pyramid);
+	}
+
+	for (size_t i = 0; i < rules.size(); ++i)
+	{
+		if (!rules[i].colour.empty())
+		{
+			m.setKey(rules[i].templ, rules[i].colour);
+		}
+	}
+}
+
+Hit
+Rules::detect(Match &m, std::vector<long long> &checked, long long now)
+{
+	assert(checked.size() == rules.size());
+
+	Hit hit;
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		// Not due yet, the rules after it may be
+		const size_t index = order[i];
+		const Rule &rule = rules[index];
+		if (checked[index] > 0 && now - checked[index] < rule.interval * 1000000ll)
+		{
+			continue;
+		}
+		checked[index] = now;
+
+		if (rule.action == HOVER)
+		{
+			// Every place found is visited
+			m.matchPeaks(rule.templ, peaks, rule.threshold);
+			if (peaks.empty())
+			{
+				continue;
+			}
+
+			hit.position = std::get<0>(peaks[0]);
+			hit.score = std::get<1>(peaks[0]);
+			for (size_t j = 0; j < peaks.size() && hit.stops < PIPELINE_STOPS; ++j)
+			{
+				hit.route[hit.stops++] = std::get<0>(peaks[j]);
+			}
+		}
+		else
+		{
+			std::tuple<cv::Point, double> mr = m.match(rule.templ);
+			if (std::get<1>(mr) <= rule.threshold)
+			{
+				continue;
+			}
+
+			hit.position = std::get<0>(mr);
+			hit.score = std::get<1>(mr);
+			hit.route[hit.stops++] = hit.position;
+		}
+
+		hit.what = index;
+		hit.size = m.extent(rule.templ);
+		return hit;
+	}
+
+	return hit;
+}
+
+const Rules::Rule &
+Rules::operator[](size_t index) const
+{
+	assert(index < rules.size());
+	return rules[index];
+}
+
+size_t
+Rules::size(void) const
+{
+	return rules.size();
+}
@@ -0,0 +1,152 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file rules.hpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The rule engine component API.
+ */
+
+#ifndef __RULES_H__
+#define __RULES_H__
+
+// C++ Standard Library headers
+#include <string>
+#include <tuple>
+#include <vector>
+
+// OpenCV headers
+#include <opencv/cv.h>
+
+// Local C++ headers
+#include "match.hpp"
+#include "pack.hpp"
+#include "pipeline.hpp"
+
+/**
+ * @class Rules
+ * @brief What to look for, and what to do about it.
+ *
+ * Every rule names a template, the score a hit needs, an action and how
+ * often the template is searched for. The rules are read from a rule
+ * file at startup, one rule per line:
+ *
+ * name template threshold action pause priority interval
+ *
+ * The action is "hover" (every place found, on one short path), "click"
+ * (the best place) or "wait". The pause is the rest after acting in
+ * milliseconds, "min-max" for a random one. The rules are checked by
+ * priority, the highest first, and the first hit is acted on. A rule is
+ * only checked when its interval (in milliseconds, 0 for every frame)
+ * has passed since it was checked last, so rarely needed templates
+ * don't add to the cost of every frame. Lines starting with '#' are
+ * comments.
+ */
+class Rules
+{
+public:
+	/**
+	 * @brief What is done on a hit.
+	 */
+	enum Action
+	{
+		HOVER, ///< Move the mouse over every place found
+		CLICK, ///< Click the best place
+		WAIT ///< Only rest for the pause
+	};
+
+	/**
+	 * @brief One template to look for.
+	 */
+	struct Rule
+	{
+		std::string name; ///< Printed with every hit
+		std::string file; ///< The template image
+		double threshold; ///< The score a hit needs, in sigma
+		Action action; ///< What is done on a hit
+		int pause[2]; ///< The rest after acting, random between the two (in milliseconds)
+		int priority; ///< The rules with a higher priority are checked first
+		int interval; ///< The time between two checks (in milliseconds), 0 for every frame
+		cv::Mat templ; ///< The template, from the pack or the image
+		std::vector<cv::Mat> pyramid; ///< The downsampled template, from the pack
+		std::vector<cv::Mat> bank; ///< The template at every browser zoom level
+		cv::Mat colour; ///< The template in colour to key it on, empty if not keyed
+	};
+
+	/**
+	 * @brief Read a rule file and load the templates.
+	 *
+	 * The templates are taken from the pack when they are in it, by the
+	 * name of the image file without directory and extension.
+	 *
+	 * @param [in] filename The rule file.
+	 * @param [in] pack The template pack, NULL or a missing file to decode the images.
+	 * @param [in] keyed Load the templates in colour too, to key them on.
+	 * @return True if every rule is valid and its template loaded.
+	 */
+	bool
+	load(const char *filename, const char *pack, bool keyed);
+
+	/**
+	 * @brief Register the templates of every rule with a matching algorithm.
+	 * @param [in,out] m The matching algorithm.
+	 */
+	void
+	attach(Match &m) const;
+
+	/**
+	 * @brief Search a prepared frame for something to do.
+	 *
+	 * The due rules are checked by priority until one of them is a hit.
+	 *
+	 * @param [in] m The matching algorithm, prepared with a frame.
+	 * @param [in,out] checked When every rule was checked last, one per
+	 * rule and game window. Start with size() zeroes.
+	 * @param [in] now The current time (CLOCK_MONOTONIC in nanoseconds).
+	 * @return What was found, Hit::what is the index of the rule.
+	 */
+	Hit
+	detect(Match &m, std::vector<long long> &checked, long long now);
+
+	/**
+	 * @brief A rule.
+	 * @param [in] index The index of the rule, in file order.
+	 * @return The rule.
+	 */
+	const Rule &
+	operator[](size_t index) const;
+
+	/**
+	 * @brief The number of rules.
+	 * @return The number of rules.
+	 */
+	size_t
+	size(void) const;
+
+private:
+	Pack pack;
+	std::vector<Rule> rules;
+	std::vector<size_t> order;
+	std::vector<std::tuple<cv::Point, double> > peaks;
+};
+
+#endif
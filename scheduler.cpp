@@ -0,0 +1,141 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file scheduler.cpp
+ * The frame scheduling component measures the CPU time of the whole
+ * process with CLOCK_PROCESS_CPUTIME_ID, hence the worker threads count.
+ * @par More info about the used library:
+ * - http://man7.org/linux/man-pages/man2/clock_gettime.2.html
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The frame scheduling component implementation.
+ */
+
+// C++ Standard Library headers
+#include <algorithm>
+
+// C++ (C Standard Library) headers
+#include <cassert>
+#include <cmath>
+
+// Local C headers
+extern "C"
+{
+#include "timer.h"
+}
+
+// Local C++ headers
+#include "scheduler.hpp"
+
+/**
+ * @brief The CPU time used by all threads of the process.
+ * @return The time in nanoseconds.
+ */
+static long long
+process(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+Scheduler::Scheduler(int budget, int targets) : budget(budget / 100.0 / targets), slow(SCHEDULER_SLOW * sqrt(targets))
+{
+	assert(budget >= 0);
+	assert(targets > 0);
+
+	Target target;
+	target.activity = 0;
+	target.updated = timer_now();
+	target.started = target.updated;
+	target.cpu = process();
+	target.cost = 0;
+	this->targets.assign(targets, target);
+}
+
+/**
+ * @brief Let the activity fade, call it with the lock held.
+ * @param [in] now The current time.
+ * @param [in,out] activity The activity, one per recent hit.
+ * @param [in,out] updated When the activity was faded.
+ */
+static void
+fade(long long now, double &activity, long long &updated)
+{
+	activity *= exp(-(now - updated) / (SCHEDULER_MEMORY * 1e9));
+	updated = now;
+}
+
+void
+Scheduler::begin(int target)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	Target &t = targets.at(target);
+	t.started = timer_now();
+	t.cpu = process();
+}
+
+void
+Scheduler::hit(int target)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	Target &t = targets.at(target);
+	fade(timer_now(), t.activity, t.updated);
+	t.activity += 1;
+}
+
+long
+Scheduler::next(std::mt19937 &engine, int target)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	Target &t = targets.at(target);
+	const long long now = timer_now();
+	const long long used = process();
+	const double work = now - t.started;
+	const double spent = used - t.cpu;
+
+	// A smooth cost, a single slow frame shouldn't stall everything
+	t.cost = t.cost == 0 ? work : t.cost + (work - t.cost) / 8;
+
+	// One recent hit is enough to go fast, then it fades slowly
+	fade(now, t.activity, t.updated);
+	const double pace = std::min(t.activity, 1.0);
+	double rest = (slow - (slow - SCHEDULER_FAST) * pace) * 1e6 - t.cost;
+	rest *= std::uniform_real_distribution<double>(1 - SCHEDULER_JITTER, 1 + SCHEDULER_JITTER)(engine);
+
+	// Stay within the share of the budget: the frame and the rest together have to last spent / budget
+	if (budget > 0)
+	{
+		const double least = spent / budget - work;
+		rest = std::max(rest, least * std::uniform_real_distribution<double>(1, 1 + SCHEDULER_JITTER)(engine));
+	}
+
+	rest = std::max(rest, 0.0);
+
+	t.started = now + static_cast<long long>(rest);
+	t.cpu = used;
+
+	return static_cast<long>(rest / 1e6);
+}
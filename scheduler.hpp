@@ -0,0 +1,136 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file scheduler.hpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The frame scheduling component API.
+ */
+
+#ifndef __SCHEDULER_H__
+#define __SCHEDULER_H__
+
+// C++ Standard Library headers
+#include <mutex>
+#include <random>
+#include <vector>
+
+/**
+ * @def SCHEDULER_FAST
+ * @brief The frame interval (in milliseconds) while bonuses keep coming.
+ */
+#define SCHEDULER_FAST 25
+
+/**
+ * @def SCHEDULER_SLOW
+ * @brief The frame interval (in milliseconds) when nothing has happened for a while.
+ */
+#define SCHEDULER_SLOW 250
+
+/**
+ * @def SCHEDULER_MEMORY
+ * @brief The time (in seconds) it takes a hit to fade to a third.
+ */
+#define SCHEDULER_MEMORY 20
+
+/**
+ * @def SCHEDULER_JITTER
+ * @brief The frame interval varies randomly this much (a fraction) in both directions.
+ */
+#define SCHEDULER_JITTER 0.2
+
+/**
+ * @class Scheduler
+ * @brief Decides how long to rest between two frames.
+ *
+ * The interval goes from SCHEDULER_SLOW down to SCHEDULER_FAST as hits
+ * come in, and slowly back up again when they stop. It never gets so
+ * short that the process uses more CPU time than the budget allows, the
+ * CPU time of all threads is measured. The interval is finally randomized
+ * by SCHEDULER_JITTER, so the frames never come like clockwork.
+ *
+ * Several targets (game windows) can share the scheduler. Each has its
+ * own pace, but they share the budget evenly. An idle target rests
+ * SCHEDULER_SLOW times the square root of the number of targets, so the
+ * CPU time grows slower than the number of windows.
+ */
+class Scheduler
+{
+public:
+	/**
+	 * @brief Constructor.
+	 *
+	 * @param [in] budget The CPU budget in percent of one core, 0 for none.
+	 * @param [in] targets The number of targets.
+	 */
+	Scheduler(int budget, int targets = 1);
+
+	/**
+	 * @brief Tell that the work on a frame of a target starts.
+	 *
+	 * Only needed when the targets take turns, otherwise the frame is
+	 * taken to start when the previous rest ended.
+	 *
+	 * @param [in] target The target.
+	 */
+	void
+	begin(int target = 0);
+
+	/**
+	 * @brief Tell that something was found.
+	 * @param [in] target Where it was found.
+	 */
+	void
+	hit(int target = 0);
+
+	/**
+	 * @brief How long to rest before the next frame.
+	 *
+	 * Call it once per frame, when the work is done. The time since the
+	 * frame began is taken as the cost of the frame.
+	 *
+	 * @param [in,out] engine The pseudorandom number generator.
+	 * @param [in] target The target of the frame.
+	 * @return The time to rest in milliseconds.
+	 */
+	long
+	next(std::mt19937 &engine, int target = 0);
+
+private:
+	/**
+	 * @brief The pace of one target.
+	 */
+	struct Target
+	{
+		double activity; ///< One per recent hit
+		long long updated; ///< When the activity was faded
+		long long started; ///< When the work on the frame started
+		long long cpu; ///< The CPU time when the work started
+		double cost; ///< A smooth time per frame
+	};
+
+	double budget;
+	double slow;
+	std::vector<Target> targets;
+	std::mutex lock;
+};
+
+#endif
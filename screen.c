@@ -21,10 +21,21 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
  * @file screen.c
  * The screen capture component uses the Xlib API for window handling.
  * It also uses the Xlib extention called XShm (MIT-SHM) for the screen
- * grabbing because the normal Xlib API was to slow.
+ * grabbing because the normal Xlib API was to slow. The XDamage extension
+ * tells which parts of the window that were redrawn, only those rows
+ * are copied from the X server. The frames can be recorded to, or
+ * replayed from, a capture log (see record.h). Several windows can be
+ * captured at once, they share one X connection. The position and size of
+ * every window is followed through the ConfigureNotify events of the
+ * window and its ancestors, no round trip to the X server is needed to
+ * place a grab or a click. The XCB backend requests the next frame as soon
+ * as one is handed out, on the same connection (see XGetXCBConnection()),
+ * the X server copies it while the caller processes the last one.
  * @par More info about the used libraries:
  * - http://en.wikipedia.org/wiki/Xlib
  * - http://en.wikipedia.org/wiki/MIT-SHM
+ * - http://www.x.org/releases/current/doc/damageproto/damageproto.txt
+ * - http://xcb.freedesktop.org/
  * 
  * @author Marcus Stjärnås
  * @date July, 2011
@@ -35,7 +46,9 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 // C Standard Library headers
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 // POSIX headers
 #include <sys/ipc.h>
@@ -43,81 +56,716 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 
 // Xlib headers
 #include <X11/Xatom.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/XShm.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+
+// XCB headers
+#include <xcb/damage.h>
+#include <xcb/shm.h>
+#include <xcb/xcbext.h>
+#include <xcb/xfixes.h>
 
 // Local C headers
+#include "record.h"
 #include "screen.h"
 
-static Display *display = NULL;
-static XImage *buffer = NULL;
+/**
+ * @def SCREEN_MAX_ANCESTORS
+ * @brief The maximum depth of a captured window below the root window.
+ *
+ * Window managers put every top level window in a frame or two, deeper
+ * windows are followed up to this depth only.
+ */
+#define SCREEN_MAX_ANCESTORS 8
+
+/**
+ * @brief The capture state of one window.
+ */
+struct Capture
+{
+	XImage *buffer; ///< The image Screen_Get() grabs into, same as buffers[0]
+	XImage *buffers[SCREEN_BUFFERS];
+	XShmSegmentInfo shminfo[SCREEN_BUFFERS];
+	int buffer_count;
+
+	Window window;
+	XWindowAttributes window_attr; ///< The size and border are kept up to date
+	int window_x;
+	int window_y;
+	Window ancestors[SCREEN_MAX_ANCESTORS]; ///< The window and its parents, up to the root
+	XPoint offsets[SCREEN_MAX_ANCESTORS]; ///< Of the inside of every ancestor in its parent
+	int ancestor_count;
+
+	Damage damage;
+	XserverRegion damage_region;
+	XRectangle dirty[SCREEN_MAX_DAMAGE];
+	int dirty_count;
+	int first; ///< The damage from the initialization covers the first frame
+
+	int recording;
+	int replaying;
 
-static XShmSegmentInfo shminfo;
+	int mapped;
+	int obscured;
 
-static Window window = 0;
-static XWindowAttributes window_attr;
-static int window_x;
-static int window_y;
+	int backend; ///< SCREEN_XLIB or SCREEN_XCB
+	XImage *spare; ///< The XCB grab in flight goes here, then it's swapped with buffer
+	XShmSegmentInfo spare_info;
+	int pending; ///< An XCB grab is in flight
+	xcb_shm_get_image_cookie_t grab;
+	xcb_xfixes_fetch_region_cookie_t fetch;
+	long long issued; ///< When the grab in flight was requested
+	long long transfer; ///< How long the last grab that had to be waited for took
+	long long waited; ///< How long the last Screen_Get() waited for the X server
+	long long hidden; ///< How long the last grab was in flight before Screen_Get()
+};
+
+// All windows share the X connection
+static Display *display = NULL;
+static int users = 0;
+static int shm_checked = 0;
+static int damage_supported = 0;
+static int damage_event;
 
 /**
- * @brief Recursively find a window with the desired name.
+ * @brief Recursively find the windows with the desired name.
  * @param [in] top The parent window.
- * @param [in] name The name of the desired window to return.
- * @return The image id of desired window.
- * @retval 0 Unable to find desired window.
+ * @param [in] name The start of the name of the desired windows.
+ * @param [out] found The windows found.
+ * @param [in] max The maximum number of windows to find.
+ * @param [in,out] count The number of windows found so far.
  */
-static Window
-Window_WithName(Window top, const char *name)
+static void
+Window_WithName(Window top, const char *name, Window *found, int max, int *count)
 {
 	Window *children, dummy;
 	unsigned int nchildren;
-	Window w = 0;
 	char *window_name;
 
-	if (XFetchName(display, top, &window_name) && !strncmp(window_name, name, strlen(name)))
+	if (*count >= max)
 	{
-		fprintf(stdout, "Window: %s\n", window_name);
-		return top;
+		return;
+	}
+
+	if (XFetchName(display, top, &window_name))
+	{
+		int match = !strncmp(window_name, name, strlen(name));
+		if (match)
+		{
+			fprintf(stdout, "Window: %s\n", window_name);
+			found[(*count)++] = top;
+		}
+		XFree(window_name);
+		if (match)
+		{
+			return;
+		}
 	}
 
 	if (!XQueryTree(display, top, &dummy, &dummy, &children, &nchildren))
 	{
-		return 0;
+		return;
 	}
 
 	int i;
 	for (i = 0; i < nchildren; ++i)
 	{
-		w = Window_WithName(children[i], name);
-		if (w)
-		{
-			break;
-		}
+		Window_WithName(children[i], name, found, max, count);
 	}
 
 	if (children)
 	{
 		XFree(children);
 	}
-
-	return w;
 }
 
-XImage *
-Screen_Initialize(const char *name)
+/**
+ * @brief Open the shared X connection, or use it once more.
+ * @return If the X server has the needed extensions.
+ */
+static int
+Screen_Connect(void)
 {
-	assert(name);
+	if (users++ > 0)
+	{
+		return shm_checked;
+	}
 
 	display = XOpenDisplay(NULL);
 	assert(display);
 
-	// Retrieve selected window
-	window = Window_WithName(DefaultRootWindow(display), name);
-	if (window == 0)
+	// Check for the XShm extension
+	int ignore, major, minor;
+	Bool pixmaps;
+	if (XQueryExtension(display, "MIT-SHM", &ignore, &ignore, &ignore) && XShmQueryVersion(display, &major, &minor, &pixmaps) == True)
+	{
+		fprintf(stdout, "MIT-SHM: %d.%d %s shared pixmaps\n", major, minor, (pixmaps==True) ? "with" : "without");
+		shm_checked = 1;
+	}
+
+	// Check for the damage reports
+	int damage_error;
+	if (XDamageQueryExtension(display, &damage_event, &damage_error) && XDamageQueryVersion(display, &major, &minor)
+		&& XFixesQueryExtension(display, &ignore, &ignore) && XFixesQueryVersion(display, &ignore, &ignore))
+	{
+		fprintf(stdout, "DAMAGE: %d.%d\n", major, minor);
+		damage_supported = 1;
+	}
+
+	return shm_checked;
+}
+
+/**
+ * @brief Stop using the shared X connection, the last user closes it.
+ */
+static void
+Screen_Disconnect(void)
+{
+	assert(users > 0);
+	if (--users > 0)
+	{
+		return;
+	}
+
+	XCloseDisplay(display);
+	display = NULL;
+	shm_checked = 0;
+	damage_supported = 0;
+}
+
+/**
+ * @brief Mark the whole captured image as damaged.
+ * @param [in,out] capture The window.
+ */
+static void
+Screen_DamageAll(Capture *capture)
+{
+	capture->dirty[0].x = 0;
+	capture->dirty[0].y = 0;
+	capture->dirty[0].width = capture->buffer->width;
+	capture->dirty[0].height = capture->buffer->height;
+	capture->dirty_count = 1;
+}
+
+/**
+ * @brief Throw away the damage notifications.
+ *
+ * The notifications only tell that something happened, the region has it all.
+ */
+static void
+Screen_DropNotifications(void)
+{
+	XEvent event;
+	while (XCheckTypedEvent(display, damage_event + XDamageNotify, &event))
 	{
-		fprintf(stderr, "Window: No window found (%s)\n", name);
-		return NULL;
 	}
+}
+
+/**
+ * @brief Make the damage of the window the dirty list.
+ *
+ * The rectangles are translated into captured image coordinates and
+ * clipped.
+ *
+ * @param [in,out] capture The window.
+ * @param [in] rects The damaged areas, in window coordinates.
+ * @param [in] count The number of damaged areas.
+ */
+static void
+Screen_Clip(Capture *capture, const XRectangle *rects, int count)
+{
+	int i;
+	const int width = capture->buffer->width;
+	const int height = capture->buffer->height;
+	XRectangle *dirty = capture->dirty;
+	int x1 = width, y1 = height, x2 = 0, y2 = 0;
+	int dirty_count = 0;
+	for (i = 0; i < count; ++i)
+	{
+		// Window coordinates are inside the border, the grab is not
+		int left = rects[i].x + capture->window_attr.border_width;
+		int top = rects[i].y + capture->window_attr.border_width;
+		int right = left + rects[i].width;
+		int bottom = top + rects[i].height;
+
+		left = left < 0 ? 0 : left;
+		top = top < 0 ? 0 : top;
+		right = right > width ? width : right;
+		bottom = bottom > height ? height : bottom;
+		if (left >= right || top >= bottom)
+		{
+			continue;
+		}
+
+		// Keep track of the bounding box, in case there are to many rectangles
+		x1 = left < x1 ? left : x1;
+		y1 = top < y1 ? top : y1;
+		x2 = right > x2 ? right : x2;
+		y2 = bottom > y2 ? bottom : y2;
+
+		if (dirty_count < SCREEN_MAX_DAMAGE)
+		{
+			dirty[dirty_count].x = left;
+			dirty[dirty_count].y = top;
+			dirty[dirty_count].width = right - left;
+			dirty[dirty_count].height = bottom - top;
+		}
+		++dirty_count;
+	}
+
+	if (dirty_count > SCREEN_MAX_DAMAGE)
+	{
+		dirty[0].x = x1;
+		dirty[0].y = y1;
+		dirty[0].width = x2 - x1;
+		dirty[0].height = y2 - y1;
+		dirty_count = 1;
+	}
+	capture->dirty_count = dirty_count;
+}
+
+/**
+ * @brief Fetch the areas of the window that has been redrawn.
+ *
+ * Moves the accumulated damage of the window into the dirty list.
+ *
+ * @param [in,out] capture The window.
+ */
+static void
+Screen_FetchDamage(Capture *capture)
+{
+	Screen_DropNotifications();
+	XDamageSubtract(display, capture->damage, None, capture->damage_region);
+
+	int count;
+	XRectangle *rects = XFixesFetchRegion(display, capture->damage_region, &count);
+	Screen_Clip(capture, rects, count);
+
+	if (rects)
+	{
+		XFree(rects);
+	}
+}
+
+/**
+ * @brief Place the window on the screen from the offsets of its ancestors.
+ * @param [in,out] capture The window.
+ */
+static void
+Screen_Place(Capture *capture)
+{
+	int i, x = 0, y = 0;
+	for (i = 0; i < capture->ancestor_count; ++i)
+	{
+		x += capture->offsets[i].x;
+		y += capture->offsets[i].y;
+	}
+
+	// The grab includes the border of the window
+	capture->window_x = x - capture->window_attr.border_width;
+	capture->window_y = y - capture->window_attr.border_width;
+}
+
+/**
+ * @brief Follow the window and its ancestors up to the root window.
+ *
+ * Selects the structure events of every ancestor, a window manager moves
+ * the frame and not the window in it. Takes a few round trips, this is
+ * only done again when the window is reparented.
+ *
+ * @param [in,out] capture The window.
+ */
+static void
+Screen_Follow(Capture *capture)
+{
+	Window window = capture->window, root, parent, *children;
+	unsigned int nchildren;
+
+	capture->ancestor_count = 0;
+	while (capture->ancestor_count < SCREEN_MAX_ANCESTORS)
+	{
+		XWindowAttributes attr;
+		int res = XGetWindowAttributes(display, window, &attr);
+		assert(res != 0);
+
+		const int i = capture->ancestor_count++;
+		capture->ancestors[i] = window;
+		capture->offsets[i].x = attr.x + attr.border_width;
+		capture->offsets[i].y = attr.y + attr.border_width;
+		if (i == 0)
+		{
+			capture->window_attr = attr;
+		}
+		else
+		{
+			XSelectInput(display, window, StructureNotifyMask);
+		}
+
+		if (!XQueryTree(display, window, &root, &parent, &children, &nchildren))
+		{
+			break;
+		}
+		if (children)
+		{
+			XFree(children);
+		}
+		if (parent == root)
+		{
+			break;
+		}
+		window = parent;
+	}
+
+	Screen_Place(capture);
+}
+
+/**
+ * @brief Tell the events of a window from those of the others.
+ * @param [in] display The X connection.
+ * @param [in] event An event in the queue.
+ * @param [in] arg The window, a Capture.
+ * @return If the event is a structure or visibility event of the window or its ancestors.
+ */
+static Bool
+Screen_Owns(Display *display, XEvent *event, XPointer arg)
+{
+	const Capture *capture = (const Capture *)arg;
+
+	switch (event->type)
+	{
+	case CirculateNotify:
+	case ConfigureNotify:
+	case DestroyNotify:
+	case GravityNotify:
+	case MapNotify:
+	case ReparentNotify:
+	case UnmapNotify:
+	case VisibilityNotify:
+		break;
+
+	default:
+		return False;
+	}
+
+	int i;
+	for (i = 0; i < capture->ancestor_count; ++i)
+	{
+		if (event->xany.window == capture->ancestors[i])
+		{
+			return True;
+		}
+	}
+
+	return False;
+}
+
+/**
+ * @brief Keep track of the window being mapped, obscured, moved and resized.
+ * @param [in,out] capture The window.
+ * @param [in] event A structure or visibility event of the window or its ancestors.
+ */
+static void
+Screen_HandleEvent(Capture *capture, const XEvent *event)
+{
+	const int own = event->xany.window == capture->window;
+	int i;
+
+	switch (event->type)
+	{
+	case MapNotify:
+		capture->mapped = own ? 1 : capture->mapped;
+		break;
+
+	case UnmapNotify:
+		capture->mapped = own ? 0 : capture->mapped;
+		break;
+
+	case VisibilityNotify:
+		capture->obscured = event->xvisibility.state == VisibilityFullyObscured;
+		break;
+
+	case ConfigureNotify:
+		// The window manager sends made up events in root coordinates, the real ones of the frame follow anyway
+		if (event->xconfigure.send_event)
+		{
+			break;
+		}
+		for (i = 0; i < capture->ancestor_count; ++i)
+		{
+			if (capture->ancestors[i] == event->xconfigure.window)
+			{
+				capture->offsets[i].x = event->xconfigure.x + event->xconfigure.border_width;
+				capture->offsets[i].y = event->xconfigure.y + event->xconfigure.border_width;
+			}
+		}
+		if (own)
+		{
+			capture->window_attr.width = event->xconfigure.width;
+			capture->window_attr.height = event->xconfigure.height;
+			capture->window_attr.border_width = event->xconfigure.border_width;
+		}
+		Screen_Place(capture);
+		break;
+
+	case ReparentNotify:
+		Screen_Follow(capture);
+		break;
+	}
+}
+
+/**
+ * @brief Handle the pending structure and visibility events of a window.
+ * @param [in,out] capture The window.
+ */
+static void
+Screen_Events(Capture *capture)
+{
+	XEvent event;
+	while (XCheckIfEvent(display, &event, Screen_Owns, (XPointer)capture))
+	{
+		Screen_HandleEvent(capture, &event);
+	}
+}
+
+/**
+ * @brief Grab a band of full rows from the screen.
+ *
+ * XShmGetImage() always fills the whole image with the server's own
+ * stride, a band of full width rows shares that stride with the buffer
+ * and can therefore be grabbed into the same shared segment.
+ *
+ * @param [in] capture The window.
+ * @param [in] y The first row.
+ * @param [in] height The number of rows.
+ */
+static void
+Screen_GetRows(Capture *capture, int y, int height)
+{
+	XImage band = *capture->buffer;
+	band.height = height;
+	band.data = capture->buffer->data + (size_t)y * capture->buffer->bytes_per_line;
+
+	XShmGetImage(display, DefaultRootWindow(display), &band, capture->window_x, capture->window_y + y, AllPlanes);
+}
+
+/**
+ * @brief Allocate a shared image with the size of the window.
+ * @param [in] capture The window.
+ * @param [out] info The shared memory segment of the image.
+ * @return The image.
+ */
+static XImage *
+Screen_CreateBuffer(const Capture *capture, XShmSegmentInfo *info)
+{
+	XImage *image = XShmCreateImage(display, DefaultVisual(display, 0), 24, ZPixmap, NULL, info, capture->window_attr.width, capture->window_attr.height);
+	assert(image);
+	info->shmid = shmget(IPC_PRIVATE, image->bytes_per_line*image->height, IPC_CREAT | 0777);
+	assert(info->shmid >= 0);
+
+	info->shmaddr = image->data = (char*)shmat(info->shmid, 0, 0);
+	info->readOnly = False;
+
+	XShmAttach(display, info);
+	XSync(display, False);
+
+	shmctl(info->shmid, IPC_RMID, 0);
+
+	return image;
+}
+
+/**
+ * @brief Free a shared image.
+ * @param [in] image The image.
+ * @param [in] info The shared memory segment of the image.
+ */
+static void
+Screen_DestroyBuffer(XImage *image, XShmSegmentInfo *info)
+{
+	XShmDetach(display, info);
+	XDestroyImage(image);
+	shmdt(info->shmaddr);
+}
+
+/**
+ * @brief Make a shared image the size of the window again.
+ *
+ * Only the shared memory segments are replaced, the rest of the capture
+ * stays as it is. A resize while recording ends the capture log, every
+ * frame of a log has the same size.
+ *
+ * @param [in,out] capture The window.
+ * @param [in] index The buffer number.
+ * @return If the image was replaced, it's then damaged as a whole.
+ */
+static int
+Screen_Fit(Capture *capture, int index)
+{
+	XImage *image = capture->buffers[index];
+	if (image->width == capture->window_attr.width && image->height == capture->window_attr.height)
+	{
+		return 0;
+	}
+
+	fprintf(stdout, "Window: Resized to %dx%d\n", capture->window_attr.width, capture->window_attr.height);
+	if (capture->recording)
+	{
+		fprintf(stderr, "Record: The window was resized, the capture log ends here\n");
+		Record_Close();
+		capture->recording = 0;
+	}
+
+	Screen_DestroyBuffer(image, &capture->shminfo[index]);
+	capture->buffers[index] = Screen_CreateBuffer(capture, &capture->shminfo[index]);
+	if (index == 0)
+	{
+		capture->buffer = capture->buffers[0];
+		capture->first = 1;
+		Screen_DamageAll(capture);
+	}
+
+	// The XCB grabs go to the spare of buffer 0, it's never in flight here
+	if (index == 0 && capture->spare)
+	{
+		assert(!capture->pending);
+		Screen_DestroyBuffer(capture->spare, &capture->spare_info);
+		capture->spare = Screen_CreateBuffer(capture, &capture->spare_info);
+	}
+
+	return 1;
+}
+
+/**
+ * @brief The current time of the monotonic clock.
+ * @return The time in nanoseconds.
+ */
+static long long
+Screen_Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/**
+ * @brief Request the next frame of the window into the spare buffer.
+ *
+ * The damage is taken at the same time, it's what changed since the last
+ * request. Nothing waits for the X server.
+ *
+ * @param [in,out] capture The window.
+ */
+static void
+Screen_Request(Capture *capture)
+{
+	xcb_connection_t *connection = XGetXCBConnection(display);
+
+	if (capture->damage != None)
+	{
+		xcb_damage_subtract(connection, capture->damage, XCB_NONE, capture->damage_region);
+		capture->fetch = xcb_xfixes_fetch_region(connection, capture->damage_region);
+	}
+
+	// The server has the name of the segment from XShmAttach()
+	capture->grab = xcb_shm_get_image(connection, DefaultRootWindow(display), capture->window_x, capture->window_y,
+		capture->spare->width, capture->spare->height, ~0u, XCB_IMAGE_FORMAT_Z_PIXMAP, capture->spare_info.shmseg, 0);
+	xcb_flush(connection);
+
+	capture->issued = Screen_Now();
+	capture->pending = 1;
+}
+
+/**
+ * @brief Wait for the requested frame and hand it out.
+ *
+ * The spare buffer becomes buffer 0, the old buffer 0 takes the next
+ * request. The time the grab was in flight before this call is hidden
+ * behind the work of the caller. When the reply was there already, the
+ * hidden time is estimated from the last grab that had to be waited for.
+ *
+ * @param [in,out] capture The window.
+ */
+static void
+Screen_Collect(Capture *capture)
+{
+	assert(capture->pending);
+	xcb_connection_t *connection = XGetXCBConnection(display);
+	const long long called = Screen_Now();
+
+	// The replies come in order, if the grab is there the damage is too
+	void *reply = NULL;
+	xcb_generic_error_t *error = NULL;
+	const int ready = xcb_poll_for_reply(connection, capture->grab.sequence, &reply, &error);
+
+	xcb_xfixes_fetch_region_reply_t *region = NULL;
+	if (capture->damage != None)
+	{
+		region = xcb_xfixes_fetch_region_reply(connection, capture->fetch, NULL);
+	}
+	if (!ready)
+	{
+		reply = xcb_shm_get_image_reply(connection, capture->grab, &error);
+	}
+	const long long now = Screen_Now();
+	capture->pending = 0;
+
+	if (!ready)
+	{
+		capture->transfer = now - capture->issued;
+	}
+	capture->waited = ready ? 0 : now - called;
+	capture->hidden = called - capture->issued;
+	if (ready && capture->hidden > capture->transfer)
+	{
+		capture->hidden = capture->transfer;
+	}
+
+	if (region)
+	{
+		Screen_DropNotifications();
+		Screen_Clip(capture, (const XRectangle *)xcb_xfixes_fetch_region_rectangles(region), xcb_xfixes_fetch_region_rectangles_length(region));
+		free(region);
+	}
+
+	// The damage is lost with a failed grab, the next frame is damaged as a whole
+	if (!reply)
+	{
+		fprintf(stderr, "Window: Unable to grab the window\n");
+		free(error);
+		capture->dirty_count = 0;
+		capture->first = 1;
+		return;
+	}
+	free(reply);
+
+	if (capture->first || capture->damage == None)
+	{
+		Screen_DamageAll(capture);
+		capture->first = 0;
+	}
+
+	XImage *image = capture->spare;
+	XShmSegmentInfo info = capture->spare_info;
+	capture->spare = capture->buffers[0];
+	capture->spare_info = capture->shminfo[0];
+	capture->buffer = capture->buffers[0] = image;
+	capture->shminfo[0] = info;
+}
+
+/**
+ * @brief Prepare a window for frame grabbing.
+ * @param [in] window The window.
+ * @return The capture state of the window.
+ */
+static Capture *
+Screen_Open(Window window)
+{
+	Capture *capture = calloc(1, sizeof (Capture));
+	assert(capture);
+	capture->window = window;
+	capture->first = 1;
 
 	// Raise window to the top
 	XEvent xev;
@@ -136,92 +784,422 @@ Screen_Initialize(const char *name)
 						&xev);
 	assert(res != 0);
 
-	// Retrieve window attributes (size matters...)
-	res = XGetWindowAttributes(display, window, &window_attr);
-	assert(res != 0);
+	// Follow the window being minimized, covered, moved or resized (size matters...)
+	XSelectInput(display, window, StructureNotifyMask | VisibilityChangeMask);
+	Screen_Follow(capture);
+	capture->mapped = capture->window_attr.map_state == IsViewable;
 
-	Window junkwin;
-	XTranslateCoordinates(	display,
-							window,
-							window_attr.root,
-							-window_attr.border_width,
-							-window_attr.border_width,
-							&window_x,
-							&window_y,
-							&junkwin);
+	// Allocate a shared buffer
+	capture->buffer = capture->buffers[0] = Screen_CreateBuffer(capture, &capture->shminfo[0]);
+	capture->buffer_count = 1;
 
-	// Check for the XShm extension
-	int ignore, major, minor;
-	Bool pixmaps;
-	if (XQueryExtension(display, "MIT-SHM", &ignore, &ignore, &ignore))
+	// Subscribe to the damage reports of the window, if possible
+	capture->damage = None;
+	capture->damage_region = None;
+	if (damage_supported)
+	{
+		capture->damage = XDamageCreate(display, window, XDamageReportNonEmpty);
+		capture->damage_region = XFixesCreateRegion(display, NULL, 0);
+	}
+
+	// The first frame is always grabbed as a whole
+	Screen_DamageAll(capture);
+
+	return capture;
+}
+
+Capture *
+Screen_Initialize(const char *name)
+{
+	Capture *capture = NULL;
+
+	return Screen_InitializeAll(name, &capture, 1) == 1 ? capture : NULL;
+}
+
+int
+Screen_InitializeAll(const char *name, Capture **captures, int max)
+{
+	assert(name);
+	assert(captures);
+	assert(max > 0);
+
+	if (!Screen_Connect())
+	{
+		Screen_Disconnect();
+		return 0;
+	}
+
+	// Retrieve the selected windows
+	Window found[SCREEN_MAX_WINDOWS];
+	int i, count = 0;
+	Window_WithName(DefaultRootWindow(display), name, found, max < SCREEN_MAX_WINDOWS ? max : SCREEN_MAX_WINDOWS, &count);
+	if (count == 0)
+	{
+		fprintf(stderr, "Window: No window found (%s)\n", name);
+		Screen_Disconnect();
+		return 0;
+	}
+
+	// Every window is one more user of the connection
+	for (i = 0; i < count; ++i)
+	{
+		captures[i] = Screen_Open(found[i]);
+	}
+	users += count - 1;
+
+	return count;
+}
+
+Capture *
+Screen_Replay(const char *filename, int paced)
+{
+	Capture *capture = calloc(1, sizeof (Capture));
+	assert(capture);
+
+	capture->buffer = Replay_Open(filename, paced);
+	if (!capture->buffer)
+	{
+		free(capture);
+		return NULL;
+	}
+	capture->replaying = 1;
+
+	return capture;
+}
+
+int
+Screen_Record(Capture *capture, const char *filename)
+{
+	assert(capture);
+	assert(capture->buffer);
+	assert(!capture->replaying);
+
+	capture->recording = Record_Open(filename, capture->buffer);
+
+	return capture->recording;
+}
+
+void
+Screen_Deinitialize(Capture *capture)
+{
+	assert(capture);
+	if (capture->replaying)
+	{
+		Replay_Close();
+		free(capture);
+		return;
+	}
+
+	assert(display);
+	if (capture->recording)
+	{
+		Record_Close();
+	}
+
+	if (capture->damage != None)
+	{
+		XDamageDestroy(display, capture->damage);
+		XFixesDestroyRegion(display, capture->damage_region);
+	}
+
+	// The server may still write into the spare buffer
+	if (capture->pending)
+	{
+		Screen_Collect(capture);
+	}
+	if (capture->spare)
+	{
+		Screen_DestroyBuffer(capture->spare, &capture->spare_info);
+	}
+
+	int i;
+	for (i = 0; i < capture->buffer_count; ++i)
+	{
+		Screen_DestroyBuffer(capture->buffers[i], &capture->shminfo[i]);
+	}
+
+	// The ancestors may be followed by other captures too, the X server forgets them with the connection
+	XSelectInput(display, capture->window, NoEventMask);
+	free(capture);
+	Screen_Disconnect();
+}
+
+/**
+ * @brief Grab the damaged rows of the window.
+ *
+ * Overlapping rows are only grabbed once.
+ *
+ * @param [in,out] capture The window.
+ */
+static void
+Screen_GetDamaged(Capture *capture)
+{
+	// The damage list from the initialization covers the first frame
+	if (!capture->first)
+	{
+		Screen_FetchDamage(capture);
+	}
+	capture->first = 0;
+
+	// Grab the damaged rows, overlapping rows are only grabbed once
+	const XRectangle *dirty = capture->dirty;
+	const int dirty_count = capture->dirty_count;
+	const int height = capture->buffer->height;
+	int y = 0;
+	while (y < height)
 	{
-		if (XShmQueryVersion(display, &major, &minor, &pixmaps) == True)
+		// Find the next damaged row...
+		int i, top = height;
+		for (i = 0; i < dirty_count; ++i)
 		{
-			fprintf(stdout, "MIT-SHM: %d.%d %s shared pixmaps\n", major, minor, (pixmaps==True) ? "with" : "without");
+			if (dirty[i].y + dirty[i].height > y && dirty[i].y < top)
+			{
+				top = dirty[i].y > y ? dirty[i].y : y;
+			}
 		}
-		else
+		if (top == height)
+		{
+			break;
+		}
+
+		// ...and grow the band for as long as other damage overlaps it
+		int bottom = top + 1, grown = 1;
+		while (grown)
 		{
-			return NULL;
+			grown = 0;
+			for (i = 0; i < dirty_count; ++i)
+			{
+				if (dirty[i].y < bottom && dirty[i].y + dirty[i].height > bottom)
+				{
+					bottom = dirty[i].y + dirty[i].height;
+					grown = 1;
+				}
+			}
 		}
+
+		Screen_GetRows(capture, top, bottom - top);
+		y = bottom;
+	}
+}
+
+int
+Screen_Get(Capture *capture)
+{
+	assert(capture);
+	if (capture->replaying)
+	{
+		return Replay_Get();
+	}
+
+	assert(display);
+
+	// Move and resize first, the grab is placed from the cached geometry
+	Screen_Events(capture);
+	const int resized = capture->buffer->width != capture->window_attr.width || capture->buffer->height != capture->window_attr.height;
+	if (resized && capture->pending)
+	{
+		// The grab in flight has the old size, it's thrown away
+		Screen_Collect(capture);
+	}
+	Screen_Fit(capture, 0);
+
+	if (capture->backend == SCREEN_XCB)
+	{
+		// The first frame, and the first one after a resize, is waited for
+		if (!capture->pending)
+		{
+			Screen_Request(capture);
+		}
+		Screen_Collect(capture);
+
+		// The next frame is copied while this one is processed
+		Screen_Request(capture);
 	}
 	else
 	{
-		return NULL;
+		const long long start = Screen_Now();
+		if (capture->damage == None)
+		{
+			XShmGetImage(display, DefaultRootWindow(display), capture->buffer, capture->window_x, capture->window_y, AllPlanes);
+			Screen_DamageAll(capture);
+		}
+		else
+		{
+			Screen_GetDamaged(capture);
+		}
+		capture->waited = Screen_Now() - start;
+		capture->hidden = 0;
 	}
 
-	// Allocate a shared buffer
-	buffer = XShmCreateImage(display, DefaultVisual(display, 0), 24, ZPixmap, NULL, &shminfo, window_attr.width, window_attr.height);
-	assert(buffer);
-	shminfo.shmid = shmget(IPC_PRIVATE, buffer->bytes_per_line*buffer->height, IPC_CREAT | 0777);
-	assert(shminfo.shmid >= 0);
+	if (capture->recording)
+	{
+		const int border = capture->window_attr.border_width;
+		Record_Frame(capture->buffer, capture->dirty, capture->dirty_count, capture->window_x + border, capture->window_y + border);
+	}
 
-	shminfo.shmaddr = buffer->data = (char*)shmat(shminfo.shmid, 0, 0);
-	shminfo.readOnly = False;
+	return capture->dirty_count;
+}
 
-	XShmAttach(display, &shminfo);
-	XSync(display, False);
+int
+Screen_AllocateBuffers(Capture *capture, int count)
+{
+	assert(capture);
+	assert(display);
 
-	shmctl(shminfo.shmid, IPC_RMID, 0);
+	count = count > SCREEN_BUFFERS ? SCREEN_BUFFERS : count;
+	for (; capture->buffer_count < count; ++capture->buffer_count)
+	{
+		capture->buffers[capture->buffer_count] = Screen_CreateBuffer(capture, &capture->shminfo[capture->buffer_count]);
+	}
 
-	return buffer;
+	return capture->buffer_count;
+}
+
+XImage *
+Screen_Buffer(const Capture *capture, int index)
+{
+	assert(capture);
+	assert(index == 0 || (index > 0 && index < capture->buffer_count));
+
+	return index == 0 ? capture->buffer : capture->buffers[index];
 }
 
 void
-Screen_Deinitialize(void)
+Screen_GetInto(Capture *capture, int index)
 {
+	assert(capture);
 	assert(display);
-	XShmDetach(display, &shminfo);
+	assert(index >= 0 && index < capture->buffer_count);
 
-	assert(buffer);
-	XDestroyImage(buffer);
-	shmdt(shminfo.shmaddr);
+	Screen_Events(capture);
+	Screen_Fit(capture, index);
 
-	XFree(display);
-	display = NULL;
+	XImage *image = capture->buffers[index];
+	XShmGetImage(display, DefaultRootWindow(display), image, capture->window_x, capture->window_y, AllPlanes);
+
+	if (capture->recording)
+	{
+		const int border = capture->window_attr.border_width;
+		XRectangle all = {0, 0, image->width, image->height};
+		Record_Frame(image, &all, 1, capture->window_x + border, capture->window_y + border);
+	}
 }
 
-void
-Screen_Get(void)
+int
+Screen_Visible(Capture *capture)
 {
+	assert(capture);
+	if (capture->replaying)
+	{
+		return 1;
+	}
+
 	assert(display);
 
-	XShmGetImage(display, DefaultRootWindow(display), buffer, window_x, window_y, AllPlanes);
-	assert(buffer);
+	Screen_Events(capture);
+
+	return capture->mapped && !capture->obscured;
+}
+
+void
+Screen_WaitVisible(Capture *capture)
+{
+	while (!Screen_Visible(capture))
+	{
+		XEvent event;
+		XIfEvent(display, &event, Screen_Owns, (XPointer)capture);
+		Screen_HandleEvent(capture, &event);
+	}
+}
+
+const XRectangle *
+Screen_GetDamage(const Capture *capture, int *count)
+{
+	assert(capture);
+	assert(count);
+
+	if (capture->replaying)
+	{
+		return Replay_GetDamage(count);
+	}
+
+	*count = capture->dirty_count;
+	return capture->dirty;
+}
+
+Window
+Screen_Window(const Capture *capture)
+{
+	assert(capture);
+
+	return capture->replaying ? None : capture->window;
 }
 
 void
-Screen_TranslateCoordinates(int *x, int *y)
+Screen_TranslateCoordinates(const Capture *capture, int *x, int *y)
 {
+	assert(capture);
 	assert(x);
 	assert(y);
-	
-	Window junkwin;
-	XTranslateCoordinates(	display,
-							window,
-							window_attr.root,
-							*x,
-							*y,
-							x,
-							y,
-							&junkwin);
+
+	if (capture->replaying)
+	{
+		int left, top;
+		Replay_GetPosition(&left, &top);
+		*x += left;
+		*y += top;
+		return;
+	}
+
+	// Window coordinates are inside the border, the grab is not
+	*x += capture->window_x + capture->window_attr.border_width;
+	*y += capture->window_y + capture->window_attr.border_width;
+}
+
+int
+Screen_SetBackend(Capture *capture, int backend)
+{
+	assert(capture);
+	assert(backend == SCREEN_XLIB || backend == SCREEN_XCB);
+
+	if (capture->replaying)
+	{
+		return SCREEN_XLIB;
+	}
+
+	assert(display);
+	// The next frame is grabbed as a whole, whatever the backend
+	if (capture->pending)
+	{
+		Screen_Collect(capture);
+	}
+	capture->first = 1;
+	Screen_DamageAll(capture);
+
+	if (backend == SCREEN_XCB && !capture->spare)
+	{
+		capture->spare = Screen_CreateBuffer(capture, &capture->spare_info);
+	}
+	capture->backend = backend;
+
+	return backend;
+}
+
+long long
+Screen_Waited(const Capture *capture, long long *hidden)
+{
+	assert(capture);
+
+	if (hidden)
+	{
+		*hidden = capture->hidden;
+	}
+
+	return capture->waited;
+}
+
+Display *
+Screen_Display(void)
+{
+	return display;
 }
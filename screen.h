@@ -30,6 +30,20 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <X11/Xlib.h>
 
+/**
+ * @brief The capture state of one window.
+ *
+ * Every captured window has its own buffers and damage, all of them share
+ * the X connection. A capture is only used by one thread at a time.
+ */
+typedef struct Capture Capture;
+
+/**
+ * @def SCREEN_MAX_WINDOWS
+ * @brief The maximum number of windows captured at once.
+ */
+#define SCREEN_MAX_WINDOWS 16
+
 /**
  * @brief Initialize the screen capture component.
  * 
@@ -38,42 +52,252 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
  * window to the front and is prepared for frame grabbing.
  * 
  * @param [in] name The name on the window that want to be captured.
- * @return The pixmap memory address of the captured window.
+ * @return The capture of the window, see Screen_Buffer() for its pixmap.
  * @retval NULL Unable to locate window or initialize the XShm X11 extension.
  */
-XImage *
+Capture *
 Screen_Initialize(const char *name);
 
+/**
+ * @brief Initialize the screen capture component for every matching window.
+ *
+ * Like Screen_Initialize(), but prepares all windows whose name starts
+ * with the supplied name.
+ *
+ * @param [in] name The name on the windows that want to be captured.
+ * @param [out] captures The captures of the windows.
+ * @param [in] max The size of captures, at most SCREEN_MAX_WINDOWS are used.
+ * @return The number of windows found.
+ * @retval 0 Unable to locate a window or initialize the XShm X11 extension.
+ */
+int
+Screen_InitializeAll(const char *name, Capture **captures, int max);
+
+/**
+ * @brief Initialize the screen capture component with a capture log.
+ *
+ * The frames are replayed from the log instead of grabbed from a window,
+ * no X server is needed. Screen_Get(), Screen_GetDamage() and
+ * Screen_TranslateCoordinates() behave just like during the recording.
+ *
+ * @param [in] filename The capture log, from Screen_Record().
+ * @param [in] paced If the frames should be replayed at the recorded speed,
+ * otherwise as fast as possible.
+ * @return The capture of the replayed frames.
+ * @retval NULL Unable to open the capture log.
+ * @attention Only one capture log can be replayed at a time.
+ */
+Capture *
+Screen_Replay(const char *filename, int paced);
+
+/**
+ * @brief Record every grabbed frame into a capture log.
+ *
+ * @param [in,out] capture The window.
+ * @param [in] filename The capture log, an existing file is replaced.
+ * @return If the capture log could be created.
+ * @attention Only one window can be recorded at a time.
+ */
+int
+Screen_Record(Capture *capture, const char *filename);
+
 /**
  * @brief Deinitialization the screen capture component.
  *
- * Free used system resources.
+ * Free used system resources, the X connection is closed together with
+ * the last window.
+ *
+ * @param [in] capture The window, not valid after the call.
  */
 void
-Screen_Deinitialize(void);
+Screen_Deinitialize(Capture *capture);
+
+/**
+ * @def SCREEN_MAX_DAMAGE
+ * @brief The maximum number of damaged rectangles kept per frame.
+ *
+ * If the window reports more damaged areas than this, they are merged
+ * into their bounding box.
+ */
+#define SCREEN_MAX_DAMAGE 32
 
 /**
  * @brief Grabs a new (current) frame of the captured window.
  *
  * Updates the memory area with a new frame grab. Hence the previously
  * acquired pixmap pointer is now updated with a new/current frame.
+ * When the XDamage extension is available only the areas of the window
+ * that were redrawn since the last call are copied, see Screen_GetDamage().
+ * The window may be moved at any time. When it was resized the buffer is
+ * replaced by one of the new size, damaged as a whole, hence the pixmap
+ * has to be retrieved again with Screen_Buffer().
+ *
+ * @param [in,out] capture The window.
+ * @return The number of damaged rectangles in the new frame.
+ * @retval 0 Nothing has changed since the last frame.
+ * @retval -1 The replayed capture log has ended.
+ * @attention A successful call to Screen_Initialize() or Screen_Replay()
+ * has to be performed before a call to this function.
+ */
+int
+Screen_Get(Capture *capture);
+
+/**
+ * @brief Check if there is anything to grab.
+ *
+ * Handles the pending map and visibility events of the window.
+ *
+ * @param [in,out] capture The window.
+ * @return If the window is mapped and not fully obscured.
+ * @attention Compositing window managers report every mapped window as
+ * visible.
+ */
+int
+Screen_Visible(Capture *capture);
+
+/**
+ * @brief Block until the window is visible again.
+ *
+ * Returns at once if Screen_Visible() is true, otherwise it sleeps until
+ * the window is mapped and (partially) visible.
+ *
+ * @param [in,out] capture The window.
+ */
+void
+Screen_WaitVisible(Capture *capture);
+
+/**
+ * @brief Retrieve the damaged areas of the last grabbed frame.
  *
+ * The rectangles are in captured image coordinates and never overlap
+ * the image border. Without the XDamage extension the whole image is
+ * reported as damaged on every frame.
+ *
+ * @param [in] capture The window.
+ * @param [out] count The number of damaged rectangles.
+ * @return The damaged rectangles, valid until the next Screen_Get().
+ */
+const XRectangle *
+Screen_GetDamage(const Capture *capture, int *count);
+
+/**
+ * @def SCREEN_BUFFERS
+ * @brief The maximum number of shared frame buffers.
+ */
+#define SCREEN_BUFFERS 3
+
+/**
+ * @brief Allocate more shared frame buffers.
+ *
+ * The buffer that Screen_Get() grabs into is buffer 0. More buffers
+ * let one frame be grabbed while earlier ones are still processed.
+ *
+ * @param [in,out] capture The window.
+ * @param [in] count The wanted number of buffers, at most SCREEN_BUFFERS.
+ * @return The number of buffers.
  * @attention A successful call to Screen_Initialize() has to be performed
  * before a call to this function.
  */
+int
+Screen_AllocateBuffers(Capture *capture, int count);
+
+/**
+ * @brief Retrieve one of the shared frame buffers.
+ * @param [in] capture The window.
+ * @param [in] index The buffer number.
+ * @return The pixmap memory address of the buffer.
+ */
+XImage *
+Screen_Buffer(const Capture *capture, int index);
+
+/**
+ * @brief Grabs a whole new frame into one of the shared frame buffers.
+ *
+ * Unlike Screen_Get() the damage is not tracked, every buffer has to be
+ * complete on its own. Like Screen_Get() the buffer is replaced when the
+ * window was resized.
+ *
+ * @param [in,out] capture The window.
+ * @param [in] index The buffer number.
+ */
 void
-Screen_Get(void);
+Screen_GetInto(Capture *capture, int index);
+
+/**
+ * @def SCREEN_XLIB
+ * @brief Grab with Xlib, only the damaged rows are copied.
+ *
+ * Screen_Get() waits while the X server copies the frame.
+ */
+#define SCREEN_XLIB 0
+
+/**
+ * @def SCREEN_XCB
+ * @brief Grab with XCB, the next frame is copied while the last one is processed.
+ *
+ * Screen_Get() hands out the frame requested by the call before, and
+ * requests the next one before it returns. Whole frames are copied, the
+ * damage still tells what changed.
+ */
+#define SCREEN_XCB 1
+
+/**
+ * @brief Select how Screen_Get() grabs the frames.
+ *
+ * The default is SCREEN_XLIB. Screen_GetInto() always uses Xlib.
+ *
+ * @param [in,out] capture The window.
+ * @param [in] backend SCREEN_XLIB or SCREEN_XCB.
+ * @return The backend in use, a replay has no other than SCREEN_XLIB.
+ */
+int
+Screen_SetBackend(Capture *capture, int backend);
+
+/**
+ * @brief Tell how long the last Screen_Get() waited for the X server.
+ * @param [in] capture The window.
+ * @param [out] hidden How long the frame was copied before Screen_Get()
+ * was called, while the caller did other work. Always 0 with SCREEN_XLIB.
+ * NULL if not wanted.
+ * @return The time in nanoseconds.
+ */
+long long
+Screen_Waited(const Capture *capture, long long *hidden);
+
+/**
+ * @brief Retrieve the shared X connection.
+ *
+ * Other components can use the connection too, like the mouse (see
+ * Mouse_Share()).
+ *
+ * @return The connection, NULL if no window is captured.
+ */
+Display *
+Screen_Display(void);
+
+/**
+ * @brief Retrieve the captured window.
+ * @param [in] capture The window.
+ * @return The window id.
+ * @retval None The frames are replayed from a capture log.
+ */
+Window
+Screen_Window(const Capture *capture);
 
 /**
  * @brief Translate local coordinates in system wide world coordinates.
  * 
  * This function translates coordinates that a local inside one window
- * into coordinates into is on your screen.
+ * into coordinates into is on your screen. The position of the window is
+ * kept up to date from its events, no round trip to the X server is made.
+ * Those events are handled by the thread that grabs the frames, so only
+ * that thread may call this; others use the origin of the frame they have.
  * 
+ * @param [in] capture The window.
  * @param [in,out] x The x-coordinate.
  * @param [in,out] y The y-coordinate.
  */
 void
-Screen_TranslateCoordinates(int *x, int *y);
+Screen_TranslateCoordinates(const Capture *capture, int *x, int *y);
 
 #endif
@@ -0,0 +1,103 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file spsc.hpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief A lock-free single producer, single consumer queue.
+ */
+
+#ifndef __SPSC_H__
+#define __SPSC_H__
+
+// C++ Standard Library headers
+#include <atomic>
+
+// C++ (C Standard Library) headers
+#include <cstddef>
+
+/**
+ * @class Spsc
+ * @brief A bounded lock-free queue for exactly one producer and one consumer.
+ *
+ * A ring buffer where only the producer moves the tail and only the
+ * consumer moves the head, so no locks are needed.
+ * @par More info here:
+ * - http://en.wikipedia.org/wiki/Circular_buffer
+ *
+ * @tparam T The element type.
+ * @tparam N The number of slots, the queue holds at most N - 1 elements.
+ */
+template <typename T, size_t N>
+class Spsc
+{
+public:
+	Spsc(void) : head(0), tail(0) {}
+
+	/**
+	 * @brief Add an element, only call this from the producer.
+	 * @param [in] item The element.
+	 * @return If there was room for the element.
+	 */
+	bool
+	push(const T &item)
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		const size_t next = (t + 1) % N;
+		if (next == head.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+
+		items[t] = item;
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief Remove the oldest element, only call this from the consumer.
+	 * @param [out] item The element.
+	 * @return If there was an element.
+	 */
+	bool
+	pop(T &item)
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire))
+		{
+			return false;
+		}
+
+		item = items[h];
+		head.store((h + 1) % N, std::memory_order_release);
+		return true;
+	}
+
+private:
+	T items[N];
+
+	// Keep the producer and consumer ends on separate cache lines
+	std::atomic<size_t> head;
+	char padding[64];
+	std::atomic<size_t> tail;
+};
+
+#endif
@@ -0,0 +1,230 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file ssd.c
+ * The sum of squared differences component compares a template with an
+ * image at every position, in integers. The differences of two template
+ * columns are interleaved into 16 bit lanes and squared and summed
+ * pairwise by the multiply-add instruction (pmaddwd) into 32 bit lanes,
+ * every lane holds one position. The kernels are vectorized with SSE4.1
+ * or AVX2 depending on what the CPU supports.
+ * @par More info:
+ * - http://en.wikipedia.org/wiki/Template_matching
+ * - http://en.wikipedia.org/wiki/Advanced_Vector_Extensions
+ *
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The sum of squared differences component implementation.
+ */
+
+// C Standard Library headers
+#include <assert.h>
+#include <stdio.h>
+
+// Local C headers
+#include "ssd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SSD_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief A row kernel, the sums of cols positions starting at src.
+ *
+ * The width is in bytes, the vectorized kernels only handle one channel.
+ */
+typedef void (*Ssd_Row)(const unsigned char *src, size_t step, const unsigned char *templ, size_t tstep, int width, int height, int channels, int cols, int *dst);
+
+static Ssd_Row row = NULL;
+static char kernel[32] = "scalar";
+
+static void
+Row_Scalar(const unsigned char *src, size_t step, const unsigned char *templ, size_t tstep, int width, int height, int channels, int cols, int *dst)
+{
+	int x;
+	for (x = 0; x < cols; ++x, src += channels)
+	{
+		int total = 0, r, i;
+		for (r = 0; r < height; ++r)
+		{
+			const unsigned char *s = src + r * step;
+			const unsigned char *t = templ + r * tstep;
+			for (i = 0; i < width; ++i)
+			{
+				const int d = s[i] - t[i];
+				total += d * d;
+			}
+		}
+		dst[x] = total;
+	}
+}
+
+#ifdef SSD_X86
+
+/*
+ * Eight (SSE4.1) or sixteen (AVX2) positions at a time. The pixels under
+ * template column c and c + 1 are widened to 16 bits and the template
+ * pixels subtracted, the interleaved differences (a, b) are turned into
+ * a * a + b * b by one multiply-add.
+ */
+
+__attribute__((target("sse4.1")))
+static void
+Row_SSE41(const unsigned char *src, size_t step, const unsigned char *templ, size_t tstep, int width, int height, int channels, int cols, int *dst)
+{
+	const __m128i zero = _mm_setzero_si128();
+
+	int x;
+	for (x = 0; x + 8 <= cols; x += 8)
+	{
+		__m128i lo = zero, hi = zero;
+		int r;
+		for (r = 0; r < height; ++r)
+		{
+			const unsigned char *s = src + r * step + x;
+			const unsigned char *t = templ + r * tstep;
+			int c;
+			for (c = 0; c + 2 <= width; c += 2)
+			{
+				__m128i a = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(s + c))), _mm_set1_epi16(t[c]));
+				__m128i b = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(s + c + 1))), _mm_set1_epi16(t[c + 1]));
+				__m128i l = _mm_unpacklo_epi16(a, b);
+				__m128i h = _mm_unpackhi_epi16(a, b);
+				lo = _mm_add_epi32(lo, _mm_madd_epi16(l, l));
+				hi = _mm_add_epi32(hi, _mm_madd_epi16(h, h));
+			}
+
+			// An odd width leaves one column, paired with zeroes
+			if (c < width)
+			{
+				__m128i a = _mm_sub_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i *)(s + c))), _mm_set1_epi16(t[c]));
+				__m128i l = _mm_unpacklo_epi16(a, zero);
+				__m128i h = _mm_unpackhi_epi16(a, zero);
+				lo = _mm_add_epi32(lo, _mm_madd_epi16(l, l));
+				hi = _mm_add_epi32(hi, _mm_madd_epi16(h, h));
+			}
+		}
+
+		_mm_storeu_si128((__m128i *)(dst + x), lo);
+		_mm_storeu_si128((__m128i *)(dst + x + 4), hi);
+	}
+
+	Row_Scalar(src + x, step, templ, tstep, width, height, channels, cols - x, dst + x);
+}
+
+__attribute__((target("avx2")))
+static void
+Row_AVX2(const unsigned char *src, size_t step, const unsigned char *templ, size_t tstep, int width, int height, int channels, int cols, int *dst)
+{
+	const __m256i zero = _mm256_setzero_si256();
+
+	int x;
+	for (x = 0; x + 16 <= cols; x += 16)
+	{
+		__m256i lo = zero, hi = zero;
+		int r;
+		for (r = 0; r < height; ++r)
+		{
+			const unsigned char *s = src + r * step + x;
+			const unsigned char *t = templ + r * tstep;
+			int c;
+			for (c = 0; c + 2 <= width; c += 2)
+			{
+				__m256i a = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s + c))), _mm256_set1_epi16(t[c]));
+				__m256i b = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s + c + 1))), _mm256_set1_epi16(t[c + 1]));
+				__m256i l = _mm256_unpacklo_epi16(a, b);
+				__m256i h = _mm256_unpackhi_epi16(a, b);
+				lo = _mm256_add_epi32(lo, _mm256_madd_epi16(l, l));
+				hi = _mm256_add_epi32(hi, _mm256_madd_epi16(h, h));
+			}
+
+			// An odd width leaves one column, paired with zeroes
+			if (c < width)
+			{
+				__m256i a = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(s + c))), _mm256_set1_epi16(t[c]));
+				__m256i l = _mm256_unpacklo_epi16(a, zero);
+				__m256i h = _mm256_unpackhi_epi16(a, zero);
+				lo = _mm256_add_epi32(lo, _mm256_madd_epi16(l, l));
+				hi = _mm256_add_epi32(hi, _mm256_madd_epi16(h, h));
+			}
+		}
+
+		// The unpacks work within 128 bit lanes: lo holds positions 0-3 and 8-11, hi 4-7 and 12-15
+		_mm256_storeu_si256((__m256i *)(dst + x), _mm256_permute2x128_si256(lo, hi, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + x + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+	}
+
+	Row_SSE41(src + x, step, templ, tstep, width, height, channels, cols - x, dst + x);
+}
+
+#endif
+
+void
+Ssd_Initialize(void)
+{
+	if (row)
+	{
+		return;
+	}
+
+	Ssd_Row best = Row_Scalar;
+	const char *name = "scalar";
+
+#ifdef SSD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		best = Row_AVX2;
+		name = "avx2";
+	}
+	else if (__builtin_cpu_supports("sse4.1"))
+	{
+		best = Row_SSE41;
+		name = "sse4.1";
+	}
+#endif
+
+	snprintf(kernel, sizeof (kernel), "%s", name);
+
+	row = best;
+}
+
+const char *
+Ssd_Kernel(void)
+{
+	return kernel;
+}
+
+void
+Ssd_Compute(const unsigned char *src, size_t step, const unsigned char *templ, size_t tstep, int width, int height, int channels, int cols, int rows, int *dst, size_t dst_step)
+{
+	assert(row);
+	assert(width * height * channels <= SSD_MAX_AREA);
+
+	const Ssd_Row compute = channels == 1 ? row : Row_Scalar;
+	int y;
+	for (y = 0; y < rows; ++y)
+	{
+		compute(src + y * step, step, templ, tstep, width * channels, height, channels, cols, dst + y * dst_step);
+	}
+}
@@ -0,0 +1,81 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/**
+ * @file ssd.h
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The sum of squared differences component API.
+ */
+
+#ifndef __SSD_H__
+#define __SSD_H__
+
+// C Standard Library headers
+#include <stddef.h>
+
+/**
+ * @def SSD_MAX_AREA
+ * @brief The largest template (in bytes) whose sums fit in 32 bits.
+ *
+ * Every byte adds at most 255 * 255, 33025 of them stay below 2^31.
+ */
+#define SSD_MAX_AREA 33025
+
+/**
+ * @brief Initialize the sum of squared differences component.
+ *
+ * Probes the CPU for supported instruction sets and selects the fastest
+ * kernel (AVX2, SSE4.1 or plain C). Calling it more than once is harmless.
+ */
+void
+Ssd_Initialize(void);
+
+/**
+ * @brief Name of the selected kernel.
+ * @return A description like "avx2".
+ */
+const char *
+Ssd_Kernel(void);
+
+/**
+ * @brief The sum of squared differences of a template at every position.
+ *
+ * The sums are exact, they are accumulated in 16 and 32 bit integers.
+ * Only single channel images use the vectorized kernels.
+ *
+ * @param [in] src The searched image, pixel (0, 0) of the searched area.
+ * @param [in] step The number of bytes per row in the searched image.
+ * @param [in] templ The template image.
+ * @param [in] tstep The number of bytes per row in the template image.
+ * @param [in] width The width of the template.
+ * @param [in] height The height of the template.
+ * @param [in] channels The number of bytes per pixel in both images.
+ * @param [in] cols The number of positions per row.
+ * @param [in] rows The number of rows of positions.
+ * @param [out] dst The sums, one per position.
+ * @param [in] dst_step The number of sums per row in dst.
+ * @attention The template may hold at most SSD_MAX_AREA bytes.
+ */
+void
+Ssd_Compute(const unsigned char *src, size_t step, const unsigned char *templ, size_t tstep, int width, int height, int channels, int cols, int rows, int *dst, size_t dst_step);
+
+#endif
@@ -0,0 +1,173 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file stats.cpp
+ * The statistics component serves its reports on a Unix stream socket,
+ * every connection gets one report and is closed.
+ * @par More info about the used library:
+ * - http://man7.org/linux/man-pages/man7/unix.7.html
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The statistics component implementation.
+ */
+
+// C++ Standard Library headers
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+// C++ (C Standard Library) headers
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+// POSIX headers
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Local C++ headers
+#include "stats.hpp"
+
+/**
+ * @brief The names of the stages, in report order.
+ */
+static const char *names[Stats::STAGES] = {"grab", "prepare", "match", "act", "sleep", "wait"};
+
+Stats::Stats(const char *path) : frames(0), hits(0), started(timer_now()), listener(-1)
+{
+	memset(histograms, 0, sizeof (histograms));
+	memset(&hidden, 0, sizeof (hidden));
+	if (!path)
+	{
+		return;
+	}
+
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof (address));
+	address.sun_family = AF_UNIX;
+	assert(strlen(path) < sizeof (address.sun_path));
+	strncpy(address.sun_path, path, sizeof (address.sun_path) - 1);
+
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert(listener >= 0);
+
+	unlink(path);
+	if (bind(listener, reinterpret_cast<struct sockaddr *>(&address), sizeof (address)) != 0 || listen(listener, 4) != 0)
+	{
+		std::cerr << "Stats: Unable to listen on " << path << std::endl;
+		close(listener);
+		listener = -1;
+		return;
+	}
+
+	this->path = path;
+	server = std::thread(&Stats::serve, this);
+	std::cout << "Stats: " << path << std::endl;
+}
+
+Stats::~Stats(void)
+{
+	if (listener < 0)
+	{
+		return;
+	}
+
+	// Wakes up the blocking accept()
+	shutdown(listener, SHUT_RDWR);
+	server.join();
+	close(listener);
+	unlink(path.c_str());
+}
+
+std::string
+Stats::report(void) const
+{
+	const double uptime = (timer_now() - started) / 1e9;
+	const unsigned long long f = frames.load(std::memory_order_relaxed);
+	const unsigned long long h = hits.load(std::memory_order_relaxed);
+
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1);
+	out << "uptime " << uptime << " s" << std::endl;
+	out << "frames " << f << " (" << f / uptime << " fps)" << std::endl;
+	out << "hits " << h << " (" << h * 3600.0 / uptime << " per hour)" << std::endl;
+
+	out << "stage\tcount\tp50 us\tp99 us\tmax us\ttotal s" << std::endl;
+	double working = 0, resting = 0;
+	for (int i = 0; i < STAGES; ++i)
+	{
+		const struct timer_histogram &hist = histograms[i];
+		const unsigned long long sum = __atomic_load_n(&hist.sum, __ATOMIC_RELAXED);
+		out << names[i] << "\t" << __atomic_load_n(&hist.count, __ATOMIC_RELAXED) << "\t"
+			<< timer_percentile(&hist, 50) / 1e3 << "\t" << timer_percentile(&hist, 99) / 1e3 << "\t"
+			<< __atomic_load_n(&hist.max, __ATOMIC_RELAXED) / 1e3 << "\t" << sum / 1e9 << std::endl;
+
+		(i == SLEEP || i == WAIT ? resting : working) += sum / 1e9;
+	}
+
+	// The pipeline stages overlap, hence the shares instead of the uptime
+	const double total = working + resting > 0 ? working + resting : 1;
+	out << "working " << working * 100 / total << "%, sleeping " << resting * 100 / total << "%" << std::endl;
+
+	// The grabs requested ahead, the share of their copying that nobody waited for
+	if (__atomic_load_n(&hidden.count, __ATOMIC_RELAXED) > 0)
+	{
+		const double hide = __atomic_load_n(&hidden.sum, __ATOMIC_RELAXED) / 1e9;
+		const double wait = __atomic_load_n(&histograms[GRAB].sum, __ATOMIC_RELAXED) / 1e9;
+		out << "grab hidden " << hide << " s, p50 " << timer_percentile(&hidden, 50) / 1e3 << " us, " << (hide + wait > 0 ? hide * 100 / (hide + wait) : 0) << "% of the grab wait" << std::endl;
+	}
+
+	return out.str();
+}
+
+/**
+ * @brief Answer every connection with a report, until the socket is shut down.
+ */
+void
+Stats::serve(void)
+{
+	while (true)
+	{
+		int client = accept(listener, NULL, NULL);
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+			{
+				continue;
+			}
+			break;
+		}
+
+		const std::string text = report();
+		size_t written = 0;
+		while (written < text.size())
+		{
+			ssize_t res = send(client, text.data() + written, text.size() - written, MSG_NOSIGNAL);
+			if (res <= 0)
+			{
+				break;
+			}
+			written += res;
+		}
+		close(client);
+	}
+}
@@ -0,0 +1,157 @@
+/*
+Copyright 2011 Marcus Stjärnås
+
+This file is part of Grorld.
+
+Grorld is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Grorld is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file stats.hpp
+ * @author Marcus Stjärnås
+ * @date July, 2011
+ * @version 1
+ * @brief The statistics component API.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+// C++ Standard Library headers
+#include <atomic>
+#include <string>
+#include <thread>
+
+// Local C headers
+extern "C"
+{
+#include "timer.h"
+}
+
+/**
+ * @class Stats
+ * @brief Keeps latency histograms of the stages of the main loop.
+ *
+ * Recording is lock-free and may be done from any thread. A report with
+ * the frame rate, hits per hour and the p50/p99/max latency of every
+ * stage is served on a Unix socket, read it with for example
+ * "nc -U /tmp/grorld.sock".
+ * @par More info here:
+ * - http://en.wikipedia.org/wiki/Unix_domain_socket
+ */
+class Stats
+{
+public:
+	/**
+	 * @brief The timed stages.
+	 */
+	enum Stage
+	{
+		GRAB, ///< Screen_Get() and friends
+		PREPARE, ///< Match::prepare()
+		MATCH, ///< Match::match() of every template
+		ACT, ///< Moving and clicking the mouse
+		SLEEP, ///< Resting between two frames
+		WAIT, ///< Waiting for another thread
+		STAGES ///< The number of stages
+	};
+
+	/**
+	 * @brief Constructor.
+	 *
+	 * @param [in] path The Unix socket to serve the reports on, NULL for none.
+	 * An existing socket file is replaced.
+	 */
+	Stats(const char *path);
+	~Stats(void);
+
+	/**
+	 * @brief Record the time spent in a stage.
+	 * @param [in] stage The stage.
+	 * @param [in] ns The time in nanoseconds.
+	 */
+	void
+	record(Stage stage, long long ns)
+	{
+		timer_record(&histograms[stage], ns);
+	}
+
+	/**
+	 * @brief Record the time spent in a stage since a point in time.
+	 *
+	 * Chain the calls to time stage after stage with one clock read each.
+	 *
+	 * @param [in] stage The stage.
+	 * @param [in] since When the stage started, from timer_now().
+	 * @return The current time, when the next stage starts.
+	 */
+	long long
+	lap(Stage stage, long long since)
+	{
+		const long long now = timer_now();
+		record(stage, now - since);
+		return now;
+	}
+
+	/**
+	 * @brief Record the part of a grab that was done while other work went on.
+	 * @param [in] ns The time in nanoseconds, see Screen_Waited().
+	 */
+	void
+	hide(long long ns)
+	{
+		timer_record(&hidden, ns);
+	}
+
+	/**
+	 * @brief Count a processed frame.
+	 */
+	void
+	frame(void)
+	{
+		frames.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief Count a hit.
+	 */
+	void
+	hit(void)
+	{
+		hits.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @brief Create a report of everything recorded so far.
+	 * @return The report, one line per item.
+	 */
+	std::string
+	report(void) const;
+
+private:
+	void
+	serve(void);
+
+	struct timer_histogram histograms[STAGES];
+	struct timer_histogram hidden;
+	std::atomic<unsigned long long> frames;
+	std::atomic<unsigned long long> hits;
+	long long started;
+
+	std::string path;
+	int listener;
+	std::thread server;
+};
+
+#endif
@@ -22,7 +22,7 @@ along with Grorld.  If not, see <http://www.gnu.org/licenses/>.
  * @author Marcus Stjärnås
  * @date July, 2011
  * @version 1
- * @brief A simplistic timer API & implementation.
+ * @brief A simplistic timer API & implementation, with latency histograms.
  */
 
 #ifndef __TIMER_H__
@@ -88,4 +88,140 @@ millis_to_timespec(long ms)
 	return ts;
 }
 
+/**
+ * @brief The current time of the monotonic clock.
+ * @return The time in nanoseconds.
+ */
+inline long long
+timer_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+/**
+ * @def TIMER_SUB_BITS
+ * @brief Every power of two is split into 2^TIMER_SUB_BITS histogram buckets.
+ *
+ * Hence a recorded time is off by at most 1/16 (6.25%).
+ */
+#define TIMER_SUB_BITS 4
+
+/**
+ * @def TIMER_BUCKETS
+ * @brief The number of buckets needed for every 64 bit time.
+ */
+#define TIMER_BUCKETS ((64 - TIMER_SUB_BITS + 1) << TIMER_SUB_BITS)
+
+/**
+ * @brief A histogram of times, with a logarithmic bucket size.
+ *
+ * The buckets are linear within each power of two, like a HDR histogram.
+ * All updates are atomic, several threads can record into the same
+ * histogram without locks. Zero initialize it before use.
+ * @par More info here:
+ * - http://hdrhistogram.github.io/HdrHistogram/
+ */
+struct timer_histogram
+{
+	unsigned long long counts[TIMER_BUCKETS]; ///< Number of times per bucket
+	unsigned long long count; ///< Number of recorded times
+	unsigned long long sum; ///< Sum of all times
+	unsigned long long max; ///< The longest time
+};
+
+/**
+ * @brief The histogram bucket of a time.
+ * @param [in] ns The time.
+ * @return The bucket.
+ */
+inline int
+timer_bucket(unsigned long long ns)
+{
+	if (ns < (1ull << TIMER_SUB_BITS))
+	{
+		return ns;
+	}
+
+	const int exponent = 63 - __builtin_clzll(ns);
+	const int shift = exponent - TIMER_SUB_BITS;
+	return ((shift + 1) << TIMER_SUB_BITS) + ((ns >> shift) & ((1ull << TIMER_SUB_BITS) - 1));
+}
+
+/**
+ * @brief The highest time that ends up in a histogram bucket.
+ * @param [in] bucket The bucket.
+ * @return The time.
+ */
+inline unsigned long long
+timer_bucket_max(int bucket)
+{
+	if (bucket < (1 << TIMER_SUB_BITS))
+	{
+		return bucket;
+	}
+
+	const int shift = (bucket >> TIMER_SUB_BITS) - 1;
+	const unsigned long long first = ((1ull << TIMER_SUB_BITS) + (bucket & ((1 << TIMER_SUB_BITS) - 1))) << shift;
+	return first + ((1ull << shift) - 1);
+}
+
+/**
+ * @brief Add a time to a histogram.
+ * @param [in,out] h The histogram.
+ * @param [in] ns The time, negative times are recorded as 0.
+ */
+inline void
+timer_record(struct timer_histogram *h, long long ns)
+{
+	const unsigned long long t = ns > 0 ? ns : 0;
+
+	__atomic_fetch_add(&h->counts[timer_bucket(t)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, t, __ATOMIC_RELAXED);
+
+	unsigned long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (t > max && !__atomic_compare_exchange_n(&h->max, &max, t, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	{
+	}
+}
+
+/**
+ * @brief A percentile of the times in a histogram.
+ * @param [in] h The histogram.
+ * @param [in] percent The percentile.
+ * @return The highest time of the bucket holding the percentile, but never
+ * more than the longest time. 0 if the histogram is empty.
+ */
+inline unsigned long long
+timer_percentile(const struct timer_histogram *h, double percent)
+{
+	const unsigned long long count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+	const unsigned long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	// The nearest rank, the buckets may be a bit ahead of the count
+	unsigned long long rank = (unsigned long long)(percent / 100.0 * count + 0.999999);
+	rank = rank < 1 ? 1 : rank;
+
+	unsigned long long seen = 0;
+	int i;
+	for (i = 0; i < TIMER_BUCKETS; ++i)
+	{
+		seen += __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+		if (seen >= rank)
+		{
+			const unsigned long long t = timer_bucket_max(i);
+			return t < max ? t : max;
+		}
+	}
+
+	return max;
+}
+
 #endif